@@ -0,0 +1,150 @@
+#include "LinePatch.h"
+
+#include <algorithm>
+
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+static const char NO_NEWLINE[] = "\\ No newline at end of file\n";
+
+std::vector<llvm::StringRef> LinePatch::splitLines(llvm::StringRef buffer) {
+    std::vector<llvm::StringRef> lines;
+    for (size_t pos = 0; pos < buffer.size();) {
+        size_t end = buffer.find('\n', pos);
+        end = end == llvm::StringRef::npos ? buffer.size() : end + 1;
+        lines.push_back(buffer.slice(pos, end));
+        pos = end;
+    }
+    return lines;
+}
+
+void LinePatch::writeHeader(llvm::raw_ostream &os, llvm::StringRef oldName, llvm::StringRef newName) {
+    os << "--- " << oldName << "\n+++ " << newName << "\n";
+}
+
+static void writeLine(llvm::raw_ostream &os, char prefix, llvm::StringRef line) {
+    os << prefix << line;
+    if (!line.endswith("\n")) os << "\n" << NO_NEWLINE;
+}
+
+void LinePatch::writeHunk(llvm::raw_ostream &os, size_t start, llvm::ArrayRef<llvm::StringRef> oldLines,
+                          llvm::ArrayRef<llvm::StringRef> newLines) {
+    // an empty side starts at the line before, as in diff -U0
+    os << "@@ -" << (oldLines.empty() ? start - 1 : start) << "," << oldLines.size() << " +"
+       << (newLines.empty() ? start - 1 : start) << "," << newLines.size() << " @@\n";
+    for (auto line : oldLines) writeLine(os, '-', line);
+    for (auto line : newLines) writeLine(os, '+', line);
+}
+
+void LinePatch::writeDiff(llvm::raw_ostream &os, llvm::ArrayRef<llvm::StringRef> oldLines,
+                          llvm::ArrayRef<llvm::StringRef> newLines) {
+    size_t size = std::max(oldLines.size(), newLines.size());
+    auto differs = [&](size_t i) { return i >= oldLines.size() || i >= newLines.size() || oldLines[i] != newLines[i]; };
+    for (size_t i = 0; i < size;) {
+        if (!differs(i)) {
+            i++;
+            continue;
+        }
+        size_t end = i + 1;
+        while (end < size && differs(end)) end++;
+        auto slice = [&](llvm::ArrayRef<llvm::StringRef> lines) {
+            return lines.slice(std::min(i, lines.size()), std::min(end, lines.size()) - std::min(i, lines.size()));
+        };
+        writeHunk(os, i + 1, slice(oldLines), slice(newLines));
+        i = end;
+    }
+}
+
+bool LinePatch::writeDiffToFile(const std::string &oldFile, const std::string &newFile, const std::string &patchFile) {
+    auto oldBuffer = llvm::MemoryBuffer::getFile(oldFile), newBuffer = llvm::MemoryBuffer::getFile(newFile);
+    if (!oldBuffer || !newBuffer) {
+        llvm::errs() << "Failed to read '" << (oldBuffer ? newFile : oldFile) << "'.\n";
+        return false;
+    }
+    std::error_code ec;
+    llvm::raw_fd_ostream os(patchFile, ec, llvm::sys::fs::OF_None);
+    if (ec) {
+        llvm::errs() << "Failed to write '" << patchFile << "': " << ec.message() << "\n";
+        return false;
+    }
+    writeHeader(os, oldFile, newFile);
+    writeDiff(os, splitLines((*oldBuffer)->getBuffer()), splitLines((*newBuffer)->getBuffer()));
+    return true;
+}
+
+std::string LinePatch::getOldName(llvm::StringRef patch) {
+    for (auto line : splitLines(patch)) {
+        if (line.startswith("@@")) break;
+        if (line.consume_front("--- ")) return line.rtrim("\r\n").split('\t').first.str();
+    }
+    return "";
+}
+
+// "@@ -start,count +start,count @@" (a count of 1 may be omitted)
+static bool parseRange(llvm::StringRef &text, char sign, size_t &start, size_t &count) {
+    text = text.ltrim(' ');
+    if (!text.consume_front(llvm::StringRef(&sign, 1)) || text.consumeInteger(10, start)) return false;
+    count = 1;
+    return !text.consume_front(",") || !text.consumeInteger(10, count);
+}
+
+bool LinePatch::apply(llvm::StringRef patch, llvm::ArrayRef<llvm::StringRef> base, llvm::raw_ostream &os,
+                      std::string &error) {
+    std::vector<llvm::StringRef> lines = splitLines(patch);
+    size_t next = 0;  // the first line of the base not written yet
+    size_t oldLeft = 0, newLeft = 0;
+    for (size_t i = 0; i < lines.size(); i++) {
+        llvm::StringRef line = lines[i];
+        std::string where = "line " + std::to_string(i + 1) + " of the patch";
+        if (oldLeft == 0 && newLeft == 0) {
+            // headers and comments between the hunks
+            if (!line.startswith("@@")) continue;
+            llvm::StringRef header = line.drop_front(2);
+            size_t oldStart, newStart;
+            if (!parseRange(header, '-', oldStart, oldLeft) || !parseRange(header, '+', newStart, newLeft)) {
+                error = "invalid hunk header at " + where;
+                return false;
+            }
+            // an empty old side inserts after its start line
+            size_t first = oldLeft == 0 ? oldStart : oldStart - 1;
+            if (first < next || first > base.size()) {
+                error = "hunk at " + where + " out of order or beyond the end of the file";
+                return false;
+            }
+            for (; next < first; next++) os << base[next];
+            continue;
+        }
+
+        // an empty context line may have lost its space
+        char op = line.startswith("\n") ? ' ' : line[0];
+        std::string text = line.startswith("\n") ? line.str() : line.drop_front().str();
+        if (i + 1 < lines.size() && lines[i + 1].startswith("\\")) {
+            if (!text.empty() && text.back() == '\n') text.pop_back();
+            i++;
+        }
+        if (op == ' ' || op == '-') {
+            if (oldLeft == 0 || (op == ' ' && newLeft == 0) || next >= base.size() || base[next] != text) {
+                error = "the file does not match the hunk at " + where;
+                return false;
+            }
+            if (op == ' ') {
+                os << text;
+                newLeft--;
+            }
+            next++;
+            oldLeft--;
+        } else if (op == '+' && newLeft > 0) {
+            os << text;
+            newLeft--;
+        } else {
+            error = "unexpected " + where;
+            return false;
+        }
+    }
+    if (oldLeft || newLeft) {
+        error = "truncated hunk at the end of the patch";
+        return false;
+    }
+    for (; next < base.size(); next++) os << base[next];
+    return true;
+}
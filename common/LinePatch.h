@@ -0,0 +1,41 @@
+#ifndef LINE_PATCH_H
+#define LINE_PATCH_H
+
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+/// \brief Results stored as patches against the debloated file
+///
+/// The fixer and cov_augment only replace lines of the debloated file with lines of the original (or
+/// with exits), so a result is the list of the replaced lines. Patches are unified diffs without
+/// context lines, written hunk by hunk: "patch -o result.c debloated.c < result.patch" or linepatch
+/// apply them.
+class LinePatch {
+   public:
+    // the lines of a buffer, with their '\n'
+    static std::vector<llvm::StringRef> splitLines(llvm::StringRef buffer);
+
+    // "--- oldName" and "+++ newName"
+    static void writeHeader(llvm::raw_ostream &os, llvm::StringRef oldName, llvm::StringRef newName);
+    // one hunk per run of lines that differ, line i of the old file being compared with line i of the new one
+    static void writeDiff(llvm::raw_ostream &os, llvm::ArrayRef<llvm::StringRef> oldLines,
+                          llvm::ArrayRef<llvm::StringRef> newLines);
+    // the patch turning the file `oldFile` into `newFile`
+    static bool writeDiffToFile(const std::string &oldFile, const std::string &newFile, const std::string &patchFile);
+
+    // the file named in "--- ", empty if none
+    static std::string getOldName(llvm::StringRef patch);
+    // writes `base` patched with the hunks of `patch`, which must match the lines they replace
+    static bool apply(llvm::StringRef patch, llvm::ArrayRef<llvm::StringRef> base, llvm::raw_ostream &os,
+                      std::string &error);
+
+   private:
+    static void writeHunk(llvm::raw_ostream &os, size_t start, llvm::ArrayRef<llvm::StringRef> oldLines,
+                          llvm::ArrayRef<llvm::StringRef> newLines);
+};
+
+#endif  // LINE_PATCH_H
@@ -1,22 +1,30 @@
 #include "CovAugment.h"
 
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <iterator>
 #include <optional>
+#include <thread>
+#include <unordered_set>
 #include <vector>
 
 #include "FileManager.h"
+#include "LinePatch.h"
 #include "SourceManager.h"
 #include "clang/AST/ParentMapContext.h"
 #include "llvm/ADT/Optional.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Process.h"
 #include "llvm/Support/Program.h"
 
 static int currentVisitingDeclStartLine = -1;
 
-const int n_keywords = 7;
-std::string keywords[n_keywords] = {"abort", "exit", "free", "error", "die", "usage", "close"};
-
 void CovAugment::Initialize(clang::ASTContext &Ctx) {
     Context = &Ctx;
     collectionVisitor = new CovAugmentAstVisitor(this);
@@ -25,183 +33,698 @@ void CovAugment::Initialize(clang::ASTContext &Ctx) {
 void CovAugment::HandleTranslationUnit(clang::ASTContext &Ctx) {
     collectionVisitor->TraverseDecl(Ctx.getTranslationUnitDecl());
 
-    std::vector<LineRange> to_replace_with_exit;
-    std::vector<LineRange> to_add_back;
+    // index the dependencies by line
+    std::stable_sort(dependencies.begin(), dependencies.end(),
+                     [](const Dependency &a, const Dependency &b) { return a.line < b.line; });
+    const clang::SourceManager &SM = Ctx.getSourceManager();
+    llvm::StringRef source = SM.getBufferData(SM.getMainFileID());
+    // keywords of all lines, in one pass over the source (range queries only OR masks)
+    lineKeywords = KeywordScanner(opt_keywords).scanAllLines(source);
+
+    if (!indexFile.empty() && saveIndex(indexFile))
+        llvm::outs() << "Saved the index of the original program to '" << indexFile << "'.\n";
+    if (!runJobs(source)) exit(1);
+}
 
-    // filter out if statements that are in empty functions
-    for (auto const &emptyFunction : emptyFunctions) {
-        // llvm::outs() << "Empty function: " << emptyFunction.first << "-" << emptyFunction.second << "\n";
-        ifStmts.erase(std::remove_if(ifStmts.begin(), ifStmts.end(),
-                                     [emptyFunction, this](const IfStmt &if_stmt) {
-                                         auto range = getStartAndEnd(if_stmt.if_stmt);
-                                         return range.first >= emptyFunction.first &&
-                                                range.second <= emptyFunction.second;
-                                     }),
-                      ifStmts.end());
-    }
-
-    // add exit to empty functions with __noreturn__ attribute
+bool CovAugment::runJobs(llvm::StringRef source) {
+    int maxLine = dependencies.empty() ? 0 : dependencies.back().line;
+    dependenciesByLine.assign(maxLine + 2, 0);
+    for (auto const &dep : dependencies) dependenciesByLine[dep.line + 1]++;
+    for (int line = 1; line <= maxLine + 1; line++) dependenciesByLine[line] += dependenciesByLine[line - 1];
+
+    // the functions containing each if
+    enclosingFunctions.assign(ifStmts.size(), {});
+    for (size_t i = 0; i < ifStmts.size(); i++) {
+        for (size_t f = 0; f < functions.size(); f++) {
+            if (ifStmts[i].range.first >= functions[f].range.first && ifStmts[i].range.second <= functions[f].range.second)
+                enclosingFunctions[i].push_back(f);
+        }
+    }
+
+    // the jobs only read the index and the lines of the original
+    originalLines = LinePatch::splitLines(source);
+    // the workers stop at the first error, exiting is left to the caller
+    std::atomic<size_t> nextJob(0);
+    std::atomic<bool> failed(false);
+    auto worker = [&]() {
+        for (size_t i; !failed && (i = nextJob++) < jobs.size();)
+            if (!augment(jobs[i])) failed = true;
+    };
+    std::vector<std::thread> threads;
+    // with --minimize, the tests of each job use the threads
+    unsigned jobThreads = opt_minimize ? 1 : numThreads;
+    for (size_t i = 1; i < std::min<size_t>(jobThreads, jobs.size()); i++) threads.emplace_back(worker);
+    worker();
+    for (auto &thread : threads) thread.join();
+    return !failed;
+}
+
+// sorted, overlapping and adjacent ranges are merged
+static std::vector<LineRange> mergeRanges(std::vector<LineRange> ranges) {
+    std::sort(ranges.begin(), ranges.end());
+    std::vector<LineRange> merged;
+    for (auto const &range : ranges) {
+        if (!merged.empty() && range.first <= merged.back().second + 1)
+            merged.back().second = std::max(merged.back().second, range.second);
+        else
+            merged.push_back(range);
+    }
+    return merged;
+}
+
+// an arm that never ran is augmented if it was removed (exit is only inserted into compound arms,
+// as in the exit strategy)
+static void augmentNeverTakenArm(const IfArm &arm, bool add_back, bool insert_exit,
+                                 const std::function<bool(int)> &lineIsRemoved, std::vector<LineRange> &to_add_back,
+                                 std::vector<LineRange> &to_replace_with_exit) {
+    if (!arm.exists) return;
+    auto range = arm.first;
+    if (range.first < 0 || range.second < 0 || !lineIsRemoved(range.first)) return;
+
+    if (add_back) {
+        auto range = arm.range;
+        if (range.first > 0 && range.second > 0) to_add_back.push_back(range);
+    } else if (insert_exit && arm.is_compound) {
+        auto range = arm.last;
+        if (range.first > 0 && range.second > 0) to_replace_with_exit.push_back(std::make_pair(range.second, range.second));
+    }
+}
+
+// whether a line of `ranges` is in `lines`
+static bool intersects(const std::vector<LineRange> &ranges, const std::set<int> &lines) {
+    for (auto const &range : ranges) {
+        auto it = lines.lower_bound(range.first);
+        if (it != lines.end() && *it <= range.second) return true;
+    }
+    return false;
+}
+
+bool CovAugment::augment(const AugmentationJob &job) {
+    std::vector<LineRange> to_add_back, to_replace_with_exit;
+    collectSites(job, to_add_back, to_replace_with_exit);
+
+    if (opt_minimize) {
+        std::vector<AugmentationSite> sites;
+        for (auto const &range : to_add_back) sites.push_back({false, range});
+        for (auto const &range : to_replace_with_exit) sites.push_back({true, range});
+        std::sort(sites.begin(), sites.end());
+        sites.erase(std::unique(sites.begin(), sites.end()), sites.end());
+        if (!minimizeSites(job, sites)) return false;
+        to_add_back.clear();
+        to_replace_with_exit.clear();
+        for (auto const &site : sites) (site.is_exit ? to_replace_with_exit : to_add_back).push_back(site.range);
+    }
+
+    return writeAugmentation(job, to_add_back, to_replace_with_exit, job.outputFile, opt_patch);
+}
+
+// the ranges the strategies add back (without their dependencies) and the lines where they insert exit,
+// decided for each function then for each if; with --index-cache, the decisions of the previous run of
+// the job are reused unless one of the lines they looked up was removed or added back since
+void CovAugment::collectSites(const AugmentationJob &job, std::vector<LineRange> &to_add_back,
+                              std::vector<LineRange> &to_replace_with_exit) {
+    std::string sitesFile = getSitesFile(job);
+    std::set<int> previousLines, changed;
+    std::vector<StrategyDecision> decisions;
+    bool cached = !sitesFile.empty() && loadSites(sitesFile, previousLines, decisions) &&
+                  decisions.size() == functions.size() + ifStmts.size();
+    if (cached)
+        std::set_symmetric_difference(previousLines.begin(), previousLines.end(), job.debloatedLines.begin(),
+                                      job.debloatedLines.end(), std::inserter(changed, changed.end()));
+    else
+        decisions.assign(functions.size() + ifStmts.size(), StrategyDecision());
+
+    for (size_t d = 0; d < decisions.size(); d++) {
+        if (cached && !intersects(decisions[d].watched, changed)) continue;
+        decisions[d] = StrategyDecision();
+        if (d < functions.size())
+            decideFunction(job, functions[d], decisions[d]);
+        else
+            decideIf(job, d - functions.size(), decisions[d]);
+        decisions[d].watched = mergeRanges(decisions[d].watched);
+    }
+    if (!sitesFile.empty() && (!cached || !changed.empty())) saveSites(sitesFile, job.debloatedLines, decisions);
+
+    for (auto const &decision : decisions) {
+        to_add_back.insert(to_add_back.end(), decision.to_add_back.begin(), decision.to_add_back.end());
+        to_replace_with_exit.insert(to_replace_with_exit.end(), decision.to_replace_with_exit.begin(),
+                                    decision.to_replace_with_exit.end());
+    }
+}
+
+// add exit to empty functions with __noreturn__ attribute (the ifs of other empty functions are skipped)
+void CovAugment::decideFunction(const AugmentationJob &job, const FunctionRange &func, StrategyDecision &decision) {
+    if (!func.is_no_return || func.first_line <= 0) return;
+    decision.watched.push_back(std::make_pair(func.first_line, func.first_line));
+    if (!job.debloatedLines.count(func.first_line)) return;
     // TODO: change exit message
-    for (auto const &func : emptyNoReturnFunctions) {
-        if (func.second - func.first >= 2) {
-            to_replace_with_exit.push_back(std::make_pair(func.second - 1, func.second - 1));
-        } else {
-            to_replace_with_exit.push_back(std::make_pair(func.first, func.first));
+    if (func.range.second - func.range.first >= 2) {
+        decision.to_replace_with_exit.push_back(std::make_pair(func.range.second - 1, func.range.second - 1));
+    } else {
+        decision.to_replace_with_exit.push_back(std::make_pair(func.range.first, func.range.first));
+    }
+}
+
+void CovAugment::decideIf(const AugmentationJob &job, size_t index, StrategyDecision &decision) {
+    const IfStmt &if_stmt = ifStmts[index];
+    const std::set<int> &removed = job.debloatedLines;
+    // every line looked up is watched
+    std::function<bool(int)> lineIsRemoved = [&removed, &decision](int line) {
+        decision.watched.push_back(std::make_pair(line, line));
+        return removed.find(line) != removed.end();
+    };
+    auto hasStrategy = [&job](const char *strategy) { return job.strategies.find(strategy) != job.strategies.end(); };
+    std::vector<LineRange> &to_add_back = decision.to_add_back;
+    std::vector<LineRange> &to_replace_with_exit = decision.to_replace_with_exit;
+
+    // filter out if statements that are in empty functions
+    for (size_t f : enclosingFunctions[index]) {
+        auto const &func = functions[f];
+        if (!func.is_no_return && func.first_line > 0 && lineIsRemoved(func.first_line)) return;
+    }
+    // if if-condition got removed, skip
+    auto range = if_stmt.cond;
+    if (range.first < 0 || range.second < 0) return;
+    if (lineIsRemoved(range.first)) return;
+
+    // keywords of the removed lines only (they only matter to the keyword strategy)
+    auto rangeContainsKeyword = [this, &lineIsRemoved](LineRange range) {
+        if (range.first < 0 || range.second < 0) return false;
+        uint64_t mask = 0;
+        for (int line = range.first; line <= range.second && line < (int)lineKeywords.size(); line++)
+            if (lineKeywords[line] && lineIsRemoved(line)) mask |= lineKeywords[line];
+        return mask != 0;
+    };
+    bool is_keyword = hasStrategy("keyword") && !if_stmt.is_symmetrical &&
+                      std::any_of(if_stmt.keyword_ranges.begin(), if_stmt.keyword_ranges.end(), rangeContainsKeyword);
+    // the code after an if could be considered as a branch, if this is if-return/if-exit/...
+    auto branchAfterIf = [&lineIsRemoved](const IfStmt &if_stmt) {
+        if (lineIsRemoved(if_stmt.range.first)) return LineRange(-1, -1);
+        if (if_stmt.next.first > 0 && if_stmt.next.second > 0 && lineIsRemoved(if_stmt.next.first)) return if_stmt.next;
+        return LineRange(-1, -1);
+    };
+
+    // with branch coverage, the arms that never ran are targeted directly (the heuristics below
+    // only choose between adding them back and inserting exit)
+    if (if_stmt.has_branch_coverage) {
+        bool add_back = (if_stmt.is_symmetrical && hasStrategy("sym_assign")) || is_keyword;
+        bool insert_exit = hasStrategy("exit");
+        if (if_stmt.then_count == 0)
+            augmentNeverTakenArm(if_stmt.then_arm, add_back, insert_exit, lineIsRemoved, to_add_back, to_replace_with_exit);
+        if (if_stmt.else_count == 0) {
+            // an else-if has its own branch coverage
+            if (if_stmt.has_else) {
+                augmentNeverTakenArm(if_stmt.else_arm, add_back, insert_exit, lineIsRemoved, to_add_back,
+                                     to_replace_with_exit);
+            } else if (insert_exit) {
+                auto range = branchAfterIf(if_stmt);
+                if (range.first > 0 && range.second > 0) to_replace_with_exit.push_back(std::make_pair(range.first, range.first));
+            }
         }
+        return;
     }
 
     // first pass: add back
-    for (auto const &if_stmt : ifStmts) {
-        // if if-condition got removed, skip
-        auto range = getStartAndEnd(if_stmt.if_stmt->getCond());
-        if (range.first < 0 || range.second < 0) continue;
-        if (lineIsRemoved(range.first)) continue;
-
-        if (if_stmt.is_symmetrical) {
-            if (opt_augmentation_strategies.find("sym_assign") != opt_augmentation_strategies.end()) {
-                // add back all deleted branches (if at least one branch is not deleted)
-                bool all_deleted = true;
+    if (if_stmt.is_symmetrical) {
+        if (hasStrategy("sym_assign")) {
+            // add back all deleted branches (if at least one branch is not deleted)
+            bool all_deleted = true;
+            for (auto const &branch : if_stmt.branches) {
+                auto range = branch.range;
+                if (range.first < 0 || range.second < 0) continue;
+                // only consider compound statements, only check the first statement
+                if (!branch.is_compound || branch.first_is_null) continue;
+                range = branch.first;
+                if (range.first < 0 || range.second < 0) continue;
+                if (!lineIsRemoved(range.first)) {
+                    all_deleted = false;
+                    break;
+                }
+            }
+            if (!all_deleted) {
                 for (auto const &branch : if_stmt.branches) {
-                    auto range = getStartAndEnd(branch);
+                    auto range = branch.range;
                     if (range.first < 0 || range.second < 0) continue;
-                    // only consider compound statements
-                    if (clang::CompoundStmt *CS = llvm::dyn_cast<clang::CompoundStmt>(branch)) {
-                        // only check the first statement
-                        if (CS->size() > 0) {
-                            clang::Stmt *first_stmt = CS->body_front();
-                            if (first_stmt && !llvm::isa<clang::NullStmt>(first_stmt)) {
-                                auto range = getStartAndEnd(first_stmt);
-                                if (range.first < 0 || range.second < 0) continue;
-                                if (!lineIsRemoved(range.first)) {
-                                    all_deleted = false;
-                                    break;
-                                }
-                            }
-                        }
-                    }
+                    to_add_back.push_back(range);
                 }
-                if (!all_deleted) {
-                    for (auto const &branch : if_stmt.branches) {
-                        auto range = getStartAndEnd(branch);
-                        if (range.first < 0 || range.second < 0) continue;
-                        to_add_back.push_back(range);
-                    }
-                }
-            }
-        } else if (if_stmt.is_keyword) {
-            if (opt_augmentation_strategies.find("keyword") != opt_augmentation_strategies.end()) {
-                // add back all deleted branches
-                // FIXME: need to add back if condition (for multi-line conditions)
-                auto range = getStartAndEnd(if_stmt.if_stmt);
-                if (range.first < 0 || range.second < 0) continue;
-                to_add_back.push_back(range);
-                // for (auto const &branch : if_stmt.branches) {
-                //     auto range = getStartAndEnd(branch);
-                //     if (range.first < 0 || range.second < 0) continue;
-                //     to_add_back.push_back(range);
-                // }
             }
         }
+    } else if (is_keyword) {
+        // add back all deleted branches
+        // FIXME: need to add back if condition (for multi-line conditions)
+        auto range = if_stmt.range;
+        if (range.first >= 0 && range.second >= 0) to_add_back.push_back(range);
     }
 
     // second pass: insert exit
-    if (opt_augmentation_strategies.find("exit") != opt_augmentation_strategies.end()) {
-        for (auto const &if_stmt : ifStmts) {
-            // if if-condition got removed, skip
-            auto range = getStartAndEnd(if_stmt.if_stmt->getCond());
+    if (!hasStrategy("exit")) return;
+    if (if_stmt.is_symmetrical && hasStrategy("sym_assign")) return;
+    if (is_keyword) return;
+    // replace deleted branches with exit
+    for (auto const &branch : if_stmt.branches) {
+        // only consider compound statements, only check the first statement
+        if (!branch.is_compound || branch.first_is_null) continue;
+        auto range = branch.first;
+        if (range.first < 0 || range.second < 0) continue;
+        bool removed_first = lineIsRemoved(range.first);
+        if (!removed_first && branch.nested_first != LineRange(-1, -1)) {
+            // TODO for nested compound statements (if () { {} })
+            auto range = branch.nested_first;
             if (range.first < 0 || range.second < 0) continue;
-            if (lineIsRemoved(range.first)) continue;
+            removed_first = lineIsRemoved(range.first);
+        }
+        if (removed_first) {
+            auto range = branch.last;
+            if (range.first < 0 || range.second < 0) continue;
+            // for multi-line statements, we need to insert exit at the end of the last line
+            to_replace_with_exit.push_back(std::make_pair(range.second, range.second));
+        }
+    }
+    auto range_after = branchAfterIf(if_stmt);
+    if (range_after.first > 0 && range_after.second > 0)
+        to_replace_with_exit.push_back(std::make_pair(range_after.first, range_after.first));
+}
 
-            if (if_stmt.is_symmetrical && opt_augmentation_strategies.find("sym_assign") != opt_augmentation_strategies.end())
-                continue;
-            if (if_stmt.is_keyword && opt_augmentation_strategies.find("keyword") != opt_augmentation_strategies.end())
-                continue;
-            // replace deleted branches with exit
-            for (auto const &branch : if_stmt.branches) {
-                // only consider compound statements
-                if (clang::CompoundStmt *CS = llvm::dyn_cast<clang::CompoundStmt>(branch)) {
-                    // only check the first statement
-                    clang::Stmt *last_stmt = nullptr;
-                    if (CS->size() > 0) {
-                        clang::Stmt *first_stmt = CS->body_front();
-                        if (first_stmt && !llvm::isa<clang::NullStmt>(first_stmt)) {
-                            auto range = getStartAndEnd(first_stmt);
-                            if (range.first < 0 || range.second < 0) continue;
-                            if (lineIsRemoved(range.first)) {
-                                last_stmt = CS->body_back();
-                            } else if (llvm::isa<clang::CompoundStmt>(first_stmt)) {
-                                // TODO for nested compound statements (if () { {} })
-                                clang::Stmt *_first_stmt = llvm::dyn_cast<clang::CompoundStmt>(first_stmt)->body_front();
-                                if (_first_stmt && !llvm::isa<clang::NullStmt>(_first_stmt)) {
-                                    auto range = getStartAndEnd(_first_stmt);
-                                    if (range.first < 0 || range.second < 0) continue;
-                                    if (lineIsRemoved(range.first)) {
-                                        last_stmt = CS->body_back();
-                                    }
-                                }
-                            }
-                        }
-                    }
-                    if (last_stmt) {
-                        auto range = getStartAndEnd(last_stmt);
-                        if (range.first < 0 || range.second < 0) continue;
-                        // for multi-line statements, we need to insert exit at the end of the last line
-                        to_replace_with_exit.push_back(std::make_pair(range.second, range.second));
-                    }
-                }
-            }
-            if (if_stmt.branch_after_if) {
-                auto range = getStartAndEnd(if_stmt.branch_after_if);
-                if (range.first < 0 || range.second < 0) continue;
-                to_replace_with_exit.push_back(std::make_pair(range.first, range.first));
+bool CovAugment::writeAugmentation(const AugmentationJob &job, std::vector<LineRange> to_add_back,
+                                   std::vector<LineRange> to_replace_with_exit, const std::string &outputFile,
+                                   bool asPatch) {
+    const std::set<int> &removed = job.debloatedLines;
+    auto lineIsRemoved = [&removed](int line) { return removed.find(line) != removed.end(); };
+
+    // also add back dependencies (FIXME: currently only declarations but no assignments)
+    // to_add_back is the worklist: the dependencies of each line are added once, if not added yet
+    auto key = [](LineRange range) { return (uint64_t)(uint32_t)range.first << 32 | (uint32_t)range.second; };
+    std::unordered_set<uint64_t> added;
+    for (auto const &range : to_add_back) added.insert(key(range));
+    std::vector<bool> expanded(dependenciesByLine.size());
+    for (size_t i = 0; i < to_add_back.size(); i++) {
+        auto range = to_add_back[i];
+        for (int line = std::max(range.first, 0); line <= range.second && line + 1 < (int)dependenciesByLine.size(); line++) {
+            if (expanded[line]) continue;
+            expanded[line] = true;
+            for (size_t d = dependenciesByLine[line]; d < dependenciesByLine[line + 1]; d++) {
+                auto const &dep = dependencies[d];
+                if (lineIsRemoved(dep.condition) && added.insert(key(dep.range)).second) to_add_back.push_back(dep.range);
             }
         }
     }
 
-    // also add back dependencies (FIXME: currently only declarations but no assignments)
-    for (bool dirty_flag = true; dirty_flag;) {
-        dirty_flag = false;
-        for (int i = 0; i < to_add_back.size(); i++) {
-            auto range = to_add_back[i];
-            for (int line = range.first; line <= range.second; line++) {
-                for (auto const &dep : mapLineToDependencies[line]) {
-                    if (std::find(to_add_back.begin(), to_add_back.end(), dep) == to_add_back.end()) {
-                        dirty_flag = true;
-                        to_add_back.push_back(dep);
-                    }
+    // one pass of the patcher: adding back a line twice changes nothing, so ranges are merged; an
+    // exit is inserted once per line
+    to_add_back = mergeRanges(to_add_back);
+    std::sort(to_replace_with_exit.begin(), to_replace_with_exit.end());
+    to_replace_with_exit.erase(std::unique(to_replace_with_exit.begin(), to_replace_with_exit.end()),
+                               to_replace_with_exit.end());
+
+    // the debloated file is patched in process: lines are added back from the original, exits are appended to lines
+    auto buffer = llvm::MemoryBuffer::getFile(job.debloatedFile);
+    if (!buffer) {
+        llvm::errs() << "Failed to read '" << job.debloatedFile << "'.\n";
+        return false;
+    }
+    std::vector<llvm::StringRef> debloatedLines = LinePatch::splitLines((*buffer)->getBuffer());
+    std::vector<std::string> lines(debloatedLines.begin(), debloatedLines.end());
+    if ((!to_add_back.empty() && to_add_back.back().second > (int)std::min(lines.size(), originalLines.size())) ||
+        (!to_replace_with_exit.empty() && to_replace_with_exit.back().first > (int)std::min(lines.size(), originalLines.size()))) {
+        llvm::errs() << "Augmented lines beyond the end of '" << job.debloatedFile << "'.\n";
+        return false;
+    }
+    for (auto const &range : to_add_back) {
+        for (int line = range.first; line <= range.second; line++) {
+            // don't replace if trimmed versions are equal (e.g.: "aaa" and "  aaa", preserving indentation in debloated program)
+            auto trim = [](llvm::StringRef text) { return text.trim(" \t\n\r").rtrim(';'); };
+            if (trim(lines[line - 1]) != trim(originalLines[line - 1])) lines[line - 1] = originalLines[line - 1].str();
+        }
+    }
+    for (auto const &range : to_replace_with_exit) {
+        // insert exit after, and preserve indentation
+        llvm::StringRef reference = originalLines[range.first - 1];
+        std::string indentation = reference.take_while([](char c) { return c == ' ' || c == '\t'; }).str();
+        lines[range.first - 1] = indentation + llvm::StringRef(lines[range.first - 1]).ltrim(" \t").rtrim().str() +
+                                 " printf(\"<This branch (L" + std::to_string(range.first) +
+                                 ") is removed by Cov debloating tool>\\n\"); exit(6);\n";
+    }
+
+    std::error_code ec;
+    llvm::raw_fd_ostream os(outputFile, ec, llvm::sys::fs::OF_None);
+    if (ec) {
+        llvm::errs() << "Failed to write '" << outputFile << "': " << ec.message() << "\n";
+        return false;
+    }
+    if (!asPatch) {
+        for (auto const &line : lines) os << line;
+        return true;
+    }
+    // only the replaced lines, against the debloated file; the new side is the augmented source it stands for
+    std::string augmentedName = llvm::StringRef(outputFile).endswith(".patch")
+                                    ? llvm::StringRef(outputFile).drop_back(6).str() + ".c"
+                                    : FileManager::getStemName(job.debloatedFile) + ".augmented.c";
+    LinePatch::writeHeader(os, job.debloatedFile, augmentedName);
+    LinePatch::writeDiff(os, debloatedLines, std::vector<llvm::StringRef>(lines.begin(), lines.end()));
+    return true;
+}
+
+// compiles the program augmented with `sites` (files numbered by `slot`, one per concurrent test) and runs the
+// test script; false if the scripts could not be run (the temp files are removed in any case)
+bool CovAugment::testSites(const AugmentationJob &job, const std::vector<AugmentationSite> &sites, unsigned slot,
+                           bool &passed) {
+    llvm::Optional<llvm::StringRef> redirect_to_null[] = {llvm::None, llvm::StringRef("/dev/null"),
+                                                          llvm::StringRef("/dev/null")};
+    std::vector<LineRange> to_add_back, to_replace_with_exit;
+    for (auto const &site : sites) (site.is_exit ? to_replace_with_exit : to_add_back).push_back(site.range);
+    std::string temp_file = job.outputFile + ".dd" + std::to_string(slot) + ".c";
+    std::string temp_bin_file = temp_file + ".out";
+    auto cleanUp = [&]() {
+        llvm::sys::fs::remove(temp_file);
+        llvm::sys::fs::remove(temp_bin_file);
+    };
+    if (!writeAugmentation(job, to_add_back, to_replace_with_exit, temp_file)) {
+        cleanUp();
+        return false;
+    }
+
+    passed = false;
+    int retcode = llvm::sys::ExecuteAndWait("/bin/bash", {"/bin/bash", opt_compile_script, temp_file, temp_bin_file},
+                                            llvm::None, redirect_to_null);
+    if (retcode < 0) {
+        llvm::errs() << "Fatal error in running compile script.\n";
+        llvm::errs() << "Using command: /bin/bash " << opt_compile_script << " " << temp_file << " " << temp_bin_file << "\n";
+        cleanUp();
+        return false;
+    }
+    if (retcode == 0) {
+        retcode = llvm::sys::ExecuteAndWait("/bin/bash", {"/bin/bash", opt_test_script, temp_bin_file}, llvm::None,
+                                            redirect_to_null);
+        if (retcode < 0) {
+            llvm::errs() << "Fatal error in running test script.\n";
+            llvm::errs() << "Using command: /bin/bash " << opt_test_script << " " << temp_bin_file << "\n";
+            cleanUp();
+            return false;
+        }
+        passed = (retcode == 0);
+    }
+
+    cleanUp();
+    return true;
+}
+
+// delta debugging (ddmin) of the sites that keep the test passing; the candidates of a round are
+// tested in parallel and the first passing one in order is taken, so the result does not depend
+// on the number of threads. False if a test could not be run.
+bool CovAugment::minimizeSites(const AugmentationJob &job, std::vector<AugmentationSite> &sites) {
+    // index of the first passing candidate (or the number of candidates); the candidates after a
+    // passing one are not tested, none is after an error
+    std::atomic<bool> failed(false);
+    auto testAll = [&](const std::vector<std::vector<AugmentationSite>> &candidates) {
+        std::atomic<size_t> next(0), firstPassed(candidates.size());
+        auto worker = [&](unsigned slot) {
+            for (size_t i; !failed && (i = next++) < candidates.size() && i < firstPassed;) {
+                bool passed;
+                if (!testSites(job, candidates[i], slot, passed)) {
+                    failed = true;
+                    break;
+                }
+                if (!passed) continue;
+                size_t first = firstPassed;
+                while (i < first && !firstPassed.compare_exchange_weak(first, i)) {}
+            }
+        };
+        std::vector<std::thread> threads;
+        for (unsigned t = 1; t < std::min<size_t>(numThreads, candidates.size()); t++) threads.emplace_back(worker, t);
+        worker(0);
+        for (auto &thread : threads) thread.join();
+        return size_t(firstPassed);
+    };
+
+    llvm::outs() << "Running delta debugging on '" << job.outputFile << "' - Size: " << sites.size() << "\n";
+    // nothing to minimize if no augmentation is needed, or if the full augmentation fails too
+    size_t first = testAll({{}, sites});
+    if (failed) return false;
+    if (first == 0) {
+        llvm::outs() << "                Success - Size: 0\n";
+        sites.clear();
+        return true;
+    }
+    if (first == 2) {
+        llvm::errs() << "The test fails with all augmentations of '" << job.outputFile << "', keeping them all.\n";
+        return true;
+    }
+
+    std::set<std::vector<AugmentationSite>> visited;
+    for (size_t n = 2; sites.size() >= 2;) {
+        n = std::min(n, sites.size());
+        // subsets, then complements (the same as the subsets for 2 chunks)
+        std::vector<std::vector<AugmentationSite>> candidates;
+        size_t numSubsets = 0;
+        for (int complement = 0; complement < (n > 2 ? 2 : 1); complement++) {
+            for (size_t i = 0; i < n; i++) {
+                size_t begin = i * sites.size() / n, end = (i + 1) * sites.size() / n;
+                std::vector<AugmentationSite> candidate;
+                if (complement) {
+                    candidate.insert(candidate.end(), sites.begin(), sites.begin() + begin);
+                    candidate.insert(candidate.end(), sites.begin() + end, sites.end());
+                } else {
+                    candidate.assign(sites.begin() + begin, sites.begin() + end);
                 }
+                if (!visited.insert(candidate).second) continue;
+                candidates.push_back(candidate);
+                if (!complement) numSubsets++;
             }
         }
+
+        size_t passed = testAll(candidates);
+        if (failed) return false;
+        if (passed < candidates.size()) {
+            sites = candidates[passed];
+            n = passed < numSubsets ? 2 : std::max<size_t>(n - 1, 2);
+            llvm::outs() << "                Success - Size: " << sites.size() << "\n";
+        } else if (n < sites.size()) {
+            n = std::min(n * 2, sites.size());
+        } else {
+            break;
+        }
     }
+    return true;
+}
 
-    llvm::sys::fs::copy_file(opt_debloated_file, outputFileName);
-    applyAugmentationToFile(to_add_back, false);
-    applyAugmentationToFile(to_replace_with_exit, true);
-}
-
-void CovAugment::applyAugmentationToFile(const std::vector<LineRange> &ranges, bool is_exit_replacement) {
-    // CANNOT use `sed -i 10c\ "$(sed -n 10p original_file)" outputFileName` (when 10th line is empty, it
-    // fails) use python instead
-    std::string rangesStr;
-    for (auto const &range : ranges)
-        rangesStr += std::to_string(range.first) + "-" + std::to_string(range.second) + ",";
-    std::string programDir = FileManager::getParentDir(llvm::sys::fs::getMainExecutable(nullptr, nullptr));
-    int ret;
-    if (is_exit_replacement) {
-        // llvm::outs() << "Apply exit replacement: " << rangesStr << "\n";
-        ret = llvm::sys::ExecuteAndWait("/usr/bin/python3",
-                                        {"/usr/bin/python3", programDir + "/apply-augmentation.py", "--exit",
-                                         "--lines", rangesStr, outputFileName, opt_original_file});
-    } else {
-        // llvm::outs() << "Apply add-back: " << rangesStr << "\n";
-        ret = llvm::sys::ExecuteAndWait("/usr/bin/python3",
-                                        {"/usr/bin/python3", programDir + "/apply-augmentation.py", "--lines",
-                                         rangesStr, outputFileName, opt_original_file});
+// bump when the index or the analysis changes, so that older indexes are not loaded
+static const char INDEX_VERSION[] = "cov_augment-index 2";
+
+std::string CovAugment::getIndexKey(llvm::StringRef source, const BranchCounts &branchCounts) {
+    llvm::MD5 md5;
+    md5.update(INDEX_VERSION);
+    md5.update(source);
+    for (auto const &keyword : opt_keywords) {
+        md5.update(keyword);
+        md5.update(llvm::StringRef("", 1));
+    }
+    for (auto const &count : branchCounts) {
+        LineRange target = std::get<2>(count.first);
+        md5.update(std::get<0>(count.first) + " " + std::to_string(std::get<1>(count.first)) + " " +
+                   std::to_string(target.first) + "-" + std::to_string(target.second) + " " +
+                   std::to_string(count.second) + "\n");
+    }
+    llvm::MD5::MD5Result result;
+    md5.final(result);
+    return std::string(result.digest().str());
+}
+
+static void writeRange(llvm::raw_ostream &os, LineRange range) { os << " " << range.first << " " << range.second; }
+static bool readRange(std::istream &is, LineRange &range) { return bool(is >> range.first >> range.second); }
+
+static void writeArm(llvm::raw_ostream &os, const IfArm &arm) {
+    os << " " << arm.exists << " " << arm.is_compound << " " << arm.first_is_null;
+    writeRange(os, arm.range);
+    writeRange(os, arm.first);
+    writeRange(os, arm.last);
+    writeRange(os, arm.nested_first);
+}
+static bool readArm(std::istream &is, IfArm &arm) {
+    return is >> arm.exists >> arm.is_compound >> arm.first_is_null && readRange(is, arm.range) &&
+           readRange(is, arm.first) && readRange(is, arm.last) && readRange(is, arm.nested_first);
+}
+
+// text, one record per line; written to a temporary file first, so concurrent runs read complete indexes
+bool CovAugment::saveIndex(const std::string &fileName) {
+    std::string tempFile = fileName + ".tmp" + std::to_string(llvm::sys::Process::getProcessId());
+    {
+        std::error_code ec;
+        llvm::raw_fd_ostream os(tempFile, ec, llvm::sys::fs::OF_Text);
+        if (ec) {
+            llvm::errs() << "Failed to write '" << tempFile << "': " << ec.message() << "\n";
+            return false;
+        }
+        os << INDEX_VERSION << "\n";
+        os << "functions " << functions.size() << "\n";
+        for (auto const &func : functions) {
+            writeRange(os, func.range);
+            os << " " << func.first_line << " " << func.is_no_return << "\n";
+        }
+        os << "dependencies " << dependencies.size() << "\n";
+        for (auto const &dep : dependencies) {
+            os << dep.line;
+            writeRange(os, dep.range);
+            os << " " << dep.condition << "\n";
+        }
+        os << "ifs " << ifStmts.size() << "\n";
+        for (auto const &if_stmt : ifStmts) {
+            writeRange(os, if_stmt.range);
+            writeRange(os, if_stmt.cond);
+            writeRange(os, if_stmt.next);
+            writeArm(os, if_stmt.then_arm);
+            writeArm(os, if_stmt.else_arm);
+            os << " " << if_stmt.has_else << " " << if_stmt.is_symmetrical << " " << if_stmt.has_branch_coverage << " "
+               << if_stmt.then_count << " " << if_stmt.else_count << " " << if_stmt.branches.size();
+            for (auto const &branch : if_stmt.branches) writeArm(os, branch);
+            os << " " << if_stmt.keyword_ranges.size();
+            for (auto const &range : if_stmt.keyword_ranges) writeRange(os, range);
+            os << "\n";
+        }
+        // only the lines with keywords
+        size_t numKeywordLines = std::count_if(lineKeywords.begin(), lineKeywords.end(), [](uint64_t mask) { return mask != 0; });
+        os << "keywords " << lineKeywords.size() << " " << numKeywordLines << "\n";
+        for (size_t line = 0; line < lineKeywords.size(); line++)
+            if (lineKeywords[line]) os << line << " " << lineKeywords[line] << "\n";
+    }
+    if (std::error_code ec = llvm::sys::fs::rename(tempFile, fileName)) {
+        llvm::errs() << "Failed to write '" << fileName << "': " << ec.message() << "\n";
+        llvm::sys::fs::remove(tempFile);
+        return false;
+    }
+    return true;
+}
+
+bool CovAugment::loadIndex(const std::string &fileName) {
+    std::ifstream is(fileName);
+    std::string version, section;
+    size_t count;
+    if (!std::getline(is, version) || version != INDEX_VERSION) return false;
+
+    if (!(is >> section >> count) || section != "functions") return false;
+    functions.resize(count);
+    for (auto &func : functions)
+        if (!readRange(is, func.range) || !(is >> func.first_line >> func.is_no_return)) return false;
+
+    if (!(is >> section >> count) || section != "dependencies") return false;
+    dependencies.resize(count);
+    for (auto &dep : dependencies)
+        if (!(is >> dep.line) || !readRange(is, dep.range) || !(is >> dep.condition)) return false;
+
+    if (!(is >> section >> count) || section != "ifs") return false;
+    ifStmts.resize(count);
+    for (auto &if_stmt : ifStmts) {
+        size_t numBranches, numKeywordRanges;
+        if (!readRange(is, if_stmt.range) || !readRange(is, if_stmt.cond) || !readRange(is, if_stmt.next) ||
+            !readArm(is, if_stmt.then_arm) || !readArm(is, if_stmt.else_arm) ||
+            !(is >> if_stmt.has_else >> if_stmt.is_symmetrical >> if_stmt.has_branch_coverage >> if_stmt.then_count >>
+              if_stmt.else_count >> numBranches))
+            return false;
+        if_stmt.branches.resize(numBranches);
+        for (auto &branch : if_stmt.branches)
+            if (!readArm(is, branch)) return false;
+        if (!(is >> numKeywordRanges)) return false;
+        if_stmt.keyword_ranges.resize(numKeywordRanges);
+        for (auto &range : if_stmt.keyword_ranges)
+            if (!readRange(is, range)) return false;
+    }
+
+    size_t numKeywordLines;
+    if (!(is >> section >> count >> numKeywordLines) || section != "keywords") return false;
+    lineKeywords.assign(count, 0);
+    for (size_t i = 0; i < numKeywordLines; i++) {
+        size_t line;
+        uint64_t mask;
+        if (!(is >> line >> mask) || line >= count) return false;
+        lineKeywords[line] = mask;
+    }
+    return true;
+}
+
+// bump when the decisions or their file change
+static const char SITES_VERSION[] = "cov_augment-sites 1";
+
+// next to the index, one per job (debloated file, strategies and output); empty without --index-cache
+std::string CovAugment::getSitesFile(const AugmentationJob &job) {
+    if (indexFile.empty()) return "";
+    llvm::MD5 md5;
+    for (auto const &field : {job.debloatedFile, job.outputFile}) {
+        md5.update(field);
+        md5.update(llvm::StringRef("", 1));
+    }
+    for (auto const &strategy : job.strategies) {
+        md5.update(strategy);
+        md5.update(llvm::StringRef("", 1));
+    }
+    llvm::MD5::MD5Result result;
+    md5.final(result);
+    return llvm::StringRef(indexFile).drop_back(llvm::StringRef(indexFile).endswith(".idx") ? 4 : 0).str() + "." +
+           std::string(result.digest().str()) + ".sites";
+}
+
+static void writeRanges(llvm::raw_ostream &os, const std::vector<LineRange> &ranges) {
+    os << " " << ranges.size();
+    for (auto const &range : ranges) writeRange(os, range);
+}
+static bool readRanges(std::istream &is, std::vector<LineRange> &ranges) {
+    size_t count;
+    if (!(is >> count)) return false;
+    ranges.resize(count);
+    for (auto &range : ranges)
+        if (!readRange(is, range)) return false;
+    return true;
+}
+
+// the removed lines of the job, then the watched lines and the sites of each decision
+bool CovAugment::saveSites(const std::string &fileName, const std::set<int> &debloatedLines,
+                           const std::vector<StrategyDecision> &decisions) {
+    std::string tempFile = fileName + ".tmp" + std::to_string(llvm::sys::Process::getProcessId());
+    {
+        std::error_code ec;
+        llvm::raw_fd_ostream os(tempFile, ec, llvm::sys::fs::OF_Text);
+        if (ec) {
+            llvm::errs() << "Failed to write '" << tempFile << "': " << ec.message() << "\n";
+            return false;
+        }
+        os << SITES_VERSION << "\n";
+        os << "removed " << debloatedLines.size() << "\n";
+        for (int line : debloatedLines) os << line << "\n";
+        os << "decisions " << decisions.size() << "\n";
+        for (auto const &decision : decisions) {
+            writeRanges(os, decision.watched);
+            writeRanges(os, decision.to_add_back);
+            writeRanges(os, decision.to_replace_with_exit);
+            os << "\n";
+        }
     }
-    if (ret != 0) {
-        llvm::errs() << "Failed to execute apply-augmentation.py (with args " << rangesStr << ")\n";
-        exit(1);
+    if (std::error_code ec = llvm::sys::fs::rename(tempFile, fileName)) {
+        llvm::errs() << "Failed to write '" << fileName << "': " << ec.message() << "\n";
+        llvm::sys::fs::remove(tempFile);
+        return false;
     }
+    return true;
+}
+
+bool CovAugment::loadSites(const std::string &fileName, std::set<int> &debloatedLines,
+                           std::vector<StrategyDecision> &decisions) {
+    std::ifstream is(fileName);
+    std::string version, section;
+    size_t count;
+    if (!std::getline(is, version) || version != SITES_VERSION) return false;
+
+    if (!(is >> section >> count) || section != "removed") return false;
+    for (size_t i = 0; i < count; i++) {
+        int line;
+        if (!(is >> line)) return false;
+        debloatedLines.insert(line);
+    }
+    if (!(is >> section >> count) || section != "decisions") return false;
+    decisions.resize(count);
+    for (auto &decision : decisions) {
+        if (!readRanges(is, decision.watched) || !readRanges(is, decision.to_add_back) ||
+            !readRanges(is, decision.to_replace_with_exit))
+            return false;
+    }
+    return true;
 }
 
 void CovAugment::addDependency(clang::Stmt *stmt) {
@@ -223,16 +746,13 @@ void CovAugment::addDependency(clang::Stmt *stmt) {
                 clang::Stmt *body = def->getBody();
                 if (body && llvm::isa<clang::CompoundStmt>(body)) {
                     clang::CompoundStmt *CS = llvm::dyn_cast<clang::CompoundStmt>(body);
-                    clang::Stmt *first_stmt = CS->body_front();
+                    clang::Stmt *first_stmt = CS->size() > 0 ? CS->body_front() : nullptr;
                     if (first_stmt && !llvm::isa<clang::NullStmt>(first_stmt)) {
                         auto range = getStartAndEnd(first_stmt);
-                        auto range_def = getStartAndEnd(def);
                         if (range.first > 0 && range.second > 0) {
-                            if (lineIsRemoved(range.first)) {
-                                addDependency(DRE, getStartAndEnd(FD));
-                                addDependency(DRE, getStartAndEnd(FD->getDefinition()));
-                                addDependency(DRE, getStartAndEnd(FD->getCanonicalDecl()));
-                            }
+                            addDependency(DRE, getStartAndEnd(FD), range.first);
+                            addDependency(DRE, getStartAndEnd(FD->getDefinition()), range.first);
+                            addDependency(DRE, getStartAndEnd(FD->getCanonicalDecl()), range.first);
                         }
                     }
                 }
@@ -248,27 +768,20 @@ void CovAugment::addDependency(clang::Stmt *stmt) {
             clang::Stmt *sub_stmt = LS->getSubStmt();
             if (sub_stmt && !llvm::isa<clang::NullStmt>(sub_stmt)) {
                 auto range = getStartAndEnd(sub_stmt);
-                if (range.first > 0 && range.second > 0) {
-                    if (lineIsRemoved(range.first)) {
-                        addDependency(GS, getRangeOfGotoLabel(LS));
-                    }
-                }
+                if (range.first > 0 && range.second > 0) addDependency(GS, getRangeOfGotoLabel(LS), range.first);
             }
         }
     }
 }
 void CovAugment::addDependency(clang::Stmt *stmt, clang::Decl *decl) {
     auto range_decl = getStartAndEnd(decl);
-    if (range_decl.first > 0 && range_decl.second > 0) {
-        if (lineIsRemoved(range_decl.first)) {
-            addDependency(stmt, range_decl);
-        }
-    }
+    if (range_decl.first > 0 && range_decl.second > 0) addDependency(stmt, range_decl, range_decl.first);
 }
-void CovAugment::addDependency(clang::Stmt *stmt, LineRange range_decl) {
+// the dependency only matters to the jobs that removed line `condition`
+void CovAugment::addDependency(clang::Stmt *stmt, LineRange range_decl, int condition) {
     auto range_stmt = getStartAndEnd(stmt);
     if (range_stmt.first > 0 && range_stmt.second > 0 && range_decl.first > 0 && range_decl.second > 0) {
-        mapLineToDependencies[range_stmt.first].insert(range_decl);
+        dependencies.push_back({range_stmt.first, range_decl, condition});
     }
 }
 
@@ -336,36 +849,29 @@ LineRange CovAugment::getRangeOfGotoLabel(clang::LabelStmt *LS) {
         return std::make_pair(-1, -1);
 }
 
-bool CovAugment::lineIsRemoved(int line) {
-    return debloatedLines.find(line) != debloatedLines.end();
-}
-bool CovAugment::functionIsRemoved(clang::FunctionDecl *FD) {
-    if (!FD) return false;
-    if (FD->isThisDeclarationADefinition()) {
-        clang::Stmt *body = FD->getBody();
-        // check if body is empty
-        if (body && llvm::isa<clang::CompoundStmt>(body)) {
-            clang::CompoundStmt *CS = llvm::dyn_cast<clang::CompoundStmt>(body);
-            clang::Stmt *first_stmt = CS->body_front();
-            if (first_stmt && !llvm::isa<clang::NullStmt>(first_stmt)) {
-                auto range = getStartAndEnd(first_stmt);
-                if (range.first > 0 && range.second > 0) {
-                    if (lineIsRemoved(range.first)) {
-                        return true;
-                    }
-                }
-            }
-            return false;
-        }
+IfArm CovAugment::getIfArm(clang::Stmt *arm) {
+    IfArm if_arm;
+    if (!arm || llvm::isa<clang::NullStmt>(arm)) return if_arm;
+    if_arm.exists = true;
+    if_arm.range = getStartAndEnd(arm);
+    if (clang::CompoundStmt *CS = llvm::dyn_cast<clang::CompoundStmt>(arm)) {
+        if_arm.is_compound = true;
+        if (CS->size() == 0) return if_arm;
+        clang::Stmt *first_stmt = CS->body_front();
+        if_arm.first = getStartAndEnd(first_stmt);
+        if_arm.last = getStartAndEnd(CS->body_back());
+        if_arm.first_is_null = !first_stmt || llvm::isa<clang::NullStmt>(first_stmt);
+        clang::CompoundStmt *nested = llvm::dyn_cast_or_null<clang::CompoundStmt>(first_stmt);
+        if (nested && nested->size() > 0 && nested->body_front() && !llvm::isa<clang::NullStmt>(nested->body_front()))
+            if_arm.nested_first = getStartAndEnd(nested->body_front());
     } else {
-        auto range = getStartAndEnd(FD);
-        if (range.first < 0 || range.second < 0) return false;
-        return lineIsRemoved(range.first);
+        if_arm.first = if_arm.last = if_arm.range;
     }
-    return false;
+    return if_arm;
 }
-bool CovAugment::ifBranchContainsKeyword(clang::Stmt *if_branch, std::string *keywords, int n_keywords) {
-    if (!if_branch || llvm::isa<clang::NullStmt>(if_branch)) return false;
+// statements of an if-branch whose removed lines are searched for keywords
+void CovAugment::getKeywordRanges(clang::Stmt *if_branch, std::vector<LineRange> &ranges) {
+    if (!if_branch || llvm::isa<clang::NullStmt>(if_branch)) return;
 
     // iterate over all first-level statements
     // FIXME: only consider compound statements
@@ -387,42 +893,13 @@ bool CovAugment::ifBranchContainsKeyword(clang::Stmt *if_branch, std::string *ke
             if (llvm::isa<clang::LabelStmt>(stmt)) break;
             // check for keywords
             if (llvm::isa<clang::CompoundStmt>(stmt)) {
-                if (ifBranchContainsKeyword(stmt, keywords, n_keywords)) {
-                    return true;
-                }
+                getKeywordRanges(stmt, ranges);
             } else {
-                if (rangeContainsKeyword(stmt->getSourceRange(), keywords, n_keywords)) {
-                    return true;
-                }
+                auto range = getStartAndEnd(stmt->getSourceRange());
+                if (range.first >= 0 && range.second >= 0) ranges.push_back(range);
             }
         }
     }
-
-    return false;
-}
-bool CovAugment::rangeContainsKeyword(clang::SourceRange range, std::string *keywords, int n_keywords) {
-    return rangeContainsKeyword(getStartAndEnd(range), keywords, n_keywords);
-}
-bool CovAugment::rangeContainsKeyword(LineRange range, std::string *keywords, int n_keywords) {
-    const clang::SourceManager &SM = Context->getSourceManager();
-
-    if (range.first < 0 || range.second < 0) return false;
-
-    for (int line = range.first; line <= range.second; line++) {
-        if (!lineIsRemoved(line)) continue;
-        std::string src =
-            SourceManager::GetSourceText(
-                SM, SM.translateLineCol(SM.getFileID(SM.getLocForStartOfFile(SM.getMainFileID())), line, 1),
-                SM.translateLineCol(SM.getFileID(SM.getLocForStartOfFile(SM.getMainFileID())), line, 1000))
-                .str();
-        for (int i = 0; i < n_keywords; i++) {
-            if (src.find(keywords[i]) != std::string::npos) {
-                return true;
-            }
-        }
-    }
-
-    return false;
 }
 
 bool CovAugmentAstVisitor::VisitDeclRefExpr(clang::DeclRefExpr *DRE) {
@@ -435,122 +912,96 @@ bool CovAugmentAstVisitor::VisitGotoStmt(clang::GotoStmt *GS) {
 }
 bool CovAugmentAstVisitor::VisitFunctionDecl(clang::FunctionDecl *FD) {
     if (FD->isThisDeclarationADefinition()) {
-        if (covAugment->functionIsRemoved(FD)) {
-            auto range = covAugment->getStartAndEnd(FD);
-            if (range.first > 0 && range.second > 0) {
-                clang::FunctionType const *FT = FD->getType()->getAs<clang::FunctionType>();
-                if (FT && FT->getNoReturnAttr()) {
-                    // if function is "__noreturn__", need to add exit if its body is removed
-                    covAugment->emptyNoReturnFunctions.push_back(range);
-                } else {
-                    covAugment->emptyFunctions.push_back(range);
+        FunctionRange func;
+        func.range = covAugment->getStartAndEnd(FD);
+        if (func.range.first > 0 && func.range.second > 0) {
+            // the body is removed if its first statement is
+            clang::Stmt *body = FD->getBody();
+            if (body && llvm::isa<clang::CompoundStmt>(body)) {
+                clang::CompoundStmt *CS = llvm::dyn_cast<clang::CompoundStmt>(body);
+                clang::Stmt *first_stmt = CS->size() > 0 ? CS->body_front() : nullptr;
+                if (first_stmt && !llvm::isa<clang::NullStmt>(first_stmt)) {
+                    auto range = covAugment->getStartAndEnd(first_stmt);
+                    if (range.first > 0 && range.second > 0) func.first_line = range.first;
                 }
             }
+            // if function is "__noreturn__", need to add exit if its body is removed
+            clang::FunctionType const *FT = FD->getType()->getAs<clang::FunctionType>();
+            func.is_no_return = FT && FT->getNoReturnAttr();
+            if (func.first_line > 0) covAugment->functions.push_back(func);
         }
     }
 
     return true;
 }
 bool CovAugmentAstVisitor::VisitIfStmt(clang::IfStmt *IS) {
-    const clang::SourceManager &SM = covAugment->Context->getSourceManager();
-
     IfStmt if_stmt;
-    if_stmt.if_stmt = IS;
-
-    auto if_range = covAugment->getStartAndEnd(IS);
+    if_stmt.range = covAugment->getStartAndEnd(IS);
+    if_stmt.cond = covAugment->getStartAndEnd(IS->getCond());
+
+    // edges of this if only (an else-if has its own), see "instrumenter --edges"
+    LineRange then_target = covAugment->getStartAndEnd(IS->getThen());
+    LineRange else_target = IS->getElse() ? covAugment->getStartAndEnd(IS->getElse()) : LineRange(0, 0);
+    auto then_count = covAugment->branchCounts.find(BranchKey("IF_THEN", if_stmt.range.first, then_target));
+    auto else_count = covAugment->branchCounts.find(BranchKey("IF_ELSE", if_stmt.range.first, else_target));
+    if (then_count != covAugment->branchCounts.end() && else_count != covAugment->branchCounts.end() &&
+        then_count->second + else_count->second > 0) {
+        if_stmt.has_branch_coverage = true;
+        if_stmt.then_count = then_count->second;
+        if_stmt.else_count = else_count->second;
+    }
+    if_stmt.then_arm = covAugment->getIfArm(IS->getThen());
+    if_stmt.has_else = IS->getElse() != nullptr;
+    if (IS->getElse() && !llvm::isa<clang::IfStmt>(IS->getElse())) if_stmt.else_arm = covAugment->getIfArm(IS->getElse());
 
+    std::vector<clang::Stmt *> branches;
     for (clang::IfStmt *_if = IS; _if;) {
-        if (_if->getThen() && !llvm::isa<clang::NullStmt>(_if->getThen()))
-            if_stmt.branches.push_back(_if->getThen());
+        if (_if->getThen() && !llvm::isa<clang::NullStmt>(_if->getThen())) branches.push_back(_if->getThen());
         if (_if->getElse() && !llvm::isa<clang::NullStmt>(_if->getElse())) {
-            if_stmt.branches.push_back(_if->getElse());
+            branches.push_back(_if->getElse());
             _if = llvm::dyn_cast<clang::IfStmt>(_if->getElse());
         } else {
             break;
         }
     }
+    for (auto const &branch : branches) if_stmt.branches.push_back(covAugment->getIfArm(branch));
 
     // the code after this ifstmt could be considered as a branch, if this is if-return/if-exit/...
-    if (!covAugment->lineIsRemoved(if_range.first)) {
-        auto parents = covAugment->Context->getParents(*IS);
-        if (!parents.empty() && parents[0].get<clang::Stmt>()) {
-            auto *parent = parents[0].get<clang::Stmt>();
-            clang::Stmt *prev = nullptr, *next = nullptr;
-            for (const clang::Stmt *child : parent->children()) {
-                if (prev == IS) next = const_cast<clang::Stmt *>(child);
-                prev = const_cast<clang::Stmt *>(child);
-            }
-            auto range = covAugment->getStartAndEnd(next);
-            if (range.first > 0 && range.second > 0) {
-                if (covAugment->lineIsRemoved(range.first)) {
-                    if_stmt.branch_after_if = next;
-                    // llvm::outs() << "Stmt after if-return: " << SM.getSpellingLineNumber(IS->getBeginLoc())
-                    //     << " -> " << SM.getSpellingLineNumber(next->getBeginLoc()) << "\n";
-                }
-            }
+    auto parents = covAugment->Context->getParents(*IS);
+    if (!parents.empty() && parents[0].get<clang::Stmt>()) {
+        auto *parent = parents[0].get<clang::Stmt>();
+        clang::Stmt *prev = nullptr, *next = nullptr;
+        for (const clang::Stmt *child : parent->children()) {
+            if (prev == IS) next = const_cast<clang::Stmt *>(child);
+            prev = const_cast<clang::Stmt *>(child);
         }
+        if_stmt.next = covAugment->getStartAndEnd(next);
     }
 
-    // symmetrical assignments
-    clang::DeclRefExpr *common_LHS = nullptr;
-    for (auto const &branch : if_stmt.branches) {
-        if (branch && !llvm::isa<clang::NullStmt>(branch)) {
-            if (clang::CompoundStmt *CS = llvm::dyn_cast<clang::CompoundStmt>(branch)) {
-                if (CS->size() == 1) {
-                    if (clang::BinaryOperator *BO = llvm::dyn_cast<clang::BinaryOperator>(CS->body_front())) {
-                        if (BO->isAssignmentOp()) {
-                            // llvm::outs() << "Possible symmetrical assignment: " <<
-                            // SM.getSpellingLineNumber(IS->getBeginLoc()) << "\n";
-                            if (clang::DeclRefExpr *LHS = llvm::dyn_cast<clang::DeclRefExpr>(BO->getLHS())) {
-                                if (!common_LHS) {
-                                    common_LHS = LHS;
-                                } else if (common_LHS->getDecl() == LHS->getDecl()) {
-                                    if_stmt.is_symmetrical = true;
-                                    covAugment->ifStmts.push_back(if_stmt);
-                                    // llvm::outs() << "Symmetrical assignment: "
-                                    //              << SM.getSpellingLineNumber(IS->getBeginLoc()) << "\n";
-                                    return true;
-                                }
-                            }
-                        }
-                    }
-                }
-            }
+    // symmetrical assignments: two branches of the same shape that assign (see StructuralHasher)
+    std::set<uint64_t> shapes;
+    for (auto const &branch : branches) {
+        clang::CompoundStmt *CS = llvm::dyn_cast<clang::CompoundStmt>(branch);
+        if (!CS || !covAugment->structuralHasher.hasAssignment(CS)) continue;
+        if (!shapes.insert(covAugment->structuralHasher.hash(CS)).second) {
+            if_stmt.is_symmetrical = true;
+            covAugment->ifStmts.push_back(if_stmt);
+            return true;
         }
     }
 
-    // keyword matching
-    for (auto const &branch : if_stmt.branches) {
-        if (branch && !llvm::isa<clang::NullStmt>(branch)) {
-            if (covAugment->ifBranchContainsKeyword(branch, keywords, n_keywords)) {
-                // llvm::outs() << "Found keyword in "
-                //              << SM.getSpellingLineNumber(IS->getBeginLoc()) << "\n";
-                if_stmt.is_keyword = true;
-                covAugment->ifStmts.push_back(if_stmt);
-                return true;
-            } else if (llvm::isa<clang::GotoStmt>(branch) ||
-                       (llvm::isa<clang::CompoundStmt>(branch) &&
-                        llvm::dyn_cast<clang::CompoundStmt>(branch)->size() == 1 &&
-                        llvm::isa<clang::GotoStmt>(
-                            llvm::dyn_cast<clang::CompoundStmt>(branch)->body_front()))) {
-                // llvm::outs() << "Found if-stmt containing goto-stmt "
-                //              << SM.getSpellingLineNumber(IS->getBeginLoc()) << "\n";
-                clang::GotoStmt *goto_stmt =
-                    llvm::isa<clang::GotoStmt>(branch)
-                        ? llvm::dyn_cast<clang::GotoStmt>(branch)
-                        : llvm::dyn_cast<clang::GotoStmt>(
-                              llvm::dyn_cast<clang::CompoundStmt>(branch)->body_front());
-                auto range = covAugment->getRangeOfGotoLabel(goto_stmt->getLabel()->getStmt());
-                if (range.first > 0 && range.second > 0) {
-                    if (covAugment->rangeContainsKeyword(range, keywords, n_keywords)) {
-                        // llvm::outs() << "Found keyword in goto label "
-                        //              << range.first << "-" << range.second << "\n";
-                        if_stmt.is_keyword = true;
-                        covAugment->ifStmts.push_back(if_stmt);
-                        return true;
-                    }
-                }
-            }
+    // keyword matching (in the branches, or in the code after the label of a goto branch)
+    for (auto const &branch : branches) {
+        covAugment->getKeywordRanges(branch, if_stmt.keyword_ranges);
+        if (llvm::isa<clang::GotoStmt>(branch) ||
+            (llvm::isa<clang::CompoundStmt>(branch) && llvm::dyn_cast<clang::CompoundStmt>(branch)->size() == 1 &&
+             llvm::isa<clang::GotoStmt>(llvm::dyn_cast<clang::CompoundStmt>(branch)->body_front()))) {
+            clang::GotoStmt *goto_stmt =
+                llvm::isa<clang::GotoStmt>(branch)
+                    ? llvm::dyn_cast<clang::GotoStmt>(branch)
+                    : llvm::dyn_cast<clang::GotoStmt>(llvm::dyn_cast<clang::CompoundStmt>(branch)->body_front());
+            auto range = covAugment->getRangeOfGotoLabel(goto_stmt->getLabel()->getStmt());
+            if (range.first > 0 && range.second > 0) if_stmt.keyword_ranges.push_back(range);
         }
     }
 
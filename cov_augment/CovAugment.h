@@ -4,12 +4,15 @@
 #include <map>
 #include <queue>
 #include <set>
+#include <tuple>
 #include <vector>
 
 #include "clang/AST/ASTConsumer.h"
 #include "clang/AST/ASTContext.h"
 #include "clang/AST/Expr.h"
 #include "clang/AST/RecursiveASTVisitor.h"
+#include "KeywordScanner.h"
+#include "StructuralHasher.h"
 #include "clang/Rewrite/Core/Rewriter.h"
 #include "llvm/Support/CommandLine.h"
 
@@ -20,16 +23,87 @@ using LineRangeVector = std::vector<LineRange>;
 using LineRangeSet = std::set<LineRange>;
 
 extern std::string opt_original_file;
-extern llvm::cl::opt<std::string> opt_debloated_file;
-extern std::set<std::string> opt_augmentation_strategies;
+extern std::vector<std::string> opt_keywords;
+extern llvm::cl::opt<bool> opt_minimize;
+extern llvm::cl::opt<bool> opt_patch;
+extern llvm::cl::opt<std::string> opt_compile_script;
+extern llvm::cl::opt<std::string> opt_test_script;
+
+// edge hit counts ("covmerge --edges"): (kind, line of the branch, lines of the target) -> count,
+// the target telling apart the branches on the same line ((0, 0) for an if without else)
+using BranchKey = std::tuple<std::string, int, LineRange>;
+using BranchCounts = std::map<BranchKey, uint64_t>;
+
+// one augmentation of the original program: a debloated variant, the strategies, the output file
+struct AugmentationJob {
+    std::string debloatedFile;
+    std::set<int> debloatedLines;
+    std::set<std::string> strategies;
+    std::string outputFile;
+};
+
+// The AST of the original program is reduced to the lines the strategies look at, so that it is
+// built once for all jobs and each job only needs its removed lines (a range of -1 is unknown).
+
+// the statement at `line` needs the lines of `range`, if line `condition` is removed
+struct Dependency {
+    int line;
+    LineRange range;
+    int condition;
+};
+
+// a function definition, empty if the first statement of its body is removed
+struct FunctionRange {
+    LineRange range;
+    int first_line = -1;
+    bool is_no_return = false;
+};
+
+// an arm of an if
+struct IfArm {
+    bool exists = false;  // not null and not ";"
+    bool is_compound = false;
+    LineRange range = {-1, -1};
+    // first and last statements of a compound arm (unset if it is empty), the arm itself otherwise
+    LineRange first = {-1, -1}, last = {-1, -1};
+    bool first_is_null = false;
+    // first statement of a compound first statement ("if () { { ... } }")
+    LineRange nested_first = {-1, -1};
+};
 
 struct IfStmt {
-    clang::IfStmt *if_stmt = nullptr;
-    std::vector<clang::Stmt*> branches;
-    clang::Stmt *branch_after_if = nullptr;
+    LineRange range = {-1, -1};
+    LineRange cond = {-1, -1};
+    IfArm then_arm;
+    IfArm else_arm;  // unset for an else-if (it has its own IfStmt)
+    bool has_else = false;
+    std::vector<IfArm> branches;  // arms of the whole else-if chain
+    LineRange next = {-1, -1};    // the statement after the if, in the same compound
 
     bool is_symmetrical = false;
-    bool is_keyword = false;
+    std::vector<LineRange> keyword_ranges;  // statements searched for keywords
+
+    // with --branch-coverage (only if the condition was evaluated): how often each arm was taken
+    bool has_branch_coverage = false;
+    uint64_t then_count = 0, else_count = 0;
+};
+
+// an element of the minimization: a range added back, or a line where exit is inserted
+struct AugmentationSite {
+    bool is_exit;
+    LineRange range;
+
+    bool operator<(const AugmentationSite &other) const {
+        return std::tie(is_exit, range) < std::tie(other.is_exit, other.range);
+    }
+    bool operator==(const AugmentationSite &other) const { return is_exit == other.is_exit && range == other.range; }
+};
+
+// the sites one decision of the strategies (about a function or an if) adds, and the lines whose
+// removal it looked up: the decision only changes if one of these lines is removed or added back
+struct StrategyDecision {
+    std::vector<LineRange> watched;
+    std::vector<LineRange> to_add_back, to_replace_with_exit;
 };
 
 class CovAugment;
@@ -47,48 +121,80 @@ class CovAugmentAstVisitor : public clang::RecursiveASTVisitor<CovAugmentAstVisi
     CovAugment *covAugment;
 };
 
+/// \brief Augments debloated variants of a program with the lines removed from the original
+///
+/// The original is parsed and indexed once, then every job is computed from the index only, so
+/// jobs run in parallel (numThreads) and each writes its own output file. The index can be saved
+/// and loaded by later runs on the same original, which then do not parse it at all. With --minimize, jobs run
+/// one after the other and the tests of the minimization run in parallel instead.
 class CovAugment : public clang::ASTConsumer {
     friend class CovAugmentAstVisitor;
 
    public:
-    CovAugment(std::set<int> &debloatedLines, std::string outputFileName)
-        : debloatedLines(debloatedLines), outputFileName(outputFileName), collectionVisitor(NULL) {}
+    // the index is saved to indexFile after the traversal, if not empty; the decisions of the jobs are
+    // saved next to it (see collectSites)
+    CovAugment(std::vector<AugmentationJob> &jobs, BranchCounts &branchCounts, unsigned numThreads = 1,
+               const std::string &indexFile = "")
+        : collectionVisitor(NULL), jobs(jobs), branchCounts(branchCounts), numThreads(numThreads), indexFile(indexFile) {}
     ~CovAugment() { delete collectionVisitor; }
 
+    // the key of the index of an original program: its source, the keywords and the branch counts
+    static std::string getIndexKey(llvm::StringRef source, const BranchCounts &branchCounts);
+    // an index saved by a previous run, instead of parsing the original program
+    bool loadIndex(const std::string &fileName);
+    // computes the jobs from the index, `source` is the original program; false if a job failed
+    bool runJobs(llvm::StringRef source);
+
    private:
     void Initialize(clang::ASTContext &Ctx);
     void HandleTranslationUnit(clang::ASTContext &Ctx);
-
-    void applyAugmentationToFile(const std::vector<LineRange> &ranges, bool is_exit_replacement);
+    bool saveIndex(const std::string &fileName);
+
+    bool augment(const AugmentationJob &job);
+    void collectSites(const AugmentationJob &job, std::vector<LineRange> &to_add_back,
+                      std::vector<LineRange> &to_replace_with_exit);
+    void decideFunction(const AugmentationJob &job, const FunctionRange &func, StrategyDecision &decision);
+    void decideIf(const AugmentationJob &job, size_t index, StrategyDecision &decision);
+    std::string getSitesFile(const AugmentationJob &job);
+    static bool saveSites(const std::string &fileName, const std::set<int> &debloatedLines,
+                          const std::vector<StrategyDecision> &decisions);
+    static bool loadSites(const std::string &fileName, std::set<int> &debloatedLines,
+                          std::vector<StrategyDecision> &decisions);
+    bool writeAugmentation(const AugmentationJob &job, std::vector<LineRange> to_add_back,
+                           std::vector<LineRange> to_replace_with_exit, const std::string &outputFile,
+                           bool asPatch = false);
+    bool testSites(const AugmentationJob &job, const std::vector<AugmentationSite> &sites, unsigned slot,
+                   bool &passed);
+    bool minimizeSites(const AugmentationJob &job, std::vector<AugmentationSite> &sites);
 
     void addDependency(clang::Stmt *stmt);
     void addDependency(clang::Stmt *stmt, clang::Decl *decl);
-    void addDependency(clang::Stmt *stmt, LineRange range_decl);
+    void addDependency(clang::Stmt *stmt, LineRange range_decl, int condition);
 
     LineRange getStartAndEnd(clang::SourceRange range);
     LineRange getStartAndEnd(clang::Decl *decl);
     LineRange getStartAndEnd(clang::Stmt *stmt);
     LineRange getRangeOfGotoLabel(clang::LabelStmt *LS);
-
-    bool lineIsRemoved(int line);
-    bool functionIsRemoved(clang::FunctionDecl *FD);
-    bool ifBranchContainsKeyword(clang::Stmt* if_branch, std::string *keywords, int n_keywords);
-    bool rangeContainsKeyword(clang::SourceRange range, std::string *keywords, int n_keywords);
-    bool rangeContainsKeyword(LineRange range, std::string *keywords, int n_keywords);
+    IfArm getIfArm(clang::Stmt *arm);
+    void getKeywordRanges(clang::Stmt *if_branch, std::vector<LineRange> &ranges);
 
     std::vector<IfStmt> ifStmts;
-    std::vector<LineRange> emptyFunctions;
-    std::vector<LineRange> emptyNoReturnFunctions;
+    std::vector<FunctionRange> functions;
+    std::vector<Dependency> dependencies;  // sorted by line after the traversal
+    // the dependencies of line l are dependencies[dependenciesByLine[l]] to dependencies[dependenciesByLine[l + 1] - 1]
+    std::vector<size_t> dependenciesByLine;
+    std::vector<uint64_t> lineKeywords;  // keywords of each line (KeywordScanner masks)
+    std::vector<std::vector<size_t>> enclosingFunctions;  // the functions containing each if, set by runJobs
+    StructuralHasher structuralHasher;
 
     CovAugmentAstVisitor *collectionVisitor;
 
-    // only record removed dependencies
-    std::map<int, std::set<LineRange>> mapLineToDependencies;
-
     clang::ASTContext *Context;
-    std::set<int> &debloatedLines;
-
-    std::string outputFileName;
+    std::vector<AugmentationJob> &jobs;
+    BranchCounts &branchCounts;
+    unsigned numThreads;
+    std::string indexFile;
+    std::vector<llvm::StringRef> originalLines;  // with their '\n', set by runJobs
 };
 
 #endif  // GLOBAL_ADD_BACK_H
@@ -0,0 +1,93 @@
+#include "KeywordScanner.h"
+
+#include <string.h>
+
+#include <fstream>
+#include <queue>
+
+#include "llvm/Support/raw_ostream.h"
+
+bool KeywordScanner::readKeywordsFile(const std::string &fileName, std::vector<std::string> &keywords) {
+    std::ifstream keywordsFile(fileName);
+    if (!keywordsFile) {
+        llvm::errs() << "Failed to read keywords file '" << fileName << "'.\n";
+        return false;
+    }
+    keywords.clear();
+    for (std::string line; std::getline(keywordsFile, line);) {
+        llvm::StringRef keyword = llvm::StringRef(line).trim();
+        if (keyword.empty() || keyword.startswith("#")) continue;
+        keywords.push_back(keyword.str());
+    }
+    if (keywords.size() > maxKeywords) {
+        llvm::errs() << "Too many keywords in '" << fileName << "' (at most " << maxKeywords << ").\n";
+        return false;
+    }
+    return true;
+}
+
+KeywordScanner::KeywordScanner(const std::vector<std::string> &keywords) {
+    Node root;
+    memset(&root, -1, sizeof(root.next));
+    root.mask = 0;
+    nodes.push_back(root);
+
+    // trie of the keywords
+    for (unsigned i = 0; i < keywords.size() && i < maxKeywords; i++) {
+        int node = 0;
+        for (unsigned char c : keywords[i]) {
+            if (nodes[node].next[c] < 0) {
+                nodes[node].next[c] = nodes.size();
+                nodes.push_back(root);
+            }
+            node = nodes[node].next[c];
+        }
+        nodes[node].mask |= uint64_t(1) << i;
+    }
+
+    // failure links in breadth-first order, missing transitions go where the failure link goes
+    std::vector<int> fail(nodes.size(), 0);
+    std::queue<int> queue;
+    for (int c = 0; c < 256; c++) {
+        if (nodes[0].next[c] < 0) {
+            nodes[0].next[c] = 0;
+        } else {
+            queue.push(nodes[0].next[c]);
+        }
+    }
+    while (!queue.empty()) {
+        int node = queue.front();
+        queue.pop();
+        nodes[node].mask |= nodes[fail[node]].mask;
+        for (int c = 0; c < 256; c++) {
+            int child = nodes[node].next[c];
+            if (child < 0) {
+                nodes[node].next[c] = nodes[fail[node]].next[c];
+            } else {
+                fail[child] = nodes[fail[node]].next[c];
+                queue.push(child);
+            }
+        }
+    }
+}
+
+std::vector<uint64_t> KeywordScanner::scanAllLines(llvm::StringRef buffer) const {
+    std::vector<uint64_t> masks(1, 0);
+    for (size_t pos = 0; pos < buffer.size();) {
+        size_t end = buffer.find('\n', pos);
+        if (end == llvm::StringRef::npos) end = buffer.size();
+        masks.push_back(scan(buffer.slice(pos, end)));
+        pos = end + 1;
+    }
+    return masks;
+}
+
+uint64_t KeywordScanner::scan(llvm::StringRef text) const {
+    uint64_t mask = 0;
+    int node = 0;
+    for (unsigned char c : text) {
+        node = nodes[node].next[c];
+        mask |= nodes[node].mask;
+    }
+    return mask;
+}
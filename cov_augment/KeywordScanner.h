@@ -0,0 +1,37 @@
+#ifndef KEYWORD_SCANNER_H
+#define KEYWORD_SCANNER_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
+
+/// \brief Finds a set of keywords (as substrings) in one pass over a buffer (Aho-Corasick)
+///
+/// Keywords never span lines, so a whole file is scanned once and each line gets a bitmask of the
+/// keywords it contains (bit i for keyword i, at most 64 keywords).
+class KeywordScanner {
+   public:
+    static const unsigned maxKeywords = 64;
+
+    // one keyword per line, empty lines and lines starting with '#' are ignored
+    static bool readKeywordsFile(const std::string &fileName, std::vector<std::string> &keywords);
+
+    explicit KeywordScanner(const std::vector<std::string> &keywords);
+
+    // masks of all lines (1-based), indexed by line
+    std::vector<uint64_t> scanAllLines(llvm::StringRef buffer) const;
+    // mask of the keywords in text
+    uint64_t scan(llvm::StringRef text) const;
+
+   private:
+    struct Node {
+        int next[256];   // goto function completed with the failure links (a DFA)
+        uint64_t mask;   // keywords ending here, including through failure links
+    };
+    std::vector<Node> nodes;
+};
+
+#endif  // KEYWORD_SCANNER_H
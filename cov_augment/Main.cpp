@@ -2,9 +2,12 @@
 #include <time.h>
 
 #include <fstream>
+#include <algorithm>
 #include <memory>
 #include <set>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "CovAugment.h"
@@ -16,6 +19,8 @@
 #include "clang/Tooling/CompilationDatabase.h"
 #include "clang/Tooling/Tooling.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/raw_ostream.h"
 
 using namespace clang::tooling;
@@ -23,13 +28,13 @@ using namespace clang::tooling;
 llvm::cl::OptionCategory covAugmentOptionsCategory("CovAugment Options");
 std::string opt_original_file;
 llvm::cl::opt<std::string> opt_debloated_file("debloated-src",
-                                              llvm::cl::desc("file path to the debloated source file"),
-                                              llvm::cl::value_desc("FILEPATH"), llvm::cl::Required,
+                                              llvm::cl::desc("file path to the debloated source file (required without --batch)"),
+                                              llvm::cl::value_desc("FILEPATH"),
                                               llvm::cl::cat(covAugmentOptionsCategory));
 llvm::cl::opt<std::string> opt_debloated_lines_file(
     "debloated-lines", llvm::cl::init("debloatedLines.txt"),
     llvm::cl::desc("file path to the text file containing all debloated lines"),
-    llvm::cl::value_desc("FILEPATH"), llvm::cl::Required, llvm::cl::cat(covAugmentOptionsCategory));
+    llvm::cl::value_desc("FILEPATH"), llvm::cl::cat(covAugmentOptionsCategory));
 // llvm::cl::opt<std::string> opt_result_file(
 //     "result-file",
 //     llvm::cl::desc("file path to the result source file (default: debloated-file-name.fixed.c)"),
@@ -39,7 +44,54 @@ llvm::cl::opt<std::string> opt_aug_strat(
     "aug-strat",
     llvm::cl::desc("augmentation strategies, separated by comma (default: \"exit,sym_assign,keyword\")"),
     llvm::cl::value_desc("LEVEL"), llvm::cl::cat(covAugmentOptionsCategory));
-std::set<std::string> opt_augmentation_strategies;
+llvm::cl::opt<std::string> opt_branch_coverage_file(
+    "branch-coverage",
+    llvm::cl::desc("file path to the edge hit counts of the original program (\"covmerge --edges\"), "
+                   "to target the if-arms that never ran instead of using the heuristics"),
+    llvm::cl::value_desc("FILEPATH"), llvm::cl::cat(covAugmentOptionsCategory));
+llvm::cl::opt<std::string> opt_keywords_file(
+    "keywords-file",
+    llvm::cl::desc("file path to the keywords of the keyword strategy, one per line (default: abort, exit, free, "
+                   "error, die, usage, close)"),
+    llvm::cl::value_desc("FILEPATH"), llvm::cl::cat(covAugmentOptionsCategory));
+std::vector<std::string> opt_keywords = {"abort", "exit", "free", "error", "die", "usage", "close"};
+llvm::cl::opt<std::string> opt_batch_file(
+    "batch",
+    llvm::cl::desc("file path to a manifest of augmentations of the original program, one \"DEBLOATED_SRC "
+                   "DEBLOATED_LINES STRATEGIES OUTPUT\" per line (STRATEGIES as --aug-strat, or \"none\"); the "
+                   "original is parsed once for all of them"),
+    llvm::cl::value_desc("FILEPATH"), llvm::cl::cat(covAugmentOptionsCategory));
+llvm::cl::opt<unsigned> opt_jobs("jobs", llvm::cl::init(0),
+                                 llvm::cl::desc("number of augmentations computed in parallel with --batch, or of tests with --minimize (default: number of CPUs)"),
+                                 llvm::cl::value_desc("N"), llvm::cl::cat(covAugmentOptionsCategory));
+llvm::cl::opt<bool> opt_minimize(
+    "minimize",
+    llvm::cl::desc("keep only the augmentations needed to pass the test script (delta debugging, with the tests "
+                   "run in parallel with --jobs)"),
+    llvm::cl::cat(covAugmentOptionsCategory));
+llvm::cl::opt<std::string> opt_compile_script("compile-script",
+                                              llvm::cl::desc("file path to the compile script (with --minimize)"),
+                                              llvm::cl::value_desc("FILEPATH"), llvm::cl::cat(covAugmentOptionsCategory));
+llvm::cl::opt<std::string> opt_test_script(
+    "test-script",
+    llvm::cl::desc("file path to the test script, run with the binary and passing with exit code 0, such as "
+                   "generality tests or crash inputs (with --minimize)"),
+    llvm::cl::value_desc("FILEPATH"), llvm::cl::cat(covAugmentOptionsCategory));
+llvm::cl::opt<std::string> opt_index_cache(
+    "index-cache",
+    llvm::cl::desc("directory keeping the analysis of original programs (by hash of the source, keywords and branch "
+                   "counts), so that later runs on the same original do not parse it"),
+    llvm::cl::value_desc("DIR"), llvm::cl::cat(covAugmentOptionsCategory));
+
+llvm::cl::opt<bool> opt_patch(
+    "patch",
+    llvm::cl::desc("write the augmentations as patches against the debloated source (<stem>.augmented.patch without "
+                   "--batch) instead of full copies, to be applied with linepatch"),
+    llvm::cl::cat(covAugmentOptionsCategory));
+
+std::set<std::string> parseStrategies(const std::string &strategies);
+std::set<int> readDebloatedLines(const std::string &fileName);
+bool readManifest(const std::string &fileName, std::vector<AugmentationJob> &jobs);
 
 int main(int argc, const char **argv) {
     llvm::cl::SetVersionPrinter([](llvm::raw_ostream &OS) { OS << "CovAugment version 0.1\n"; });
@@ -53,37 +105,143 @@ int main(int argc, const char **argv) {
     CommonOptionsParser &options = expectedOptions.get();
     opt_original_file = options.getSourcePathList()[0];
 
-    if (opt_aug_strat.empty()) {
-        opt_augmentation_strategies.insert("exit");
-        opt_augmentation_strategies.insert("sym_assign");
-        opt_augmentation_strategies.insert("keyword");
+    if (opt_batch_file.empty() && opt_debloated_file.empty()) {
+        llvm::errs() << "Either --debloated-src or --batch is required.\n";
+        return 1;
+    }
+
+    if (opt_minimize && (opt_compile_script.empty() || opt_test_script.empty())) {
+        llvm::errs() << "--minimize requires --compile-script and --test-script.\n";
+        return 1;
+    }
+
+    if (!opt_keywords_file.empty() && !KeywordScanner::readKeywordsFile(opt_keywords_file, opt_keywords)) return 1;
+
+    // one "KIND LINE FIRST-LAST COUNT" per line
+    BranchCounts branchCounts;
+    if (!opt_branch_coverage_file.empty()) {
+        std::ifstream branchCoverageFile(opt_branch_coverage_file);
+        if (!branchCoverageFile) {
+            llvm::errs() << "Failed to read branch coverage '" << opt_branch_coverage_file << "'.\n";
+            return 1;
+        }
+        std::string kind, range;
+        int line;
+        uint64_t count;
+        std::set<BranchKey> ambiguous;
+        while (branchCoverageFile >> kind >> line >> range >> count) {
+            LineRange target(0, 0);
+            llvm::StringRef first, last;
+            std::tie(first, last) = llvm::StringRef(range).split('-');
+            if (first.getAsInteger(10, target.first) || last.getAsInteger(10, target.second)) target = LineRange(0, 0);
+            BranchKey key(kind, line, target);
+            if (!branchCounts.emplace(key, count).second) ambiguous.insert(key);
+        }
+        // edges that cannot be told apart (such as two ifs on one line) are not used, their ifs use the heuristics
+        for (auto const &key : ambiguous) branchCounts.erase(key);
+    }
+
+    // Frontend::runWithoutCompilation(opt_result_file, new GlobalReduction(addedBackLines, tempFile));
+    // FrontendDCE::run({opt_result_file}, options.getCompilations(),
+    //     newFrontendActionFactory<DCEAction<tempFile>>().get());
+
+    std::vector<AugmentationJob> jobs;
+    if (!opt_batch_file.empty()) {
+        if (!readManifest(opt_batch_file, jobs)) return 1;
     } else {
+        AugmentationJob job;
+        job.debloatedFile = opt_debloated_file;
+        job.debloatedLines = readDebloatedLines(opt_debloated_lines_file);
+        job.strategies = parseStrategies(opt_aug_strat);
+        job.outputFile = FileManager::getStemName(opt_debloated_file) + (opt_patch ? ".augmented.patch" : ".augmented.c");
+        jobs.push_back(job);
+    }
+    for (auto const &job : jobs) llvm::outs() << "Output augmented program to file '" << job.outputFile << "'.\n";
+    unsigned numThreads = opt_jobs ? opt_jobs : std::max(1u, std::thread::hardware_concurrency());
+
+    std::string indexFile;
+    if (!opt_index_cache.empty()) {
+        auto buffer = llvm::MemoryBuffer::getFile(opt_original_file);
+        if (!buffer) {
+            llvm::errs() << "Failed to read '" << opt_original_file << "'.\n";
+            return 1;
+        }
+        llvm::sys::fs::create_directories(opt_index_cache);
+        indexFile = opt_index_cache + "/" + CovAugment::getIndexKey((*buffer)->getBuffer(), branchCounts) + ".idx";
+        if (llvm::sys::fs::exists(indexFile)) {
+            CovAugment covAugment(jobs, branchCounts, numThreads, indexFile);
+            if (covAugment.loadIndex(indexFile)) {
+                llvm::outs() << "Loaded the index of the original program from '" << indexFile << "'.\n";
+                return covAugment.runJobs((*buffer)->getBuffer()) ? 0 : 1;
+            }
+            llvm::errs() << "Ignored the invalid index '" << indexFile << "'.\n";
+        }
+    }
+    Frontend::runWithoutCompilation(opt_original_file, new CovAugment(jobs, branchCounts, numThreads, indexFile));
+
+    return 0;
+}
+
+// comma separated (default: "exit,sym_assign,keyword"), "none" for no strategy
+std::set<std::string> parseStrategies(const std::string &strategies) {
+    std::set<std::string> augmentationStrategies;
+    if (strategies.empty()) {
+        augmentationStrategies.insert("exit");
+        augmentationStrategies.insert("sym_assign");
+        augmentationStrategies.insert("keyword");
+    } else if (strategies != "none") {
         std::string strategy;
-        for (char c : opt_aug_strat) {
+        for (char c : strategies) {
             if (c == ',') {
-                opt_augmentation_strategies.insert(strategy);
+                augmentationStrategies.insert(strategy);
                 strategy.clear();
             } else {
                 strategy.push_back(c);
             }
         }
-        opt_augmentation_strategies.insert(strategy);
+        augmentationStrategies.insert(strategy);
     }
+    return augmentationStrategies;
+}
 
-    // input from file
-    // file contains single line with numbers separated by space
+// input from file
+// file contains single line with numbers separated by space
+std::set<int> readDebloatedLines(const std::string &fileName) {
     std::set<int> debloatedLines;
-    std::ifstream debloatedLinesFile(opt_debloated_lines_file);
+    std::ifstream debloatedLinesFile(fileName);
     for (int line; debloatedLinesFile >> line;) debloatedLines.insert(line);
     debloatedLinesFile.close();
+    return debloatedLines;
+}
 
-    // Frontend::runWithoutCompilation(opt_result_file, new GlobalReduction(addedBackLines, tempFile));
-    // FrontendDCE::run({opt_result_file}, options.getCompilations(),
-    //     newFrontendActionFactory<DCEAction<tempFile>>().get());
-
-    std::string outputFile = FileManager::getStemName(opt_debloated_file) + ".augmented.c";
-    llvm::outs() << "Output augmented program to file '" << outputFile << "'.\n";
-    Frontend::runWithoutCompilation(opt_original_file, new CovAugment(debloatedLines, outputFile));
-
-    return 0;
+// one "DEBLOATED_SRC DEBLOATED_LINES STRATEGIES OUTPUT" per line, empty lines and '#' comments are ignored
+bool readManifest(const std::string &fileName, std::vector<AugmentationJob> &jobs) {
+    std::ifstream manifestFile(fileName);
+    if (!manifestFile) {
+        llvm::errs() << "Failed to read manifest '" << fileName << "'.\n";
+        return false;
+    }
+    std::set<std::string> outputFiles;
+    int lineNumber = 0;
+    for (std::string line; std::getline(manifestFile, line);) {
+        lineNumber++;
+        std::istringstream fields(line);
+        std::string debloatedFile, debloatedLinesFile, strategies, outputFile, extra;
+        if (!(fields >> debloatedFile) || debloatedFile[0] == '#') continue;
+        if (!(fields >> debloatedLinesFile >> strategies >> outputFile) || fields >> extra) {
+            llvm::errs() << fileName << ":" << lineNumber << ": expected \"DEBLOATED_SRC DEBLOATED_LINES STRATEGIES OUTPUT\".\n";
+            return false;
+        }
+        if (!outputFiles.insert(outputFile).second) {
+            llvm::errs() << fileName << ":" << lineNumber << ": output '" << outputFile << "' is already written by another line.\n";
+            return false;
+        }
+        AugmentationJob job;
+        job.debloatedFile = debloatedFile;
+        job.debloatedLines = readDebloatedLines(debloatedLinesFile);
+        job.strategies = parseStrategies(strategies);
+        job.outputFile = outputFile;
+        jobs.push_back(job);
+    }
+    return true;
 }
@@ -0,0 +1,67 @@
+#include "StructuralHasher.h"
+
+#include "clang/AST/Expr.h"
+#include "llvm/ADT/Hashing.h"
+
+// tags of the abstracted nodes (statement classes are hashed otherwise)
+enum : unsigned { LEAF = 0x10000, ASSIGN, TARGET, TARGET_MEMBER, TARGET_ELEMENT, TARGET_DEREF };
+
+bool StructuralHasher::hasAssignment(const clang::Stmt *S) {
+    if (!S) return false;
+    auto cached = assigns.find(S);
+    if (cached != assigns.end()) return cached->second;
+
+    bool result = false;
+    if (auto *BO = llvm::dyn_cast<clang::BinaryOperator>(S); BO && BO->isAssignmentOp()) result = true;
+    if (auto *UO = llvm::dyn_cast<clang::UnaryOperator>(S); UO && UO->isIncrementDecrementOp()) result = true;
+    for (auto it = S->child_begin(); !result && it != S->child_end(); ++it) result = hasAssignment(*it);
+    return assigns[S] = result;
+}
+
+uint64_t StructuralHasher::hash(const clang::Stmt *S) {
+    if (!S) return 0;
+    auto cached = cache.find(S);
+    if (cached != cache.end()) return cached->second;
+
+    llvm::hash_code h;
+    if (auto *E = llvm::dyn_cast<clang::ImplicitCastExpr>(S)) {
+        // casts follow the types of the abstracted identifiers
+        h = hash(E->getSubExpr());
+    } else if (auto *DRE = llvm::dyn_cast<clang::DeclRefExpr>(S);
+               DRE && llvm::isa<clang::FunctionDecl>(DRE->getDecl())) {
+        // functions are not abstracted: "f(a)" and "g(b)" differ
+        h = llvm::hash_combine(unsigned(LEAF), DRE->getDecl()->getCanonicalDecl());
+    } else if (llvm::isa<clang::DeclRefExpr>(S) || llvm::isa<clang::IntegerLiteral>(S) ||
+               llvm::isa<clang::FloatingLiteral>(S) || llvm::isa<clang::CharacterLiteral>(S) ||
+               llvm::isa<clang::StringLiteral>(S) || llvm::isa<clang::ImaginaryLiteral>(S)) {
+        h = llvm::hash_value(unsigned(LEAF));
+    } else if (auto *BO = llvm::dyn_cast<clang::BinaryOperator>(S); BO && BO->isAssignmentOp()) {
+        h = llvm::hash_combine(unsigned(ASSIGN), hashTarget(BO->getLHS()));
+    } else if (auto *UO = llvm::dyn_cast<clang::UnaryOperator>(S); UO && UO->isIncrementDecrementOp()) {
+        h = llvm::hash_combine(unsigned(ASSIGN), hashTarget(UO->getSubExpr()));
+    } else {
+        h = llvm::hash_value(unsigned(S->getStmtClass()));
+        if (auto *BO = llvm::dyn_cast<clang::BinaryOperator>(S)) h = llvm::hash_combine(h, unsigned(BO->getOpcode()));
+        if (auto *UO = llvm::dyn_cast<clang::UnaryOperator>(S)) h = llvm::hash_combine(h, unsigned(UO->getOpcode()));
+        for (const clang::Stmt *child : S->children()) h = llvm::hash_combine(h, hash(child));
+    }
+    return cache[S] = static_cast<uint64_t>(size_t(h));
+}
+
+// the variable, field or element an assignment writes (not cached, targets are small)
+uint64_t StructuralHasher::hashTarget(const clang::Expr *E) {
+    E = E->IgnoreParenImpCasts();
+    llvm::hash_code h;
+    if (auto *DRE = llvm::dyn_cast<clang::DeclRefExpr>(E)) {
+        h = llvm::hash_combine(unsigned(TARGET), DRE->getDecl()->getCanonicalDecl());
+    } else if (auto *ME = llvm::dyn_cast<clang::MemberExpr>(E)) {
+        h = llvm::hash_combine(unsigned(TARGET_MEMBER), ME->getMemberDecl()->getCanonicalDecl(), hashTarget(ME->getBase()));
+    } else if (auto *ASE = llvm::dyn_cast<clang::ArraySubscriptExpr>(E)) {
+        h = llvm::hash_combine(unsigned(TARGET_ELEMENT), hashTarget(ASE->getBase()), hash(ASE->getIdx()));
+    } else if (auto *UO = llvm::dyn_cast<clang::UnaryOperator>(E); UO && UO->getOpcode() == clang::UO_Deref) {
+        h = llvm::hash_combine(unsigned(TARGET_DEREF), hashTarget(UO->getSubExpr()));
+    } else {
+        h = llvm::hash_value(hash(E));
+    }
+    return static_cast<uint64_t>(size_t(h));
+}
@@ -0,0 +1,30 @@
+#ifndef STRUCTURAL_HASHER_H
+#define STRUCTURAL_HASHER_H
+
+#include <stdint.h>
+
+#include "clang/AST/Stmt.h"
+#include "llvm/ADT/DenseMap.h"
+
+/// \brief Hash of the shape of statements, to find symmetrical if-branches in linear time
+///
+/// Identifiers and literals are abstracted, except the functions (calls to different functions
+/// differ) and the variables (or fields, elements...) that are assigned: an assignment only hashes
+/// its target, so branches setting the same variables to different values
+/// ("if () { a = 1; b = x; } else { a = 2; b = y; }") get the same hash. Hashes are cached by
+/// subtree, so the branches of nested ifs are hashed once.
+class StructuralHasher {
+   public:
+    uint64_t hash(const clang::Stmt *S);
+
+    // whether S assigns, at any depth (nested blocks, loops, arguments...), cached like hashes
+    bool hasAssignment(const clang::Stmt *S);
+
+   private:
+    uint64_t hashTarget(const clang::Expr *E);
+
+    llvm::DenseMap<const clang::Stmt *, uint64_t> cache;
+    llvm::DenseMap<const clang::Stmt *, bool> assigns;
+};
+
+#endif  // STRUCTURAL_HASHER_H
@@ -0,0 +1,252 @@
+#include "CovMerge.h"
+
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+bool CovMerge::readMap(const std::string &mapFile) {
+    auto buffer = llvm::MemoryBuffer::getFile(mapFile, true);
+    if (!buffer) {
+        llvm::errs() << "Failed to read sidecar map '" << mapFile << "'.\n";
+        return false;
+    }
+    llvm::SmallVector<llvm::StringRef, 0> records;
+    (*buffer)->getBuffer().split(records, '\n', -1, false);
+    for (auto record : records) {
+        // "STMT_EXEC;<line>;<line>" or "BLOCK_EXEC;<id>;<line> <line>..."
+        llvm::SmallVector<llvm::StringRef, 3> fields;
+        record.split(fields, ';', 2);
+        unsigned id;
+        if (fields.size() != 3 || fields[1].getAsInteger(10, id)) continue;
+        if (fields[0] == "BLOCK_IMPLIED") {
+            // "BLOCK_IMPLIED;<id>;EQUIV <id>" or "BLOCK_IMPLIED;<id>;DOM <id> <id>..."
+            llvm::SmallVector<llvm::StringRef, 8> words;
+            fields[2].split(words, ' ', -1, false);
+            if (words.empty()) continue;
+            ImpliedSite &implied = impliedSites[id];
+            implied.equivalent = words[0] == "EQUIV";
+            for (size_t i = 1; i < words.size(); i++) {
+                unsigned implicant;
+                if (!words[i].getAsInteger(10, implicant)) implied.implicants.push_back(implicant);
+            }
+            continue;
+        }
+        if (fields[0] == "EDGE") {
+            edges[id] = fields[2].str();
+            continue;
+        }
+        if (fields[0] == "FUNC_SIG") {
+            funcSigs[id] = fields[2].str();
+            continue;
+        }
+        std::map<unsigned, std::vector<int>> *sites = nullptr;
+        if (fields[0] == "STMT_EXEC")
+            sites = &stmtSites;
+        else if (fields[0] == "BLOCK_EXEC")
+            sites = &blockSites;
+        else
+            continue;
+        llvm::SmallVector<llvm::StringRef, 8> lines;
+        fields[2].split(lines, ' ', -1, false);
+        for (auto lineStr : lines) {
+            int line;
+            if (!lineStr.getAsInteger(10, line)) (*sites)[id].push_back(line);
+        }
+    }
+    return true;
+}
+
+bool CovMerge::addDump(const std::string &dumpFile) {
+    // without a null terminator, large dumps are memory-mapped instead of read
+    auto buffer = llvm::MemoryBuffer::getFile(dumpFile, false, false);
+    if (!buffer) {
+        llvm::errs() << "Failed to read dump '" << dumpFile << "'.\n";
+        return false;
+    }
+    llvm::StringRef data = (*buffer)->getBuffer();
+    instru_cov_header header;
+    if (data.size() < sizeof(header)) {
+        llvm::errs() << "Invalid dump '" << dumpFile << "' (truncated header).\n";
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    // the header is checked by the other overload
+    size_t numEntries = (size_t)header.n_sites + header.n_funcs + header.n_edges;
+    size_t entrySize = header.kind == INSTRU_COV_COUNTER ? sizeof(uint64_t) : sizeof(uint8_t);
+    if (data.size() < sizeof(header) + numEntries * entrySize) {
+        llvm::errs() << "Invalid dump '" << dumpFile << "' (truncated entries).\n";
+        return false;
+    }
+    return addDump(header, reinterpret_cast<const uint8_t *>(data.data()) + sizeof(header), dumpFile);
+}
+
+bool CovMerge::addDump(const instru_cov_header &header, const uint8_t *entries, const std::string &dumpFile) {
+    size_t entrySize = header.kind == INSTRU_COV_COUNTER     ? sizeof(uint64_t)
+                       : header.kind == INSTRU_COV_FIRST_HIT ? sizeof(uint8_t)
+                                                             : 0;
+    size_t numEntries = (size_t)header.n_sites + header.n_funcs + header.n_edges;
+    if (header.magic != INSTRU_COV_MAGIC || header.version != INSTRU_COV_VERSION || entrySize == 0) {
+        llvm::errs() << "Invalid dump '" << dumpFile << "' (unknown format).\n";
+        return false;
+    }
+
+    if (numDumps == 0) {
+        mergedHeader = header;
+        if (header.kind == INSTRU_COV_COUNTER)
+            counters.assign(numEntries, 0);
+        else
+            hits.assign(numEntries, 0);
+    } else if (header.kind != mergedHeader.kind || header.site_space != mergedHeader.site_space ||
+               header.n_sites != mergedHeader.n_sites || header.n_funcs != mergedHeader.n_funcs ||
+               header.n_edges != mergedHeader.n_edges) {
+        llvm::errs() << "Dump '" << dumpFile
+                     << "' does not match the previous dumps (different runtime or program).\n";
+        return false;
+    }
+
+    if (header.kind == INSTRU_COV_COUNTER)
+        addCounters(counters.data(), entries, numEntries);
+    else
+        orHits(hits.data(), entries, numEntries);
+    numDumps++;
+    return true;
+}
+
+const std::map<unsigned, std::vector<int>> &CovMerge::getSites() {
+    return mergedHeader.site_space == INSTRU_SITES_BLOCKS ? blockSites : stmtSites;
+}
+
+uint64_t CovMerge::getSiteCount(unsigned site) {
+    if (numDumps == 0 || site >= mergedHeader.n_sites) return 0;
+    return mergedHeader.kind == INSTRU_COV_COUNTER ? counters[site] : hits[site];
+}
+
+// false if the execution of a site without a probe is unknown
+bool CovMerge::getInferredCount(unsigned site, uint64_t &count) {
+    auto implied = impliedSites.find(site);
+    count = 0;
+    // an equivalent block runs exactly as often as its implicant
+    if (implied->second.equivalent) {
+        if (!implied->second.implicants.empty()) count = getSiteCount(implied->second.implicants[0]);
+        return true;
+    }
+    // otherwise, executed at least once if any implicant is
+    for (unsigned implicant : implied->second.implicants) {
+        if (getSiteCount(implicant) != 0) count = 1;
+    }
+    return count != 0;
+}
+
+std::map<int, uint64_t> CovMerge::getLineCounts() {
+    std::map<int, uint64_t> lineCounts;
+    std::set<int> unknownLines;
+    bool blockSpace = numDumps != 0 && mergedHeader.site_space == INSTRU_SITES_BLOCKS;
+    for (auto const &site : getSites()) {
+        uint64_t count = getSiteCount(site.first);
+        bool known = true;
+        if (blockSpace && impliedSites.count(site.first)) known = getInferredCount(site.first, count);
+        for (int line : site.second) {
+            if (!known)
+                unknownLines.insert(line);
+            else if (numDumps != 0 && mergedHeader.kind == INSTRU_COV_FIRST_HIT)
+                lineCounts[line] |= count;
+            else
+                lineCounts[line] += count;
+        }
+    }
+    // a line is never executed only if all of its sites are known not to be
+    for (int line : unknownLines) {
+        auto it = lineCounts.find(line);
+        if (it != lineCounts.end() && it->second == 0) lineCounts.erase(it);
+    }
+    return lineCounts;
+}
+
+std::set<int> CovMerge::getExecutedLines() {
+    std::set<int> lines;
+    for (auto const &lineCount : getLineCounts())
+        if (lineCount.second != 0) lines.insert(lineCount.first);
+    return lines;
+}
+
+// lines with a probe that no run has executed
+std::set<int> CovMerge::getNeverExecutedLines() {
+    std::set<int> lines;
+    for (auto const &lineCount : getLineCounts())
+        if (lineCount.second == 0) lines.insert(lineCount.first);
+    return lines;
+}
+
+std::vector<std::pair<std::string, uint64_t>> CovMerge::getEdgeCounts() {
+    std::vector<std::pair<std::string, uint64_t>> edgeCounts;
+    for (auto const &edge : edges) {
+        uint64_t count = 0;
+        if (numDumps != 0 && edge.first < mergedHeader.n_edges) {
+            size_t entry = (size_t)mergedHeader.n_sites + mergedHeader.n_funcs + edge.first;
+            count = mergedHeader.kind == INSTRU_COV_COUNTER ? counters[entry] : hits[entry];
+        }
+        edgeCounts.push_back(std::make_pair(edge.second, count));
+    }
+    return edgeCounts;
+}
+
+std::vector<std::pair<std::string, uint64_t>> CovMerge::getFuncCallCounts() {
+    std::vector<std::pair<std::string, uint64_t>> funcCallCounts;
+    for (auto const &funcSig : funcSigs) {
+        uint64_t count = 0;
+        if (numDumps != 0 && funcSig.first < mergedHeader.n_funcs) {
+            size_t entry = (size_t)mergedHeader.n_sites + funcSig.first;
+            count = mergedHeader.kind == INSTRU_COV_COUNTER ? counters[entry] : hits[entry];
+        }
+        funcCallCounts.push_back(std::make_pair(funcSig.second, count));
+    }
+    return funcCallCounts;
+}
+
+// the build uses -march=native, so the widest kernel of the host is selected at compile time
+void addCounters(uint64_t *dst, const uint8_t *src, size_t n) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 4 <= n; i += 4) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i * sizeof(uint64_t)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_add_epi64(a, b));
+    }
+#elif defined(__SSE2__)
+    for (; i + 2 <= n; i += 2) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * sizeof(uint64_t)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_add_epi64(a, b));
+    }
+#endif
+    for (; i < n; i++) {
+        uint64_t value;
+        memcpy(&value, src + i * sizeof(uint64_t), sizeof(value));
+        dst[i] += value;
+    }
+}
+
+void orHits(uint8_t *dst, const uint8_t *src, size_t n) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_or_si256(a, b));
+    }
+#elif defined(__SSE2__)
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_or_si128(a, b));
+    }
+#endif
+    for (; i < n; i++) dst[i] |= src[i];
+}
@@ -0,0 +1,62 @@
+#ifndef COV_MERGE_H
+#define COV_MERGE_H
+
+#include <stdint.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "instru_format.h"
+
+/// \brief Merges coverage dumps of the instrumentation runtime ("<prefix>.<pid>.cov")
+///
+/// Counter dumps are summed and first-hit dumps are OR-ed (all dumps must be of the same kind and
+/// come from the same instrumented program). Sites are mapped back to lines with the sidecar map,
+/// edges to the branches they leave.
+class CovMerge {
+   public:
+    bool readMap(const std::string &mapFile);
+    bool addDump(const std::string &dumpFile);
+    // entries follow the header as in a dump file, dumpName is for errors
+    bool addDump(const instru_cov_header &header, const uint8_t *entries, const std::string &dumpName);
+
+    unsigned getNumDumps() { return numDumps; }
+    // hits of every line with a probe (number of executions, or 1 / 0 for first-hit dumps);
+    // lines only known by inference count 1, those whose execution is unknown are left out
+    std::map<int, uint64_t> getLineCounts();
+    std::set<int> getExecutedLines();
+    std::set<int> getNeverExecutedLines();
+    // hits of every edge (--edges instrumentation), with its EDGE record "<kind> <line> <range>"
+    std::vector<std::pair<std::string, uint64_t>> getEdgeCounts();
+    // calls of every function signature (FUNC_SIG records), 1 / 0 for first-hit dumps
+    std::vector<std::pair<std::string, uint64_t>> getFuncCallCounts();
+
+   private:
+    // site id -> lines, for statement (STMT_EXEC records) and block (BLOCK_EXEC records) granularity
+    std::map<unsigned, std::vector<int>> stmtSites, blockSites;
+    // blocks without a probe (BLOCK_IMPLIED records of "instrumenter --overhead-budget")
+    struct ImpliedSite {
+        bool equivalent;                  // executed iff the implicant is, otherwise only if any is
+        std::vector<unsigned> implicants;
+    };
+    std::map<unsigned, ImpliedSite> impliedSites;
+    std::map<unsigned, std::string> edges;  // edge id -> EDGE record payload
+    std::map<unsigned, std::string> funcSigs;  // signature id -> FUNC_SIG record payload
+    instru_cov_header mergedHeader;
+    unsigned numDumps = 0;
+    std::vector<uint64_t> counters;  // INSTRU_COV_COUNTER: sites, then FUNC_CALLs, then edges
+    std::vector<uint8_t> hits;       // INSTRU_COV_FIRST_HIT: sites, then FUNC_CALLs, then edges
+
+    const std::map<unsigned, std::vector<int>> &getSites();
+    uint64_t getSiteCount(unsigned site);
+    bool getInferredCount(unsigned site, uint64_t &count);
+};
+
+// dst[i] += src[i]
+void addCounters(uint64_t *dst, const uint8_t *src, size_t n);
+// dst[i] |= src[i]
+void orHits(uint8_t *dst, const uint8_t *src, size_t n);
+
+#endif  // COV_MERGE_H
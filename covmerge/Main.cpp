@@ -0,0 +1,121 @@
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "CovMerge.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+void writeLines(const std::string &fileName, const std::set<int> &lines);
+
+llvm::cl::OptionCategory covmergeOptionsCategory("Covmerge Options");
+llvm::cl::list<std::string> opt_dump_files(llvm::cl::Positional, llvm::cl::desc("<dump files>"),
+                                           llvm::cl::ZeroOrMore,
+                                           llvm::cl::cat(covmergeOptionsCategory));
+llvm::cl::opt<std::string> opt_input_list("input-list",
+                                          llvm::cl::desc("file path to a text file listing dump files (one per line)"),
+                                          llvm::cl::value_desc("FILEPATH"),
+                                          llvm::cl::cat(covmergeOptionsCategory));
+llvm::cl::opt<std::string> opt_map_file("map",
+                                        llvm::cl::desc("file path to the sidecar map of the instrumented program (<stem>.instru.map)"),
+                                        llvm::cl::value_desc("FILEPATH"), llvm::cl::Required,
+                                        llvm::cl::cat(covmergeOptionsCategory));
+llvm::cl::opt<std::string> opt_counts_file("counts",
+                                           llvm::cl::desc("file path to the output hit counts (one \"LINE COUNT\" per line)"),
+                                           llvm::cl::value_desc("FILEPATH"),
+                                           llvm::cl::cat(covmergeOptionsCategory));
+llvm::cl::opt<std::string> opt_executed_file("executed-lines",
+                                             llvm::cl::desc("file path to the output executed lines (same format as debloated lines)"),
+                                             llvm::cl::value_desc("FILEPATH"),
+                                             llvm::cl::cat(covmergeOptionsCategory));
+llvm::cl::opt<std::string> opt_never_executed_file("never-executed",
+                                                   llvm::cl::desc("file path to the output never executed lines (same format as debloated lines)"),
+                                                   llvm::cl::value_desc("FILEPATH"),
+                                                   llvm::cl::cat(covmergeOptionsCategory));
+llvm::cl::opt<std::string> opt_edges_file("edges",
+                                          llvm::cl::desc("file path to the output edge hit counts (one \"KIND LINE FIRST-LAST COUNT\" per line, read by \"cov_augment --branch-coverage\")"),
+                                          llvm::cl::value_desc("FILEPATH"),
+                                          llvm::cl::cat(covmergeOptionsCategory));
+llvm::cl::opt<std::string> opt_func_calls_file("func-calls",
+                                               llvm::cl::desc("file path to the output function call counts (one \"COUNT SIGNATURE\" per line)"),
+                                               llvm::cl::value_desc("FILEPATH"),
+                                               llvm::cl::cat(covmergeOptionsCategory));
+
+int main(int argc, const char **argv) {
+    llvm::cl::SetVersionPrinter([](llvm::raw_ostream &OS) { OS << "Covmerge version 0.1\n"; });
+    llvm::cl::HideUnrelatedOptions(covmergeOptionsCategory);
+    llvm::cl::ParseCommandLineOptions(argc, argv, "Merge coverage dumps of instrumented programs");
+
+    std::vector<std::string> dumpFiles(opt_dump_files.begin(), opt_dump_files.end());
+    if (!opt_input_list.empty()) {
+        std::ifstream inputList(opt_input_list);
+        for (std::string dumpFile; std::getline(inputList, dumpFile);)
+            if (!dumpFile.empty()) dumpFiles.push_back(dumpFile);
+    }
+
+    CovMerge merge;
+    if (!merge.readMap(opt_map_file)) return 1;
+    // a run killed while writing its dump should not spoil the others
+    for (auto &dumpFile : dumpFiles) merge.addDump(dumpFile);
+    if (merge.getNumDumps() == 0) {
+        llvm::errs() << "No valid dump to merge.\n";
+        return 1;
+    }
+
+    std::map<int, uint64_t> lineCounts = merge.getLineCounts();
+    std::set<int> executedLines = merge.getExecutedLines();
+    llvm::outs() << "Merged " << merge.getNumDumps() << " of " << dumpFiles.size() << " dumps: "
+                 << executedLines.size() << " of " << lineCounts.size() << " lines executed.\n";
+
+    if (!opt_counts_file.empty()) {
+        std::error_code ec;
+        llvm::raw_fd_ostream os(opt_counts_file, ec, llvm::sys::fs::OF_Text);
+        if (ec) {
+            llvm::errs() << "Failed to write '" << opt_counts_file << "': " << ec.message() << "\n";
+            return 1;
+        }
+        for (auto const &lineCount : lineCounts) os << lineCount.first << " " << lineCount.second << "\n";
+    }
+    if (!opt_edges_file.empty()) {
+        std::error_code ec;
+        llvm::raw_fd_ostream os(opt_edges_file, ec, llvm::sys::fs::OF_Text);
+        if (ec) {
+            llvm::errs() << "Failed to write '" << opt_edges_file << "': " << ec.message() << "\n";
+            return 1;
+        }
+        unsigned numTaken = 0;
+        std::vector<std::pair<std::string, uint64_t>> edgeCounts = merge.getEdgeCounts();
+        for (auto const &edgeCount : edgeCounts) {
+            os << edgeCount.first << " " << edgeCount.second << "\n";
+            if (edgeCount.second != 0) numTaken++;
+        }
+        llvm::outs() << numTaken << " of " << edgeCounts.size() << " edges taken.\n";
+    }
+    if (!opt_func_calls_file.empty()) {
+        std::error_code ec;
+        llvm::raw_fd_ostream os(opt_func_calls_file, ec, llvm::sys::fs::OF_Text);
+        if (ec) {
+            llvm::errs() << "Failed to write '" << opt_func_calls_file << "': " << ec.message() << "\n";
+            return 1;
+        }
+        for (auto const &funcCallCount : merge.getFuncCallCounts())
+            os << funcCallCount.second << " " << funcCallCount.first << "\n";
+    }
+    if (!opt_executed_file.empty()) writeLines(opt_executed_file, executedLines);
+    if (!opt_never_executed_file.empty()) writeLines(opt_never_executed_file, merge.getNeverExecutedLines());
+
+    return 0;
+}
+
+// numbers separated by space, as read by "fixer --debloated-lines" and "cov_augment --debloated-lines"
+void writeLines(const std::string &fileName, const std::set<int> &lines) {
+    std::error_code ec;
+    llvm::raw_fd_ostream os(fileName, ec, llvm::sys::fs::OF_Text);
+    if (ec) {
+        llvm::errs() << "Failed to write '" << fileName << "': " << ec.message() << "\n";
+        exit(1);
+    }
+    for (int line : lines) os << " " << line;
+    llvm::outs() << "Output " << lines.size() << " lines to file '" << fileName << "'.\n";
+}
@@ -0,0 +1,122 @@
+#include "CovSample.h"
+
+#include <tuple>
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Object/ELFObjectFile.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+static llvm::symbolize::LLVMSymbolizer::Options getSymbolizerOptions() {
+    llvm::symbolize::LLVMSymbolizer::Options options;
+    options.Demangle = false;
+    return options;
+}
+
+CovSample::CovSample(const std::string &sourceFile)
+    : sourceName(llvm::sys::path::filename(sourceFile).str()), symbolizer(getSymbolizerOptions()) {}
+
+bool CovSample::addSamples(const std::string &samplesFile) {
+    auto buffer = llvm::MemoryBuffer::getFile(samplesFile, true);
+    if (!buffer) {
+        llvm::errs() << "Failed to read samples '" << samplesFile << "'.\n";
+        return false;
+    }
+    llvm::SmallVector<llvm::StringRef, 0> records;
+    (*buffer)->getBuffer().split(records, '\n', -1, false);
+    if (records.empty() || !records[0].startswith("SAMPLER;")) {
+        llvm::errs() << "Invalid samples '" << samplesFile << "' (unknown format).\n";
+        return false;
+    }
+
+    // mappings precede the PCs
+    std::vector<Mapping> mappings;
+    for (auto record : records) {
+        llvm::SmallVector<llvm::StringRef, 5> fields;
+        record.split(fields, ';', 4);
+        if (fields[0] == "SAMPLER" && fields.size() == 4) {
+            long interval;
+            uint64_t samples, dropped;
+            if (fields[1].getAsInteger(10, interval) || fields[2].getAsInteger(10, samples) ||
+                fields[3].getAsInteger(10, dropped))
+                continue;
+            intervals.insert(interval);
+            numSamples += samples;
+            numDropped += dropped;
+        } else if (fields[0] == "MAP" && fields.size() == 5) {
+            Mapping mapping;
+            if (fields[1].getAsInteger(16, mapping.start) || fields[2].getAsInteger(16, mapping.end) ||
+                fields[3].getAsInteger(16, mapping.offset))
+                continue;
+            mapping.path = fields[4].str();
+            mappings.push_back(mapping);
+        } else if (fields[0] == "PC" && fields.size() == 3) {
+            uint64_t pc, count;
+            if (fields[1].getAsInteger(16, pc) || fields[2].getAsInteger(10, count)) continue;
+            for (auto const &mapping : mappings) {
+                if (pc < mapping.start || pc >= mapping.end) continue;
+                int line = getLine(mapping, pc);
+                if (line > 0) lineCounts[line] += count;
+                break;
+            }
+        }
+    }
+    numFiles++;
+    return true;
+}
+
+// the innermost frame in the source file (a sample in an inlined header function counts for the
+// line calling it)
+int CovSample::getLine(const Mapping &mapping, uint64_t pc) {
+    uint64_t address = getFileAddress(mapping.path, pc - mapping.start + mapping.offset);
+    auto key = std::make_pair(mapping.path, address);
+    auto cached = lineCache.find(key);
+    if (cached != lineCache.end()) return cached->second;
+
+    int line = 0;
+    auto inlined = symbolizer.symbolizeInlinedCode(
+        mapping.path, {address, llvm::object::SectionedAddress::UndefSection});
+    if (inlined) {
+        for (uint32_t i = 0; i < inlined->getNumberOfFrames(); i++) {
+            const llvm::DILineInfo &frame = inlined->getFrame(i);
+            if (frame.Line != 0 && llvm::sys::path::filename(frame.FileName) == sourceName) {
+                line = frame.Line;
+                break;
+            }
+        }
+    } else {
+        llvm::consumeError(inlined.takeError());
+    }
+    lineCache[key] = line;
+    return line;
+}
+
+// file offset -> virtual address in the object file, which the debug info refers to
+uint64_t CovSample::getFileAddress(const std::string &path, uint64_t offset) {
+    auto it = segments.find(path);
+    if (it == segments.end()) {
+        it = segments.insert(std::make_pair(path, std::vector<std::tuple<uint64_t, uint64_t, uint64_t>>())).first;
+        auto object = llvm::object::ObjectFile::createObjectFile(path);
+        if (!object) {
+            llvm::consumeError(object.takeError());
+        } else if (auto *elf = llvm::dyn_cast<llvm::object::ELF64LEObjectFile>(object->getBinary())) {
+            auto headers = elf->getELFFile().program_headers();
+            if (!headers) {
+                llvm::consumeError(headers.takeError());
+            } else {
+                for (auto const &header : *headers) {
+                    if (header.p_type == llvm::ELF::PT_LOAD)
+                        it->second.emplace_back(header.p_offset, header.p_filesz, header.p_vaddr);
+                }
+            }
+        }
+    }
+    for (auto const &segment : it->second) {
+        if (offset >= std::get<0>(segment) && offset < std::get<0>(segment) + std::get<1>(segment))
+            return std::get<2>(segment) + offset - std::get<0>(segment);
+    }
+    return offset;
+}
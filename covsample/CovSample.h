@@ -0,0 +1,53 @@
+#ifndef COV_SAMPLE_H
+#define COV_SAMPLE_H
+
+#include <stdint.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "llvm/DebugInfo/Symbolize/Symbolize.h"
+
+/// \brief Maps the samples of the sampling profiler ("<prefix>.<pid>.samples") to lines
+///
+/// Sampled PCs are symbolized with the debug info of the mapped executables and libraries, a
+/// sample counts for the innermost (inlined) frame in the source file. Counts are approximate: a
+/// line without samples may still have run (for less than a sampling interval).
+class CovSample {
+   public:
+    CovSample(const std::string &sourceFile);
+
+    bool addSamples(const std::string &samplesFile);
+
+    unsigned getNumFiles() { return numFiles; }
+    uint64_t getNumSamples() { return numSamples; }
+    uint64_t getNumDropped() { return numDropped; }
+    std::set<long> getIntervals() { return intervals; }
+    // samples of every line of the source file with at least one sample
+    const std::map<int, uint64_t> &getLineCounts() { return lineCounts; }
+
+   private:
+    struct Mapping {
+        uint64_t start, end, offset;
+        std::string path;
+    };
+
+    int getLine(const Mapping &mapping, uint64_t pc);
+    uint64_t getFileAddress(const std::string &path, uint64_t offset);
+
+    std::string sourceName;
+    llvm::symbolize::LLVMSymbolizer symbolizer;
+    // (path, address in the file) -> line (0: not in the source file), shared by all sample files
+    std::map<std::pair<std::string, uint64_t>, int> lineCache;
+    // path -> PT_LOAD segments (file offset, size, virtual address)
+    std::map<std::string, std::vector<std::tuple<uint64_t, uint64_t, uint64_t>>> segments;
+
+    unsigned numFiles = 0;
+    uint64_t numSamples = 0, numDropped = 0;
+    std::set<long> intervals;
+    std::map<int, uint64_t> lineCounts;
+};
+
+#endif  // COV_SAMPLE_H
@@ -0,0 +1,80 @@
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "CovSample.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+llvm::cl::OptionCategory covsampleOptionsCategory("Covsample Options");
+llvm::cl::list<std::string> opt_samples_files(llvm::cl::Positional, llvm::cl::desc("<samples files>"),
+                                              llvm::cl::ZeroOrMore,
+                                              llvm::cl::cat(covsampleOptionsCategory));
+llvm::cl::opt<std::string> opt_input_list("input-list",
+                                          llvm::cl::desc("file path to a text file listing samples files (one per line)"),
+                                          llvm::cl::value_desc("FILEPATH"),
+                                          llvm::cl::cat(covsampleOptionsCategory));
+llvm::cl::opt<std::string> opt_source_file("source",
+                                           llvm::cl::desc("file path to the source file whose lines are reported (matched by file name)"),
+                                           llvm::cl::value_desc("FILEPATH"), llvm::cl::Required,
+                                           llvm::cl::cat(covsampleOptionsCategory));
+llvm::cl::opt<std::string> opt_counts_file("counts",
+                                           llvm::cl::desc("file path to the output sample counts (one \"LINE COUNT\" per line, after a \"# approximate\" line)"),
+                                           llvm::cl::value_desc("FILEPATH"),
+                                           llvm::cl::cat(covsampleOptionsCategory));
+llvm::cl::opt<std::string> opt_executed_file("executed-lines",
+                                             llvm::cl::desc("file path to the output sampled lines (same format as debloated lines)"),
+                                             llvm::cl::value_desc("FILEPATH"),
+                                             llvm::cl::cat(covsampleOptionsCategory));
+
+int main(int argc, const char **argv) {
+    llvm::cl::SetVersionPrinter([](llvm::raw_ostream &OS) { OS << "Covsample version 0.1\n"; });
+    llvm::cl::HideUnrelatedOptions(covsampleOptionsCategory);
+    llvm::cl::ParseCommandLineOptions(argc, argv, "Map the samples of the sampling profiler to source lines");
+
+    std::vector<std::string> samplesFiles(opt_samples_files.begin(), opt_samples_files.end());
+    if (!opt_input_list.empty()) {
+        std::ifstream inputList(opt_input_list);
+        for (std::string samplesFile; std::getline(inputList, samplesFile);)
+            if (!samplesFile.empty()) samplesFiles.push_back(samplesFile);
+    }
+
+    CovSample sample(opt_source_file);
+    for (auto &samplesFile : samplesFiles) sample.addSamples(samplesFile);
+    if (sample.getNumFiles() == 0) {
+        llvm::errs() << "No valid samples file.\n";
+        return 1;
+    }
+
+    // several intervals would make the counts incomparable, report them all
+    std::string intervals;
+    for (long interval : sample.getIntervals()) intervals += (intervals.empty() ? "" : ",") + std::to_string(interval);
+    const std::map<int, uint64_t> &lineCounts = sample.getLineCounts();
+    llvm::outs() << "Read " << sample.getNumFiles() << " of " << samplesFiles.size() << " samples files: "
+                 << sample.getNumSamples() << " samples (" << sample.getNumDropped() << " dropped) every "
+                 << intervals << " us, " << lineCounts.size() << " lines sampled (approximate).\n";
+
+    if (!opt_counts_file.empty()) {
+        std::error_code ec;
+        llvm::raw_fd_ostream os(opt_counts_file, ec, llvm::sys::fs::OF_Text);
+        if (ec) {
+            llvm::errs() << "Failed to write '" << opt_counts_file << "': " << ec.message() << "\n";
+            return 1;
+        }
+        os << "# approximate: " << sample.getNumSamples() << " samples every " << intervals << " us\n";
+        for (auto const &lineCount : lineCounts) os << lineCount.first << " " << lineCount.second << "\n";
+    }
+    if (!opt_executed_file.empty()) {
+        std::error_code ec;
+        llvm::raw_fd_ostream os(opt_executed_file, ec, llvm::sys::fs::OF_Text);
+        if (ec) {
+            llvm::errs() << "Failed to write '" << opt_executed_file << "': " << ec.message() << "\n";
+            return 1;
+        }
+        for (auto const &lineCount : lineCounts) os << " " << lineCount.first;
+        llvm::outs() << "Output " << lineCounts.size() << " lines to file '" << opt_executed_file << "'.\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,230 @@
+#include "CovStream.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+// larger ids come from a corrupt stream, not from a sidecar map
+static const unsigned maxId = 1 << 26;
+// a text line or a compressed chunk is at most the 64KB buffer of the runtime
+static const size_t maxPending = 1 << 20;
+
+static volatile sig_atomic_t stopRequested = 0;
+
+void CovStream::stop() { stopRequested = 1; }
+
+CovStream::~CovStream() {
+    for (auto &connection : connections) close(connection.fd);
+    if (listenFd >= 0) {
+        close(listenFd);
+        unlink(socketPath.c_str());
+    }
+}
+
+bool CovStream::readMap(const std::string &mapFile) {
+    auto buffer = llvm::MemoryBuffer::getFile(mapFile, true);
+    if (!buffer) {
+        llvm::errs() << "Failed to read sidecar map '" << mapFile << "'.\n";
+        return false;
+    }
+    llvm::SmallVector<llvm::StringRef, 0> records;
+    (*buffer)->getBuffer().split(records, '\n', -1, false);
+    for (auto record : records) {
+        llvm::StringRef kind, rest;
+        std::tie(kind, rest) = record.split(';');
+        unsigned id;
+        if (rest.split(';').first.getAsInteger(10, id) || id >= maxId) continue;
+        if (kind == "STMT_EXEC" || kind == "BLOCK_EXEC") {
+            siteHits.resize(std::max<size_t>(siteHits.size(), id + 1));
+            blockSites = blockSites || kind == "BLOCK_EXEC";
+        } else if (kind == "FUNC_SIG") {
+            funcHits.resize(std::max<size_t>(funcHits.size(), id + 1));
+        } else if (kind == "EDGE") {
+            edgeHits.resize(std::max<size_t>(edgeHits.size(), id + 1));
+        }
+    }
+    return true;
+}
+
+bool CovStream::listen(const std::string &path) {
+    struct sockaddr_un addr;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        llvm::errs() << "Socket path '" << path << "' is too long.\n";
+        return false;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+    unlink(path.c_str());
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd < 0 || bind(listenFd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        ::listen(listenFd, SOMAXCONN) != 0) {
+        llvm::errs() << "Failed to listen on '" << path << "': " << strerror(errno) << "\n";
+        if (listenFd >= 0) close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+    socketPath = path;
+    return true;
+}
+
+void CovStream::run(bool once) {
+    std::vector<char> readBuffer(64 * 1024);
+    std::vector<struct pollfd> fds;
+    while (!stopRequested) {
+        fds.assign(1, {listenFd, POLLIN, 0});
+        for (auto &connection : connections) fds.push_back({connection.fd, POLLIN, 0});
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            llvm::errs() << "Failed to wait for traces: " << strerror(errno) << "\n";
+            return;
+        }
+        // read the connections polled, new ones are appended
+        for (size_t i = fds.size() - 1; i > 0; i--) {
+            if (fds[i].revents == 0 || receive(connections[i - 1], readBuffer)) continue;
+            close(connections[i - 1].fd);
+            connections.erase(connections.begin() + (i - 1));
+        }
+        if (fds[0].revents & POLLIN) acceptConnections();
+
+        // a forked child connects before the connection of its parent closes, but maybe after poll()
+        if (once && numProcesses > 0 && connections.empty()) {
+            struct pollfd listenPoll = {listenFd, POLLIN, 0};
+            if (poll(&listenPoll, 1, 0) <= 0) return;
+        }
+    }
+}
+
+void CovStream::acceptConnections() {
+    int fd;
+    while ((fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC)) >= 0)
+        connections.push_back({fd, Connection::UNKNOWN, std::string()});
+}
+
+// false when the connection is closed
+bool CovStream::receive(Connection &connection, std::vector<char> &readBuffer) {
+    ssize_t n = read(connection.fd, readBuffer.data(), readBuffer.size());
+    if (n < 0 && errno == EINTR) return true;
+    if (n <= 0) {
+        // the process was killed in the middle of a chunk
+        if (!connection.pending.empty() || n < 0) numBroken++;
+        return false;
+    }
+    connection.pending.append(readBuffer.data(), n);
+    if (consume(connection) && connection.pending.size() <= maxPending) return true;
+    numBroken++;
+    return false;
+}
+
+// false if the stream is not a trace
+bool CovStream::consume(Connection &connection) {
+    if (connection.format == Connection::UNKNOWN) {
+        uint32_t magic;
+        if (connection.pending.size() < sizeof(magic)) return true;
+        memcpy(&magic, connection.pending.data(), sizeof(magic));
+        if (magic == INSTRU_CTRACE_MAGIC) {
+            instru_ctrace_header header;
+            if (connection.pending.size() < sizeof(header)) return true;
+            memcpy(&header, connection.pending.data(), sizeof(header));
+            if (header.version != INSTRU_CTRACE_VERSION) return false;
+            connection.pending.erase(0, sizeof(header));
+            connection.format = Connection::COMPRESSED;
+        } else if (llvm::StringRef(connection.pending).startswith("PROC")) {
+            connection.format = Connection::TEXT;
+        } else {
+            return false;
+        }
+        numProcesses++;
+    }
+    return connection.format == Connection::TEXT ? consumeLines(connection) : consumeChunks(connection);
+}
+
+// "STMT_EXEC;;<line>", "BLOCK_EXEC;;<id>", "FUNC_CALL;<id>;", "EDGE_EXEC;;<id>"...
+bool CovStream::consumeLines(Connection &connection) {
+    size_t end = connection.pending.rfind('\n');
+    if (end == std::string::npos) return true;
+    llvm::StringRef lines(connection.pending.data(), end);
+    while (!lines.empty()) {
+        llvm::StringRef line, kind, rest;
+        std::tie(line, lines) = lines.split('\n');
+        std::tie(kind, rest) = line.split(';');
+        unsigned id;
+        if (kind == "FUNC_CALL") {
+            if (!rest.split(';').first.getAsInteger(10, id)) count(FUNC_CALL, id);
+        } else if (kind == "STMT_EXEC" || kind == "BLOCK_EXEC" || kind == "EDGE_EXEC") {
+            if (!rest.split(';').second.getAsInteger(10, id))
+                count(kind == "STMT_EXEC" ? STMT_EXEC : kind == "BLOCK_EXEC" ? BLOCK_EXEC : EDGE_EXEC, id);
+        } else if (kind == "FUNC_RETURN") {
+            count(FUNC_RETURN, 0);
+        }
+    }
+    connection.pending.erase(0, end + 1);
+    return true;
+}
+
+// decodes the complete chunks, a partial one is kept for the next read
+bool CovStream::consumeChunks(Connection &connection) {
+    const unsigned char *begin = reinterpret_cast<const unsigned char *>(connection.pending.data());
+    const unsigned char *end = begin + connection.pending.size(), *pos = begin, *complete = begin;
+    auto readVarint = [&](uint64_t &value) {
+        value = 0;
+        for (unsigned shift = 0; pos < end && shift < 64; shift += 7) {
+            value |= static_cast<uint64_t>(*pos & 0x7f) << shift;
+            if ((*pos++ & 0x80) == 0) return true;
+        }
+        return false;
+    };
+    while (pos < end) {
+        uint64_t tid, length;
+        if (*pos++ != INSTRU_CTRACE_CHUNK) return false;
+        if (!readVarint(tid) || !readVarint(length) || length > static_cast<uint64_t>(end - pos)) break;
+        pos += length;
+        complete = pos;
+    }
+    if (complete == begin) return true;
+
+    reader.openChunks(llvm::StringRef(connection.pending.data(), complete - begin));
+    for (const TraceEvent &event : reader) count(event.type, event.id);
+    if (reader.hasError()) return false;
+    connection.pending.erase(0, complete - begin);
+    return true;
+}
+
+void CovStream::count(unsigned type, unsigned id) {
+    numEvents++;
+    if (type == FUNC_RETURN || id >= maxId) return;
+    std::vector<uint64_t> &hits = type == FUNC_CALL ? funcHits : type == EDGE_EXEC ? edgeHits : siteHits;
+    if (type == BLOCK_EXEC) blockSites = true;
+    if (id >= hits.size()) hits.resize(id + 1);
+    hits[id]++;
+}
+
+instru_cov_header CovStream::getHeader() {
+    instru_cov_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = INSTRU_COV_MAGIC;
+    header.version = INSTRU_COV_VERSION;
+    header.kind = INSTRU_COV_COUNTER;
+    header.site_space = blockSites ? INSTRU_SITES_BLOCKS : INSTRU_SITES_LINES;
+    header.n_sites = siteHits.size();
+    header.n_funcs = funcHits.size();
+    header.n_edges = edgeHits.size();
+    return header;
+}
+
+std::vector<uint64_t> CovStream::getEntries() {
+    std::vector<uint64_t> entries(siteHits);
+    entries.insert(entries.end(), funcHits.begin(), funcHits.end());
+    entries.insert(entries.end(), edgeHits.begin(), edgeHits.end());
+    return entries;
+}
@@ -0,0 +1,62 @@
+#ifndef COV_STREAM_H
+#define COV_STREAM_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "CTraceReader.h"
+#include "instru_format.h"
+#include "llvm/ADT/StringRef.h"
+
+/// \brief Online coverage of the traces streamed by instrumented programs ($INSTRU_STREAM)
+///
+/// Listens on a Unix socket, every process of the trace runtimes connects and sends its trace
+/// (text or compressed) chunk by chunk. Events only update counters, so memory is bounded by the
+/// number of sites and one chunk per connection, whatever the length of the runs. The counters
+/// have the dump format of the counter runtime, for CovMerge.
+class CovStream {
+   public:
+    ~CovStream();
+
+    // sizes the counters as the runtime does, so that dumps of both can be merged
+    bool readMap(const std::string &mapFile);
+    bool listen(const std::string &socketPath);
+    // until stop() or, with once, until no process is connected anymore (after the first one)
+    void run(bool once);
+    // async-signal-safe
+    static void stop();
+
+    instru_cov_header getHeader();
+    std::vector<uint64_t> getEntries();  // sites, then FUNC_CALLs, then edges
+    unsigned getNumProcesses() { return numProcesses; }
+    unsigned getNumBroken() { return numBroken; }
+    uint64_t getNumEvents() { return numEvents; }
+
+   private:
+    struct Connection {
+        int fd;
+        enum { UNKNOWN, TEXT, COMPRESSED } format;
+        std::string pending;  // received bytes that do not make a complete line or chunk yet
+    };
+
+    void acceptConnections();
+    bool receive(Connection &connection, std::vector<char> &readBuffer);
+    bool consume(Connection &connection);
+    bool consumeLines(Connection &connection);
+    bool consumeChunks(Connection &connection);
+    void count(unsigned type, unsigned id);
+
+    std::string socketPath;
+    int listenFd = -1;
+    std::vector<Connection> connections;
+    CTraceReader reader;
+
+    std::vector<uint64_t> siteHits, funcHits, edgeHits;
+    bool blockSites = false;
+    unsigned numProcesses = 0, numBroken = 0;
+    uint64_t numEvents = 0;
+};
+
+#endif  // COV_STREAM_H
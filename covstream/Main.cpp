@@ -0,0 +1,120 @@
+#include <signal.h>
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "CovMerge.h"
+#include "CovStream.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+void writeLines(const std::string &fileName, const std::set<int> &lines);
+
+llvm::cl::OptionCategory covstreamOptionsCategory("Covstream Options");
+llvm::cl::opt<std::string> opt_socket("socket",
+                                      llvm::cl::desc("file path to the Unix socket to listen on (set $INSTRU_STREAM to it when running the programs)"),
+                                      llvm::cl::value_desc("FILEPATH"), llvm::cl::Required,
+                                      llvm::cl::cat(covstreamOptionsCategory));
+llvm::cl::opt<std::string> opt_map_file("map",
+                                        llvm::cl::desc("file path to the sidecar map of the instrumented program (<stem>.instru.map)"),
+                                        llvm::cl::value_desc("FILEPATH"), llvm::cl::Required,
+                                        llvm::cl::cat(covstreamOptionsCategory));
+llvm::cl::opt<bool> opt_once("once",
+                             llvm::cl::desc("Stop when no process is connected anymore (otherwise stop with SIGINT or SIGTERM)"),
+                             llvm::cl::cat(covstreamOptionsCategory));
+llvm::cl::opt<std::string> opt_dump_file("dump",
+                                         llvm::cl::desc("file path to the output counters (dump format of the counter runtime, read by covmerge)"),
+                                         llvm::cl::value_desc("FILEPATH"),
+                                         llvm::cl::cat(covstreamOptionsCategory));
+llvm::cl::opt<std::string> opt_counts_file("counts",
+                                           llvm::cl::desc("file path to the output hit counts (one \"LINE COUNT\" per line)"),
+                                           llvm::cl::value_desc("FILEPATH"),
+                                           llvm::cl::cat(covstreamOptionsCategory));
+llvm::cl::opt<std::string> opt_executed_file("executed-lines",
+                                             llvm::cl::desc("file path to the output executed lines (same format as debloated lines)"),
+                                             llvm::cl::value_desc("FILEPATH"),
+                                             llvm::cl::cat(covstreamOptionsCategory));
+llvm::cl::opt<std::string> opt_never_executed_file("never-executed",
+                                                   llvm::cl::desc("file path to the output never executed lines (same format as debloated lines)"),
+                                                   llvm::cl::value_desc("FILEPATH"),
+                                                   llvm::cl::cat(covstreamOptionsCategory));
+llvm::cl::opt<std::string> opt_func_calls_file("func-calls",
+                                               llvm::cl::desc("file path to the output function call counts (one \"COUNT SIGNATURE\" per line)"),
+                                               llvm::cl::value_desc("FILEPATH"),
+                                               llvm::cl::cat(covstreamOptionsCategory));
+
+int main(int argc, const char **argv) {
+    llvm::cl::SetVersionPrinter([](llvm::raw_ostream &OS) { OS << "Covstream version 0.1\n"; });
+    llvm::cl::HideUnrelatedOptions(covstreamOptionsCategory);
+    llvm::cl::ParseCommandLineOptions(argc, argv, "Collect the coverage of instrumented programs streaming their traces");
+
+    CovStream stream;
+    CovMerge merge;
+    if (!stream.readMap(opt_map_file) || !merge.readMap(opt_map_file) || !stream.listen(opt_socket)) return 1;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = [](int) { CovStream::stop(); };
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    llvm::outs() << "Listening on '" << opt_socket << "'.\n";
+    llvm::outs().flush();
+    stream.run(opt_once);
+
+    instru_cov_header header = stream.getHeader();
+    std::vector<uint64_t> entries = stream.getEntries();
+    merge.addDump(header, reinterpret_cast<const uint8_t *>(entries.data()), opt_socket);
+    std::map<int, uint64_t> lineCounts = merge.getLineCounts();
+    std::set<int> executedLines = merge.getExecutedLines();
+    llvm::outs() << "Received " << stream.getNumEvents() << " events from " << stream.getNumProcesses()
+                 << " processes (" << stream.getNumBroken() << " broken streams): " << executedLines.size()
+                 << " of " << lineCounts.size() << " lines executed.\n";
+
+    if (!opt_dump_file.empty()) {
+        std::error_code ec;
+        llvm::raw_fd_ostream os(opt_dump_file, ec, llvm::sys::fs::OF_None);
+        if (ec) {
+            llvm::errs() << "Failed to write '" << opt_dump_file << "': " << ec.message() << "\n";
+            return 1;
+        }
+        os.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        os.write(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(uint64_t));
+    }
+    if (!opt_counts_file.empty()) {
+        std::error_code ec;
+        llvm::raw_fd_ostream os(opt_counts_file, ec, llvm::sys::fs::OF_Text);
+        if (ec) {
+            llvm::errs() << "Failed to write '" << opt_counts_file << "': " << ec.message() << "\n";
+            return 1;
+        }
+        for (auto const &lineCount : lineCounts) os << lineCount.first << " " << lineCount.second << "\n";
+    }
+    if (!opt_func_calls_file.empty()) {
+        std::error_code ec;
+        llvm::raw_fd_ostream os(opt_func_calls_file, ec, llvm::sys::fs::OF_Text);
+        if (ec) {
+            llvm::errs() << "Failed to write '" << opt_func_calls_file << "': " << ec.message() << "\n";
+            return 1;
+        }
+        for (auto const &funcCallCount : merge.getFuncCallCounts())
+            os << funcCallCount.second << " " << funcCallCount.first << "\n";
+    }
+    if (!opt_executed_file.empty()) writeLines(opt_executed_file, executedLines);
+    if (!opt_never_executed_file.empty()) writeLines(opt_never_executed_file, merge.getNeverExecutedLines());
+
+    return 0;
+}
+
+// numbers separated by space, as read by "fixer --debloated-lines" and "cov_augment --debloated-lines"
+void writeLines(const std::string &fileName, const std::set<int> &lines) {
+    std::error_code ec;
+    llvm::raw_fd_ostream os(fileName, ec, llvm::sys::fs::OF_Text);
+    if (ec) {
+        llvm::errs() << "Failed to write '" << fileName << "': " << ec.message() << "\n";
+        exit(1);
+    }
+    for (int line : lines) os << " " << line;
+    llvm::outs() << "Output " << lines.size() << " lines to file '" << fileName << "'.\n";
+}
@@ -0,0 +1,111 @@
+#include "CTraceReader.h"
+
+#include <cstring>
+
+#include "llvm/Support/raw_ostream.h"
+
+bool CTraceReader::open(const std::string &traceFile) {
+    path = traceFile;
+    auto fileBuffer = llvm::MemoryBuffer::getFile(traceFile, false, false);
+    if (!fileBuffer) {
+        llvm::errs() << "Failed to read trace '" << traceFile << "': " << fileBuffer.getError().message() << "\n";
+        return false;
+    }
+    buffer = std::move(*fileBuffer);
+    instru_ctrace_header header;
+    if (buffer->getBufferSize() < sizeof(header)) {
+        llvm::errs() << "Invalid compressed trace '" << traceFile << "': truncated header.\n";
+        return false;
+    }
+    memcpy(&header, buffer->getBufferStart(), sizeof(header));
+    if (header.magic != INSTRU_CTRACE_MAGIC || header.version != INSTRU_CTRACE_VERSION) {
+        llvm::errs() << "Invalid compressed trace '" << traceFile << "': bad magic or version.\n";
+        return false;
+    }
+    pid = header.pid;
+    ppid = header.ppid;
+    pos = chunkEnd = reinterpret_cast<const unsigned char *>(buffer->getBufferStart()) + sizeof(header);
+    fileEnd = reinterpret_cast<const unsigned char *>(buffer->getBufferEnd());
+    return true;
+}
+
+void CTraceReader::openChunks(llvm::StringRef chunks) {
+    buffer.reset();
+    error = false;
+    pos = chunkEnd = reinterpret_cast<const unsigned char *>(chunks.begin());
+    fileEnd = reinterpret_cast<const unsigned char *>(chunks.end());
+    repeatLeft = 0;
+}
+
+// within the current chunk, or the file between chunks
+bool CTraceReader::readVarint(uint64_t &value) {
+    const unsigned char *limit = pos < chunkEnd ? chunkEnd : fileEnd;
+    value = 0;
+    for (unsigned shift = 0; pos < limit && shift < 64; shift += 7) {
+        unsigned char byte = *pos++;
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+bool CTraceReader::nextChunk() {
+    uint64_t length;
+    if (*pos++ != INSTRU_CTRACE_CHUNK || !readVarint(tid) || !readVarint(length) ||
+        length > static_cast<uint64_t>(fileEnd - pos)) {
+        error = true;
+        return false;
+    }
+    chunkEnd = pos + length;
+    numHistory = 0;
+    memset(lastIds, 0, sizeof(lastIds));
+    repeatPeriod = 0;
+    repeatLeft = 0;
+    numChunks++;
+    return true;
+}
+
+bool CTraceReader::next(TraceEvent &event) {
+    if (error) return false;
+    uint64_t key;
+    if (repeatLeft > 0) {
+        key = history[(numHistory - repeatPeriod) % INSTRU_CTRACE_HISTORY];
+        repeatLeft--;
+    } else {
+        // empty chunks are not written, but skipping them costs nothing
+        while (pos == chunkEnd) {
+            if (pos == fileEnd || !nextChunk()) return false;
+        }
+        uint64_t token;
+        if (!readVarint(token)) {
+            error = true;
+            return false;
+        }
+        unsigned type = token & 7;
+        if (type == INSTRU_CTRACE_REPEAT) {
+            uint64_t period = token >> 3, count;
+            if (!readVarint(count) || period == 0 || period > INSTRU_CTRACE_MAX_PERIOD ||
+                period > numHistory || count == 0 || count > UINT64_MAX / period) {
+                error = true;
+                return false;
+            }
+            repeatPeriod = period;
+            repeatLeft = period * count - 1;
+            numRepeatedEvents += period * count;
+            key = history[(numHistory - repeatPeriod) % INSTRU_CTRACE_HISTORY];
+        } else if (type > EDGE_EXEC) {
+            error = true;
+            return false;
+        } else {
+            uint64_t zigzag = token >> 3;
+            int64_t delta = static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+            key = (static_cast<uint64_t>(static_cast<uint32_t>(lastIds[type] + delta)) << 3) | type;
+        }
+    }
+    push(key);
+    lastIds[key & 7] = static_cast<uint32_t>(key >> 3);
+    event.type = static_cast<TraceEventType>(key & 7);
+    event.id = static_cast<unsigned>(key >> 3);
+    event.tid = tid;
+    return true;
+}
@@ -0,0 +1,95 @@
+#ifndef CTRACE_READER_H
+#define CTRACE_READER_H
+
+#include <stdint.h>
+
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <string>
+
+#include "instru_ctrace.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+// event types, as in instru_runtime.h (not included: it defines the probes)
+enum TraceEventType { STMT_EXEC = 0, BLOCK_EXEC = 1, FUNC_CALL = 2, FUNC_RETURN = 3, EDGE_EXEC = 4 };
+
+struct TraceEvent {
+    TraceEventType type;
+    unsigned id;  // line, block id, signature id or edge id (0 for FUNC_RETURN)
+    uint64_t tid;
+};
+
+/// \brief Streaming decoder of compressed traces ("<prefix>.<pid>.ctrace", see instru_ctrace.h)
+///
+/// The file is mapped and decoded one event at a time, repeats are replayed without being
+/// expanded in memory. Events come in file order: the chunks of a thread are in order, chunks of
+/// different threads are in the order they were flushed.
+///   CTraceReader reader;
+///   if (reader.open(path))
+///       for (const TraceEvent &event : reader) ...
+class CTraceReader {
+   public:
+    class iterator {
+       public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = TraceEvent;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const TraceEvent *;
+        using reference = const TraceEvent &;
+
+        explicit iterator(CTraceReader *reader = nullptr) : reader(reader) {
+            if (reader != nullptr) ++*this;
+        }
+        reference operator*() const { return event; }
+        pointer operator->() const { return &event; }
+        iterator &operator++() {
+            if (!reader->next(event)) reader = nullptr;
+            return *this;
+        }
+        bool operator==(const iterator &other) const { return reader == other.reader; }
+        bool operator!=(const iterator &other) const { return reader != other.reader; }
+
+       private:
+        CTraceReader *reader;
+        TraceEvent event;
+    };
+
+    // prints an error and returns false if the file is not a compressed trace
+    bool open(const std::string &traceFile);
+    // complete chunks without the file header (received by a stream consumer), not copied
+    void openChunks(llvm::StringRef chunks);
+    // false at the end of the trace, or at a truncated or corrupt chunk (see hasError())
+    bool next(TraceEvent &event);
+    iterator begin() { return iterator(this); }
+    iterator end() { return iterator(); }
+
+    uint64_t getPid() const { return pid; }
+    uint64_t getParentPid() const { return ppid; }
+    bool hasError() const { return error; }
+    uint64_t getNumChunks() const { return numChunks; }
+    uint64_t getNumRepeatedEvents() const { return numRepeatedEvents; }
+    size_t getFileSize() const { return buffer ? buffer->getBufferSize() : 0; }
+
+   private:
+    bool readVarint(uint64_t &value);
+    bool nextChunk();
+    void push(uint64_t key) { history[numHistory++ % INSTRU_CTRACE_HISTORY] = key; }
+
+    std::string path;
+    std::unique_ptr<llvm::MemoryBuffer> buffer;
+    const unsigned char *pos = nullptr, *chunkEnd = nullptr, *fileEnd = nullptr;
+    uint64_t pid = 0, ppid = 0, tid = 0;
+    bool error = false;
+
+    // decoder state of the chunk, mirrors __instru_ctrace_encoder
+    uint64_t history[INSTRU_CTRACE_HISTORY];
+    uint64_t numHistory = 0;
+    uint32_t lastIds[8];
+    uint32_t repeatPeriod = 0;
+    uint64_t repeatLeft = 0;  // events left to replay
+
+    uint64_t numChunks = 0, numRepeatedEvents = 0;
+};
+
+#endif  // CTRACE_READER_H
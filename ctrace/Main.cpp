@@ -0,0 +1,67 @@
+#include <string>
+
+#include "CTraceReader.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+llvm::cl::OptionCategory ctraceOptionsCategory("Ctrace Options");
+llvm::cl::list<std::string> opt_trace_files(llvm::cl::Positional, llvm::cl::desc("<compressed traces>"),
+                                            llvm::cl::OneOrMore, llvm::cl::cat(ctraceOptionsCategory));
+llvm::cl::opt<std::string> opt_output_file("o",
+                                           llvm::cl::desc("file path to the decoded trace (same format as the trace runtime, default: stdout)"),
+                                           llvm::cl::value_desc("FILEPATH"), llvm::cl::init("-"),
+                                           llvm::cl::cat(ctraceOptionsCategory));
+llvm::cl::opt<bool> opt_summary("summary", llvm::cl::desc("Only print the number of events and the compression ratio"),
+                              llvm::cl::cat(ctraceOptionsCategory));
+
+int main(int argc, const char **argv) {
+    llvm::cl::SetVersionPrinter([](llvm::raw_ostream &OS) { OS << "Ctrace version 0.1\n"; });
+    llvm::cl::HideUnrelatedOptions(ctraceOptionsCategory);
+    llvm::cl::ParseCommandLineOptions(argc, argv, "Decode the compressed traces of the instrumentation runtime");
+
+    std::error_code ec;
+    llvm::raw_fd_ostream os(opt_summary ? std::string("-") : opt_output_file, ec, llvm::sys::fs::OF_Text);
+    if (ec) {
+        llvm::errs() << "Failed to write '" << opt_output_file << "': " << ec.message() << "\n";
+        return 1;
+    }
+
+    // the text trace: "PROCESS;<pid>;<parent pid>", then events after "THREAD;<tid>;" lines
+    static const char *const prefixes[] = {"STMT_EXEC;;", "BLOCK_EXEC;;", "FUNC_CALL;", "FUNC_RETURN;;", "EDGE_EXEC;;"};
+    int status = 0;
+    for (auto &traceFile : opt_trace_files) {
+        CTraceReader reader;
+        if (!reader.open(traceFile)) {
+            status = 1;
+            continue;
+        }
+        uint64_t numEvents = 0;
+        uint64_t tid = 0, chunk = 0;
+        if (!opt_summary) os << "PROCESS;" << reader.getPid() << ";" << reader.getParentPid() << "\n";
+        for (const TraceEvent &event : reader) {
+            numEvents++;
+            if (opt_summary) continue;
+            if (reader.getNumChunks() != chunk || event.tid != tid) {
+                chunk = reader.getNumChunks();
+                tid = event.tid;
+                os << "THREAD;" << tid << ";\n";
+            }
+            os << prefixes[event.type];
+            if (event.type != FUNC_RETURN) os << event.id;
+            os << (event.type == FUNC_CALL ? ";\n" : "\n");
+        }
+        if (reader.hasError()) {
+            llvm::errs() << "Corrupt or truncated compressed trace '" << traceFile << "' after " << numEvents
+                         << " events.\n";
+            status = 1;
+        }
+        if (opt_summary)
+            os << traceFile << ": " << numEvents << " events (" << reader.getNumRepeatedEvents() << " in repeats), "
+               << reader.getNumChunks() << " chunks, " << reader.getFileSize() << " bytes ("
+               << llvm::format("%.2f", numEvents ? static_cast<double>(reader.getFileSize()) / numEvents : 0.0)
+               << " bytes per event)\n";
+    }
+    return status;
+}
@@ -10,6 +10,8 @@
 #include "clang/Rewrite/Core/Rewriter.h"
 #include "llvm/Support/CommandLine.h"
 
+#include "TestSelection.h"
+
 // Delta debugging elements
 // make sure each line can contain at most one statement
 using DDElement = std::pair<int, int>;
@@ -27,6 +29,7 @@ extern llvm::cl::opt<bool> opt_no_redir;
 extern llvm::cl::opt<bool> opt_add_back_all;
 
 extern std::set<int> addedBackLines, addedBackLinesWithoutDependencies, addedBackDependencies;
+extern TestSelection testSelection;
 
 // using DDVector = std::vector<std::pair<int, int>>;
 
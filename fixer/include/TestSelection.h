@@ -0,0 +1,63 @@
+#ifndef TEST_SELECTION_H
+#define TEST_SELECTION_H
+
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+/// \brief Selects the other tests a candidate may fail, from the coverage of each test
+///
+/// Each test is a script run with the binary ("bash TEST_SCRIPT BINARY", unlike --other-test-script
+/// which gets the source file), with the lines it executes in the original program (covmerge
+/// --executed-lines of its runs). Candidates are compared with the reference, the last program all
+/// the tests passed on (the original, then every accepted candidate): the tests executing no line
+/// where a candidate differs from it run as on the reference, and pass as there. A changed statement
+/// that no test executes (a STMT_EXEC/BLOCK_EXEC line of the instrumenter map) is skipped; any other
+/// changed line executed by no test (a declaration, a global initializer, a case label) runs all tests.
+/// The tests executing a line changed by an accepted candidate may take other paths since, and are
+/// always run.
+class TestSelection {
+  public:
+    // reads one "TEST_SCRIPT EXECUTED_LINES_FILE" per line
+    bool load(const std::string &manifestFile);
+    // reads the probed statement lines of the sidecar map of the instrumented original
+    bool loadProbedLines(const std::string &mapFile);
+    // runs every test on the original once; the tests failing on it are dropped
+    bool runBaseline(const std::string &originalFile);
+    // runs the tests executing a line of `sourceFile` changed from the reference, until one fails
+    bool test(const std::string &sourceFile, const std::string &binFile);
+    // makes `sourceFile` (an accepted candidate) the reference
+    void setReference(const std::string &sourceFile);
+
+    bool empty() { return tests.empty(); }
+    size_t size() { return tests.size(); }
+    size_t getNumRuns() { return numRuns; }
+    size_t getNumCandidates() { return numCandidates; }
+
+  private:
+    struct Test {
+        std::string script;
+        std::vector<int> lines;
+        // executed a line changed since the original, its lines are not known anymore
+        bool stale = false;
+    };
+
+    bool runTest(const Test &test, const std::string &binFile);
+    void indexLines();
+    std::vector<int> getChangedLines(const std::vector<llvm::StringRef> &lines);
+
+    std::vector<Test> tests;
+    // testsByLine[line] are the tests executing the line
+    std::vector<std::vector<unsigned>> testsByLine;
+    std::set<int> probedLines;
+    std::unique_ptr<llvm::MemoryBuffer> reference;
+    std::vector<llvm::StringRef> referenceLines;
+
+    size_t numRuns = 0, numCandidates = 0;
+};
+
+#endif // TEST_SELECTION_H
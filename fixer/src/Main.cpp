@@ -7,11 +7,13 @@
 
 #include "FileManager.h"
 #include "Frontend.h"
+#include "LinePatch.h"
 #include "clang/Frontend/FrontendAction.h"
 #include "clang/Tooling/CommonOptionsParser.h"
 #include "clang/Tooling/CompilationDatabase.h"
 #include "clang/Tooling/Tooling.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Path.h"
 #include "llvm/Support/raw_ostream.h"
 #include "clang/Frontend/TextDiagnosticBuffer.h"
 
@@ -20,6 +22,7 @@
 #include "LocalReduction.h"
 #include "Reduction.h"
 #include "DeadCodeElimination.h"
+#include "TestSelection.h"
 
 using namespace clang::tooling;
 
@@ -55,6 +58,20 @@ llvm::cl::opt<std::string>
     opt_other_test_script("other-test-script",
                           llvm::cl::desc("file path to the other test script (such as runDebInputs.sh)"),
                           llvm::cl::value_desc("FILEPATH"), llvm::cl::cat(fixerOptionsCategory));
+llvm::cl::opt<std::string>
+    opt_test_coverage("test-coverage",
+                      llvm::cl::desc("file path to the other tests and their coverage, one \"TEST_SCRIPT EXECUTED_LINES_FILE\" per line "
+                                     "(scripts run with the binary, unlike --other-test-script which gets the source file; lines of "
+                                     "the original from covmerge --executed-lines); only the tests executing a line changed from the "
+                                     "last accepted candidate are run, or all of them if a changed line is executed by no test and "
+                                     "is not a probed statement of --test-coverage-map"),
+                      llvm::cl::value_desc("FILEPATH"), llvm::cl::cat(fixerOptionsCategory));
+llvm::cl::opt<std::string>
+    opt_test_coverage_map("test-coverage-map",
+                          llvm::cl::desc("file path to the sidecar map of the instrumented original (<stem>.instru.map) the "
+                                         "coverage of --test-coverage was measured with; a changed statement no test executes "
+                                         "then runs no test"),
+                          llvm::cl::value_desc("FILEPATH"), llvm::cl::cat(fixerOptionsCategory));
 llvm::cl::opt<bool> opt_no_reduction("skip-reduction", llvm::cl::desc("Do not perform reduction after add-back"),
                                      llvm::cl::cat(fixerOptionsCategory));
 llvm::cl::opt<bool> opt_no_redir("no-redir",
@@ -63,6 +80,9 @@ llvm::cl::opt<bool> opt_no_redir("no-redir",
 llvm::cl::opt<bool> opt_add_back_all("add-back-all",
                                      llvm::cl::desc("Add back all functions and global variables and types (for debugging)"),
                                      llvm::cl::cat(fixerOptionsCategory));
+llvm::cl::opt<bool> opt_patch("patch",
+                              llvm::cl::desc("Only keep a patch of the result against the debloated file (result-file with the .patch extension, applied with linepatch)"),
+                              llvm::cl::cat(fixerOptionsCategory));
 
 int main(int argc, const char **argv) {
     llvm::cl::SetVersionPrinter([](llvm::raw_ostream &OS) { OS << "Fixer version 0.1\n"; });
@@ -86,8 +106,30 @@ int main(int argc, const char **argv) {
         debloatedLines.insert(line);
     debloatedLinesFile.close();
 
+    // results of the other tests on the original, reused for the candidates that do not change their lines
+    if (!opt_test_coverage.empty()) {
+        if (!testSelection.load(opt_test_coverage))
+            return 1;
+        if (!opt_test_coverage_map.empty() && !testSelection.loadProbedLines(opt_test_coverage_map))
+            return 1;
+        size_t numTests = testSelection.size();
+        if (!testSelection.runBaseline(opt_original_file))
+            return 1;
+        llvm::outs() << testSelection.size() << " of " << numTests << " other tests pass on the original program\n";
+    }
+
     reduceOneFile(options, debloatedLines);
 
+    // the replaced lines instead of a copy of the whole program
+    if (opt_patch) {
+        llvm::SmallString<256> patchFile(opt_result_file);
+        llvm::sys::path::replace_extension(patchFile, "patch");
+        if (!LinePatch::writeDiffToFile(opt_debloated_file, opt_result_file, std::string(patchFile.str())))
+            return 1;
+        llvm::sys::fs::remove(opt_result_file);
+        llvm::outs() << "Output the patch to file '" << patchFile << "'.\n";
+    }
+
     return 0;
 }
 
@@ -98,6 +140,7 @@ std::set<int> addedBackLines, addedBackLinesWithoutDependencies, addedBackDepend
 // used to store diagnostic messages (for deadcode elimination)
 clang::TextDiagnosticBuffer diagnosticConsumer;
 std::string tempFile;
+TestSelection testSelection;
 void reduceOneFile(CommonOptionsParser &options, std::set<int> &debloatedLines) {
     // only do one round of global add-back
     llvm::outs() << "Add-Back\n";
@@ -129,6 +172,9 @@ void reduceOneFile(CommonOptionsParser &options, std::set<int> &debloatedLines)
         llvm::outs() << "Dead Code Elimination\n";
         FrontendDCE::run({opt_result_file}, options.getCompilations(), newFrontendActionFactory<DCEAction<tempFile>>().get());
         llvm::sys::fs::copy_file(tempFile, opt_result_file);
+        // dead code elimination is not tested, its removals are not changes to test again
+        if (!testSelection.empty())
+            testSelection.setReference(opt_result_file);
         // FrontendDCE::runDCE(opt_result_file, new ClangDeadcodeElimination(debloatedLines, tempFile));
         // FrontendDCE::run({opt_result_file}, options.getCompilations(), newFrontendActionFactory<DCEAction<tempFile>>().get());
     }
@@ -137,4 +183,7 @@ void reduceOneFile(CommonOptionsParser &options, std::set<int> &debloatedLines)
     llvm::outs() << "\n";
     llvm::outs() << "Finished repairing " << opt_debloated_file << "\n";
     llvm::outs() << "Added back " << addedBackLines.size() << " lines\n";
+    if (testSelection.getNumCandidates())
+        llvm::outs() << "Ran " << testSelection.getNumRuns() << " of " << testSelection.getNumCandidates() * testSelection.size()
+                     << " other tests on " << testSelection.getNumCandidates() << " candidates\n";
 }
@@ -133,6 +133,14 @@ bool Reduction::test(const DDElementVector &toAddBack) {
             }
             success = (retcode == 0);
         }
+
+        // check if it passes the other tests that execute a changed line (run with the binary, while the
+        // other test script above gets the source file)
+        if (success && !testSelection.empty())
+            success = testSelection.test(temp_file, temp_bin_file);
+        // a passing candidate is accepted, the next ones are compared with it
+        if (success && !testSelection.empty())
+            testSelection.setReference(temp_file);
     }
 
     // remove temp files
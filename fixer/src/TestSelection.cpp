@@ -0,0 +1,197 @@
+#include "TestSelection.h"
+#include "FileManager.h"
+#include "LinePatch.h"
+#include "Reduction.h"
+
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Program.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+bool TestSelection::load(const std::string &manifestFile) {
+    std::ifstream manifest(manifestFile);
+    if (!manifest) {
+        llvm::errs() << "Failed to read test coverage '" << manifestFile << "'.\n";
+        return false;
+    }
+    std::string line;
+    for (int lineNumber = 1; std::getline(manifest, line); lineNumber++) {
+        std::istringstream fields(line);
+        std::string script, linesFile;
+        if (!(fields >> script))
+            continue;
+        if (!(fields >> linesFile)) {
+            llvm::errs() << manifestFile << ":" << lineNumber << ": expected \"TEST_SCRIPT EXECUTED_LINES_FILE\".\n";
+            return false;
+        }
+        // lines separated by space, as written by covmerge --executed-lines
+        std::ifstream executedLines(linesFile);
+        if (!executedLines) {
+            llvm::errs() << "Failed to read executed lines '" << linesFile << "'.\n";
+            return false;
+        }
+        Test test;
+        test.script = script;
+        for (int executed; executedLines >> executed;)
+            test.lines.push_back(executed);
+        tests.push_back(test);
+    }
+    return true;
+}
+
+bool TestSelection::loadProbedLines(const std::string &mapFile) {
+    auto buffer = llvm::MemoryBuffer::getFile(mapFile);
+    if (!buffer) {
+        llvm::errs() << "Failed to read '" << mapFile << "'.\n";
+        return false;
+    }
+    llvm::SmallVector<llvm::StringRef, 0> records;
+    (*buffer)->getBuffer().split(records, '\n', -1, false);
+    for (auto record : records) {
+        // "STMT_EXEC;<line>;<line>" or "BLOCK_EXEC;<id>;<line> <line>..."
+        llvm::SmallVector<llvm::StringRef, 3> fields;
+        record.split(fields, ';', 2);
+        if (fields.size() != 3 || (fields[0] != "STMT_EXEC" && fields[0] != "BLOCK_EXEC"))
+            continue;
+        llvm::SmallVector<llvm::StringRef, 8> lines;
+        fields[2].split(lines, ' ', -1, false);
+        for (auto lineStr : lines) {
+            int line;
+            if (!lineStr.getAsInteger(10, line))
+                probedLines.insert(line);
+        }
+    }
+    return true;
+}
+
+bool TestSelection::runTest(const Test &test, const std::string &binFile) {
+    llvm::Optional<llvm::StringRef> redirect_to_null[] = {llvm::None, llvm::StringRef("/dev/null"),
+                                                          llvm::StringRef("/dev/null")};
+    numRuns++;
+    int retcode;
+    if (opt_no_redir) {
+        retcode = llvm::sys::ExecuteAndWait("/bin/bash", {"/bin/bash", test.script, binFile});
+    } else {
+        retcode = llvm::sys::ExecuteAndWait("/bin/bash", {"/bin/bash", test.script, binFile}, llvm::None,
+                                            redirect_to_null);
+    }
+    if (retcode < 0) {
+        llvm::errs() << "Fatal error in running test script.\n";
+        llvm::errs() << "Using command: /bin/bash " << test.script << " " << binFile << "\n";
+        exit(1);
+    }
+    return retcode == 0;
+}
+
+bool TestSelection::runBaseline(const std::string &originalFile) {
+    auto buffer = llvm::MemoryBuffer::getFile(originalFile);
+    if (!buffer) {
+        llvm::errs() << "Failed to read '" << originalFile << "'.\n";
+        return false;
+    }
+    reference = std::move(*buffer);
+    referenceLines = LinePatch::splitLines(reference->getBuffer());
+
+    llvm::Optional<llvm::StringRef> redirect_to_null[] = {llvm::None, llvm::StringRef("/dev/null"),
+                                                          llvm::StringRef("/dev/null")};
+    std::string bin_file = FileManager::getStemName(originalFile) + ".baseline.out";
+    if (llvm::sys::ExecuteAndWait("/bin/bash", {"/bin/bash", opt_compile_script, originalFile, bin_file}, llvm::None,
+                                  redirect_to_null) != 0) {
+        llvm::errs() << "Failed to compile the original program for the baseline of the tests.\n";
+        return false;
+    }
+    std::vector<Test> passing;
+    for (auto const &test : tests) {
+        if (runTest(test, bin_file))
+            passing.push_back(test);
+        else
+            llvm::errs() << "Test " << test.script << " fails on the original program, skipped.\n";
+    }
+    llvm::sys::fs::remove(bin_file);
+    tests = passing;
+    numRuns = 0;
+
+    indexLines();
+    return true;
+}
+
+void TestSelection::indexLines() {
+    testsByLine.assign(referenceLines.size() + 1, {});
+    for (unsigned t = 0; t < tests.size(); t++) {
+        for (int line : tests[t].lines) {
+            if (line > 0 && line < (int)testsByLine.size())
+                testsByLine[line].push_back(t);
+        }
+    }
+}
+
+// lines that differ from the reference, compared as by apply-fix.py (aligned sources, same line numbers)
+std::vector<int> TestSelection::getChangedLines(const std::vector<llvm::StringRef> &lines) {
+    auto trim = [](llvm::StringRef text) { return text.trim(" \t\n\r").rtrim(';'); };
+    std::vector<int> changed;
+    size_t numLines = std::max(lines.size(), referenceLines.size());
+    for (size_t i = 0; i < numLines; i++) {
+        // lines of the reference beyond the end of the candidate are removed
+        if (i < lines.size() && i < referenceLines.size() && trim(lines[i]) == trim(referenceLines[i]))
+            continue;
+        changed.push_back(i + 1);
+    }
+    return changed;
+}
+
+bool TestSelection::test(const std::string &sourceFile, const std::string &binFile) {
+    numCandidates++;
+    auto buffer = llvm::MemoryBuffer::getFile(sourceFile);
+    if (!buffer) {
+        llvm::errs() << "Failed to read '" << sourceFile << "'.\n";
+        exit(1);
+    }
+    std::vector<llvm::StringRef> lines = LinePatch::splitLines((*buffer)->getBuffer());
+
+    std::vector<bool> selected(tests.size());
+    for (size_t t = 0; t < tests.size(); t++)
+        selected[t] = tests[t].stale;
+    bool runAll = false;
+    for (int line : getChangedLines(lines)) {
+        if (line < (int)testsByLine.size() && !testsByLine[line].empty()) {
+            for (unsigned t : testsByLine[line])
+                selected[t] = true;
+            continue;
+        }
+        // a statement no test executes does not change their runs; other lines no test executes
+        // (declarations, global initializers, case labels, else and braces) change the program in
+        // ways the coverage does not tell
+        if (!probedLines.count(line)) {
+            runAll = true;
+            break;
+        }
+    }
+    if (runAll)
+        selected.assign(tests.size(), true);
+
+    // the other tests execute the same lines as on the reference, and pass as there
+    for (size_t t = 0; t < tests.size(); t++) {
+        if (selected[t] && !runTest(tests[t], binFile))
+            return false;
+    }
+    return true;
+}
+
+void TestSelection::setReference(const std::string &sourceFile) {
+    auto buffer = llvm::MemoryBuffer::getFile(sourceFile);
+    if (!buffer) {
+        llvm::errs() << "Failed to read '" << sourceFile << "'.\n";
+        exit(1);
+    }
+    std::vector<llvm::StringRef> lines = LinePatch::splitLines((*buffer)->getBuffer());
+    for (int line : getChangedLines(lines)) {
+        if (line < (int)testsByLine.size()) {
+            for (unsigned t : testsByLine[line])
+                tests[t].stale = true;
+        }
+    }
+    reference = std::move(*buffer);
+    referenceLines = lines;
+}
@@ -0,0 +1,325 @@
+#include "GenEval.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+
+static const char NOT_IN_SPEC[] = "INPUT_NOT_IN_SPEC";
+
+static std::string joinPath(const std::string &a, const std::string &b) {
+    llvm::SmallString<256> path(a);
+    llvm::sys::path::append(path, b);
+    return std::string(path.str());
+}
+
+// sorted entries of a directory
+static std::vector<std::string> listDirectory(const std::string &dir) {
+    std::vector<std::string> entries;
+    std::error_code ec;
+    for (llvm::sys::fs::directory_iterator it(dir, ec), end; it != end && !ec; it.increment(ec))
+        entries.push_back(it->path());
+    std::sort(entries.begin(), entries.end());
+    return entries;
+}
+
+bool GenEval::collectTests(const std::string &testscriptDir) {
+    // testscript/I*/* as in the scripts of debloating_study
+    for (auto &testDir : listDirectory(testscriptDir)) {
+        std::string id = llvm::sys::path::filename(testDir).str();
+        if (id.empty() || id[0] != 'I' || !llvm::sys::fs::is_directory(testDir)) continue;
+        for (auto &script : listDirectory(testDir)) {
+            if (!llvm::sys::fs::is_regular_file(script)) continue;
+            Test test;
+            test.id = id;
+            test.script = script;
+            tests.push_back(test);
+        }
+    }
+    if (tests.empty()) {
+        llvm::errs() << "No test script in '" << testscriptDir << "'.\n";
+        return false;
+    }
+    return true;
+}
+
+void GenEval::addBinary(const std::string &label, const std::string &path) {
+    Binary binary;
+    binary.label = label;
+    binary.path = path;
+    binaries.push_back(binary);
+}
+
+size_t GenEval::getNumRelated() {
+    return std::count_if(tests.begin(), tests.end(), [](const Test &test) { return test.related == Test::RELATED; });
+}
+
+static std::string cacheKey(const std::string &id, const std::string &script) {
+    return id + "/" + llvm::sys::path::filename(script).str();
+}
+
+void GenEval::loadRelatedCache() {
+    if (options.relatedCache.empty()) return;
+    std::ifstream file(options.relatedCache);
+    std::map<std::string, bool> cached;
+    std::string status, key;
+    while (file >> status >> key) cached[key] = status == "RELATED";
+    for (auto &test : tests) {
+        auto it = cached.find(cacheKey(test.id, test.script));
+        if (it != cached.end()) test.related = it->second ? Test::RELATED : Test::UNRELATED;
+    }
+}
+
+void GenEval::saveRelatedCache() {
+    if (options.relatedCache.empty()) return;
+    std::error_code ec;
+    llvm::raw_fd_ostream os(options.relatedCache, ec, llvm::sys::fs::OF_Text);
+    if (ec) {
+        llvm::errs() << "Failed to write '" << options.relatedCache << "': " << ec.message() << "\n";
+        return;
+    }
+    for (auto &test : tests) {
+        if (test.related == Test::UNKNOWN) continue;
+        os << (test.related == Test::RELATED ? "RELATED " : "UNRELATED ") << cacheKey(test.id, test.script) << "\n";
+    }
+}
+
+bool GenEval::run() {
+    if (binaries.size() < 2) {
+        llvm::errs() << "Need the original binary and at least one binary to compare.\n";
+        return false;
+    }
+
+    // probed once rather than by every job
+    if (options.sandbox == Sandbox::AUTO)
+        options.sandbox = Sandbox::canMountOverlay(joinPath(options.workDir, "overlay-probe")) ? Sandbox::OVERLAY
+                                                                                                : Sandbox::CLONE;
+
+    // relatedness of the tests to the debloating specification, before running any binary
+    std::vector<Job> jobs;
+    if (options.relatedChecker.empty()) {
+        for (auto &test : tests) test.related = Test::RELATED;
+    } else {
+        loadRelatedCache();
+        for (size_t t = 0; t < tests.size(); t++)
+            if (tests[t].related == Test::UNKNOWN) jobs.push_back({t, -1, "", 0, 0});
+        if (!runJobs(jobs)) return false;
+        saveRelatedCache();
+    }
+
+    jobs.clear();
+    for (size_t t = 0; t < tests.size(); t++) {
+        if (tests[t].related != Test::RELATED) continue;
+        for (size_t b = 0; b < binaries.size(); b++) jobs.push_back({t, int(b), "", 0, 0});
+    }
+    return runJobs(jobs);
+}
+
+bool GenEval::runJobs(std::vector<Job> &jobs) {
+    std::map<pid_t, size_t> running;
+    size_t next = 0;
+    while (next < jobs.size() || !running.empty()) {
+        while (next < jobs.size() && running.size() < std::max(options.numJobs, 1u)) {
+            pid_t pid = startJob(jobs[next]);
+            if (pid < 0) return false;
+            running[pid] = next++;
+        }
+
+        int status;
+        pid_t pid = waitpid(-1, &status, WNOHANG);
+        if (pid > 0) {
+            auto it = running.find(pid);
+            if (it == running.end()) {
+                cleaners.erase(pid);
+                continue;
+            }
+            Job &job = jobs[it->second];
+            running.erase(it);
+            // 127: the job could not set up its directory or run bash
+            if (WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+                llvm::errs() << "Failed to run '" << tests[job.test].script << "'.\n";
+                numFailed++;
+            }
+            finishJob(job);
+            continue;
+        }
+
+        time_t now = time(NULL);
+        for (auto &entry : running) {
+            Job &job = jobs[entry.second];
+            if (job.start && now - job.start >= options.killAfter) {
+                llvm::errs() << "Killed '" << tests[job.test].script << "' after " << options.killAfter << " s.\n";
+                kill(-job.pid, SIGKILL);
+                job.start = 0;  // killed once
+                numFailed++;
+            }
+        }
+        usleep(2000);
+    }
+    // the work directory may be removed after the run
+    for (pid_t pid : cleaners) waitpid(pid, NULL, 0);
+    cleaners.clear();
+    return true;
+}
+
+pid_t GenEval::startJob(Job &job) {
+    static unsigned counter = 0;
+    job.dir = joinPath(options.workDir, "job" + std::to_string(counter++));
+    std::error_code ec = llvm::sys::fs::create_directories(joinPath(job.dir, "input"));
+    if (!ec) ec = llvm::sys::fs::create_directories(joinPath(job.dir, "output"));
+    if (ec) {
+        llvm::errs() << "Failed to create '" << job.dir << "': " << ec.message() << "\n";
+        return -1;
+    }
+
+    const Test &test = tests[job.test];
+    std::string inputDir = options.inputDir.empty() ? "" : joinPath(options.inputDir, test.id);
+    std::string outputDir = joinPath(job.dir, "output");
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        llvm::errs() << "Failed to fork: " << strerror(errno) << "\n";
+        return -1;
+    }
+    if (pid > 0) {
+        job.pid = pid;
+        job.start = time(NULL);
+        return pid;
+    }
+
+    // the child: its own process group (killed with its subprocesses), directory and copies
+    setpgid(0, 0);
+    if (chdir(job.dir.c_str()) != 0) _exit(127);
+
+    Sandbox sandbox(options.sandbox, options.preserve);
+    std::string program, scriptInput;
+    if (job.binary < 0) {
+        // the checker records whether the arguments are in the specification, the inputs are read-only
+        program = "./eval_bin.py";
+        scriptInput = inputDir;
+        if (!sandbox.copyFile(options.relatedChecker, "eval_bin.py")) _exit(127);
+    } else {
+        // testing rm may get the binary removed; same filename for same "usage" output
+        program = "./eval_bin";
+        scriptInput = "input/" + test.id;
+        if (!sandbox.copyFile(binaries[job.binary].path, "eval_bin")) _exit(127);
+        if (!inputDir.empty() && llvm::sys::fs::is_directory(inputDir) &&
+            !sandbox.populate(inputDir, joinPath(job.dir, scriptInput), joinPath(job.dir, ".sandbox")))
+            _exit(127);
+    }
+    llvm::sys::fs::setPermissions(program, llvm::sys::fs::all_read | llvm::sys::fs::all_exe |
+                                               llvm::sys::fs::owner_write);
+
+    int devNull = open("/dev/null", O_RDWR);
+    if (devNull >= 0) {
+        dup2(devNull, STDIN_FILENO);
+        dup2(devNull, STDOUT_FILENO);
+        dup2(devNull, STDERR_FILENO);
+        close(devNull);
+    }
+    // args: "binary outdir timeout indir"
+    std::string timeout = std::to_string(options.scriptTimeout);
+    execl("/bin/bash", "bash", test.script.c_str(), program.c_str(), outputDir.c_str(), timeout.c_str(),
+          scriptInput.c_str(), (char *)NULL);
+    _exit(127);
+}
+
+void GenEval::finishJob(Job &job) {
+    // subprocesses left behind by the script
+    kill(-job.pid, SIGKILL);
+
+    if (job.binary < 0) {
+        bool related = llvm::sys::fs::exists(joinPath(job.dir, "is_related"));
+        tests[job.test].related = related ? Test::RELATED : Test::UNRELATED;
+    } else {
+        std::string outputDir = joinPath(job.dir, "output");
+        hashOutputs(job, outputDir);
+        if (!options.keepOutputsDir.empty()) {
+            std::string keepDir = joinPath(joinPath(options.keepOutputsDir, binaries[job.binary].label), tests[job.test].id);
+            llvm::sys::fs::create_directories(keepDir);
+            std::vector<llvm::StringRef> cp = {"cp", "-r", "-T", outputDir, keepDir};
+            llvm::sys::ExecuteAndWait("/bin/cp", cp);
+        }
+    }
+
+    // removed by a child process, so that the next jobs start meanwhile
+    pid_t pid = fork();
+    if (pid == 0) {
+        Sandbox::remove(job.dir);
+        _exit(0);
+    }
+    if (pid > 0) cleaners.insert(pid);
+    else Sandbox::remove(job.dir);
+}
+
+void GenEval::hashOutputs(Job &job, const std::string &outputDir) {
+    const Test &test = tests[job.test];
+    auto &outputs = binaries[job.binary].outputs;
+    const size_t overlap = sizeof(NOT_IN_SPEC) - 2;
+
+    std::error_code ec;
+    for (llvm::sys::fs::recursive_directory_iterator it(outputDir, ec), end; it != end && !ec; it.increment(ec)) {
+        if (it->type() != llvm::sys::fs::file_type::regular_file) continue;
+        std::ifstream file(it->path(), std::ios::binary);
+        if (!file) continue;
+
+        // in chunks, keeping the end of the previous chunk to find the marker across chunks
+        llvm::MD5 md5;
+        bool notInSpec = false;
+        std::string window;
+        char buffer[1 << 16];
+        while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0) {
+            llvm::StringRef chunk(buffer, file.gcount());
+            md5.update(chunk);
+            if (!notInSpec) {
+                window.append(chunk.data(), chunk.size());
+                notInSpec = window.find(NOT_IN_SPEC) != std::string::npos;
+                if (window.size() > overlap) window.erase(0, window.size() - overlap);
+            }
+        }
+        llvm::MD5::MD5Result result;
+        md5.final(result);
+
+        llvm::StringRef relPath(it->path());
+        relPath = relPath.drop_front(outputDir.size()).ltrim('/');
+        auto key = std::make_pair(test.id, relPath.str());
+        auto existing = outputs.find(key);
+        if (existing != outputs.end() && existing->second.test > job.test) continue;
+        Output &output = outputs[key];
+        output.digest = std::string(result.digest().str());
+        output.notInSpec = notInSpec;
+        output.test = job.test;
+    }
+}
+
+void GenEval::printSummary(llvm::raw_ostream &os) {
+    // files of the original that do not contain "INPUT_NOT_IN_SPEC"
+    auto &reference = binaries[0].outputs;
+    size_t total = std::count_if(reference.begin(), reference.end(),
+                                 [](const std::pair<const std::pair<std::string, std::string>, Output> &entry) {
+                                     return !entry.second.notInSpec;
+                                 });
+    os << "Related tests: " << getNumRelated() << "/" << tests.size() << "\n";
+    if (numFailed) os << "Failed or killed jobs: " << numFailed << "\n";
+    for (size_t b = 1; b < binaries.size(); b++) {
+        // files in both output trees that differ, as counted by "diff -qr"
+        size_t differ = 0;
+        for (auto &entry : binaries[b].outputs) {
+            auto it = reference.find(entry.first);
+            if (it != reference.end() && it->second.digest != entry.second.digest) differ++;
+        }
+        os << "Generality problems count (" << binaries[b].label << "): " << differ << "/" << total << "\n";
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef GEN_EVAL_H
+#define GEN_EVAL_H
+
+#include <sys/types.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Sandbox.h"
+#include "llvm/Support/raw_ostream.h"
+
+/// \brief Generality evaluation of debloated binaries against the original one
+///
+/// Every test script (testscript/<test id>/<script>, run as "script BINARY OUTDIR TIMEOUT INDIR")
+/// runs once per binary. Jobs run in parallel, each in its own scratch directory with a private view
+/// of the inputs and of the binary (scripts of rm or make delete them, see Sandbox). Output files are hashed
+/// when a job ends, then removed, so output trees are neither kept nor diffed. Tests unrelated to
+/// the debloating specification (per the wrapper of create_wrapper_to_check_related) are skipped.
+class GenEval {
+   public:
+    struct Options {
+        std::string inputDir;        // input.origin (<test id> subdirectories), may be empty
+        std::string relatedChecker;  // instantiated wrapper_template_check_related.py, may be empty
+        std::string relatedCache;    // file keeping the results of the checker, may be empty
+        std::string workDir;
+        std::string keepOutputsDir;  // outputs moved to <dir>/<label>/<test id>/, may be empty
+        unsigned numJobs = 1;
+        unsigned scriptTimeout = 1;  // passed to the scripts
+        unsigned killAfter = 60;     // seconds, then the process group of a job is killed
+        bool preserve = false;       // keep attributes of the inputs (cp -p, for make)
+        Sandbox::Mode sandbox = Sandbox::AUTO;
+    };
+
+    // a file written by a script, relative to its output directory
+    struct Output {
+        std::string digest;
+        bool notInSpec = false;  // contains "INPUT_NOT_IN_SPEC"
+        size_t test = 0;         // the script that wrote it (the last one wins, as in a sequential run)
+    };
+
+    GenEval(const Options &options) : options(options) {}
+
+    bool collectTests(const std::string &testscriptDir);
+    // binaries[0] is the reference, the others are compared with it
+    void addBinary(const std::string &label, const std::string &path);
+    bool run();
+    void printSummary(llvm::raw_ostream &os);
+
+    size_t getNumTests() { return tests.size(); }
+    size_t getNumRelated();
+
+   private:
+    struct Test {
+        std::string id, script;
+        enum { UNKNOWN, RELATED, UNRELATED } related = UNKNOWN;
+    };
+    struct Binary {
+        std::string label, path;
+        std::map<std::pair<std::string, std::string>, Output> outputs;  // (test id, file) -> output
+    };
+    struct Job {
+        size_t test;
+        int binary;  // -1 for the relatedness check
+        std::string dir;
+        pid_t pid;
+        time_t start;
+    };
+
+    void loadRelatedCache();
+    void saveRelatedCache();
+    bool runJobs(std::vector<Job> &jobs);
+    pid_t startJob(Job &job);
+    void finishJob(Job &job);
+    void hashOutputs(Job &job, const std::string &outputDir);
+
+    Options options;
+    std::vector<Test> tests;
+    std::vector<Binary> binaries;
+    std::set<pid_t> cleaners;  // processes removing the directories of finished jobs
+    unsigned numFailed = 0;
+};
+
+#endif  // GEN_EVAL_H
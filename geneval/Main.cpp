@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <string>
+#include <thread>
+
+#include "GenEval.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+llvm::cl::OptionCategory genevalOptionsCategory("Geneval Options");
+llvm::cl::opt<std::string> opt_testscript_dir("testscripts",
+                                              llvm::cl::desc("directory of the test scripts (<test id>/<script>)"),
+                                              llvm::cl::value_desc("DIR"), llvm::cl::Required,
+                                              llvm::cl::cat(genevalOptionsCategory));
+llvm::cl::opt<std::string> opt_input_dir("inputs",
+                                         llvm::cl::desc("directory of the inputs (input.origin, <test id> subdirectories)"),
+                                         llvm::cl::value_desc("DIR"),
+                                         llvm::cl::cat(genevalOptionsCategory));
+llvm::cl::opt<std::string> opt_original_binary("original",
+                                               llvm::cl::desc("file path to the original binary (the reference)"),
+                                               llvm::cl::value_desc("FILEPATH"), llvm::cl::Required,
+                                               llvm::cl::cat(genevalOptionsCategory));
+llvm::cl::list<std::string> opt_binaries("binary",
+                                         llvm::cl::desc("binary compared with the original, reported with its label"),
+                                         llvm::cl::value_desc("LABEL=FILEPATH"), llvm::cl::OneOrMore,
+                                         llvm::cl::cat(genevalOptionsCategory));
+llvm::cl::opt<std::string> opt_related_checker("related-checker",
+                                               llvm::cl::desc("wrapper creating \"is_related\" if the test is in the debloating specification (all tests otherwise)"),
+                                               llvm::cl::value_desc("FILEPATH"),
+                                               llvm::cl::cat(genevalOptionsCategory));
+llvm::cl::opt<std::string> opt_related_cache("related-cache",
+                                             llvm::cl::desc("file keeping the results of the related checker across runs"),
+                                             llvm::cl::value_desc("FILEPATH"),
+                                             llvm::cl::cat(genevalOptionsCategory));
+llvm::cl::opt<unsigned> opt_jobs("jobs", llvm::cl::init(0),
+                                 llvm::cl::desc("number of scripts run in parallel (default: number of cores)"),
+                                 llvm::cl::value_desc("N"),
+                                 llvm::cl::cat(genevalOptionsCategory));
+llvm::cl::opt<unsigned> opt_timeout("timeout", llvm::cl::init(1),
+                                    llvm::cl::desc("timeout passed to the scripts, in seconds"),
+                                    llvm::cl::value_desc("SECONDS"),
+                                    llvm::cl::cat(genevalOptionsCategory));
+llvm::cl::opt<unsigned> opt_kill_after("kill-after", llvm::cl::init(60),
+                                       llvm::cl::desc("kill a script and its subprocesses after this time, in seconds"),
+                                       llvm::cl::value_desc("SECONDS"),
+                                       llvm::cl::cat(genevalOptionsCategory));
+llvm::cl::opt<bool> opt_preserve("preserve", llvm::cl::init(false),
+                                 llvm::cl::desc("copy the inputs with their attributes (timestamps for make)"),
+                                 llvm::cl::cat(genevalOptionsCategory));
+llvm::cl::opt<std::string> opt_sandbox("sandbox", llvm::cl::init("auto"),
+                                       llvm::cl::desc("private inputs of the scripts: overlay, clone (reflinks or copies), hardlink, copy or auto (overlay, else clone)"),
+                                       llvm::cl::value_desc("MODE"),
+                                       llvm::cl::cat(genevalOptionsCategory));
+llvm::cl::opt<std::string> opt_work_dir("work-dir",
+                                        llvm::cl::desc("directory of the scratch directories of the scripts (default: a temporary directory)"),
+                                        llvm::cl::value_desc("DIR"),
+                                        llvm::cl::cat(genevalOptionsCategory));
+llvm::cl::opt<std::string> opt_keep_outputs("keep-outputs",
+                                            llvm::cl::desc("copy the outputs to <DIR>/<label>/<test id>/ (only hashed otherwise)"),
+                                            llvm::cl::value_desc("DIR"),
+                                            llvm::cl::cat(genevalOptionsCategory));
+
+static std::string makeAbsolute(const std::string &path) {
+    llvm::SmallString<256> absolute(path);
+    llvm::sys::fs::make_absolute(absolute);
+    return std::string(absolute.str());
+}
+
+int main(int argc, const char **argv) {
+    llvm::cl::SetVersionPrinter([](llvm::raw_ostream &OS) { OS << "Geneval version 0.1\n"; });
+    llvm::cl::HideUnrelatedOptions(genevalOptionsCategory);
+    llvm::cl::ParseCommandLineOptions(argc, argv, "Compare the outputs of debloated binaries with the original on the test scripts");
+
+    // scripts run in their own directories, so every path is absolute
+    GenEval::Options options;
+    options.inputDir = opt_input_dir.empty() ? "" : makeAbsolute(opt_input_dir);
+    options.relatedChecker = opt_related_checker.empty() ? "" : makeAbsolute(opt_related_checker);
+    options.relatedCache = opt_related_cache;
+    options.keepOutputsDir = opt_keep_outputs.empty() ? "" : makeAbsolute(opt_keep_outputs);
+    options.numJobs = opt_jobs ? opt_jobs : std::max(1u, std::thread::hardware_concurrency());
+    options.scriptTimeout = opt_timeout;
+    options.killAfter = opt_kill_after;
+    options.preserve = opt_preserve;
+    if (!Sandbox::parseMode(opt_sandbox, options.sandbox)) {
+        llvm::errs() << "Invalid sandbox mode '" << opt_sandbox << "'.\n";
+        return 1;
+    }
+
+    bool removeWorkDir = opt_work_dir.empty();
+    if (removeWorkDir) {
+        llvm::SmallString<256> workDir;
+        if (std::error_code ec = llvm::sys::fs::createUniqueDirectory("geneval", workDir)) {
+            llvm::errs() << "Failed to create a temporary directory: " << ec.message() << "\n";
+            return 1;
+        }
+        options.workDir = makeAbsolute(std::string(workDir.str()));
+    } else {
+        options.workDir = makeAbsolute(opt_work_dir);
+        llvm::sys::fs::create_directories(options.workDir);
+    }
+
+    GenEval eval(options);
+    if (!eval.collectTests(makeAbsolute(opt_testscript_dir))) return 1;
+    eval.addBinary("original", makeAbsolute(opt_original_binary));
+    for (auto &binary : opt_binaries) {
+        size_t pos = binary.find('=');
+        if (pos == std::string::npos) {
+            llvm::errs() << "Invalid binary '" << binary << "', expected LABEL=FILEPATH.\n";
+            return 1;
+        }
+        eval.addBinary(binary.substr(0, pos), makeAbsolute(binary.substr(pos + 1)));
+    }
+
+    llvm::outs() << "Running " << eval.getNumTests() << " test scripts with " << options.numJobs << " jobs.\n";
+    bool ok = eval.run();
+    if (removeWorkDir) Sandbox::remove(options.workDir);
+    if (!ok) return 1;
+
+    llvm::outs() << "\n";
+    eval.printSummary(llvm::outs());
+    return 0;
+}
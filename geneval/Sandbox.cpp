@@ -0,0 +1,208 @@
+#include "Sandbox.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <vector>
+
+bool Sandbox::parseMode(llvm::StringRef name, Mode &mode) {
+    if (name == "auto") mode = AUTO;
+    else if (name == "overlay") mode = OVERLAY;
+    else if (name == "clone") mode = CLONE;
+    else if (name == "hardlink") mode = HARDLINK;
+    else if (name == "copy") mode = COPY;
+    else return false;
+    return true;
+}
+
+// names of the entries of a directory
+static bool listDirectory(const std::string &dir, std::vector<std::string> &names) {
+    DIR *d = opendir(dir.c_str());
+    if (!d) return false;
+    while (struct dirent *entry = readdir(d)) {
+        std::string name = entry->d_name;
+        if (name != "." && name != "..") names.push_back(name);
+    }
+    closedir(d);
+    return true;
+}
+
+static bool writeFile(const char *path, const std::string &content) {
+    int fd = open(path, O_WRONLY);
+    if (fd < 0) return false;
+    bool ok = write(fd, content.data(), content.size()) == ssize_t(content.size());
+    close(fd);
+    return ok;
+}
+
+bool Sandbox::populate(const std::string &source, const std::string &target, const std::string &scratchDir) {
+    switch (mode) {
+        case AUTO:
+            // a failed mount may leave the process in a user namespace where copies fail, so probe first
+            return (canMountOverlay(scratchDir + "/probe") && mountOverlay(source, target, scratchDir)) ||
+                   copyTree(source, target, false);
+        case OVERLAY:
+            return mountOverlay(source, target, scratchDir);
+        case CLONE:
+            return copyTree(source, target, false);
+        case HARDLINK:
+            return copyTree(source, target, true);
+        case COPY:
+            canClone = false;
+            return copyTree(source, target, false);
+    }
+    return false;
+}
+
+bool Sandbox::canMountOverlay(const std::string &scratchDir) {
+    std::string lower = scratchDir + "/lower", target = scratchDir + "/target";
+    if ((mkdir(scratchDir.c_str(), 0700) != 0 && errno != EEXIST) ||
+        (mkdir(lower.c_str(), 0700) != 0 && errno != EEXIST))
+        return false;
+    // the namespaces and the mount go away with the child
+    pid_t pid = fork();
+    if (pid == 0) {
+        Sandbox sandbox(OVERLAY, false);
+        _exit(sandbox.mountOverlay(lower, target, scratchDir + "/overlay") ? 0 : 1);
+    }
+    int status = 0;
+    bool ok = pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    remove(scratchDir);
+    return ok;
+}
+
+bool Sandbox::mountOverlay(const std::string &source, const std::string &target, const std::string &scratchDir) {
+    // the options of overlayfs separate paths with ',' and ':'
+    if (source.find_first_of(",:") != std::string::npos || scratchDir.find_first_of(",:") != std::string::npos)
+        return false;
+
+    // unprivileged users mount in a user namespace mapping their own ids (Linux 5.11 or later)
+    uid_t uid = getuid();
+    gid_t gid = getgid();
+    if (uid != 0) {
+        if (unshare(CLONE_NEWUSER | CLONE_NEWNS) != 0) return false;
+        writeFile("/proc/self/setgroups", "deny");
+        if (!writeFile("/proc/self/uid_map", std::to_string(uid) + " " + std::to_string(uid) + " 1\n") ||
+            !writeFile("/proc/self/gid_map", std::to_string(gid) + " " + std::to_string(gid) + " 1\n"))
+            return false;
+    } else if (unshare(CLONE_NEWNS) != 0) {
+        return false;
+    }
+    if (mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) != 0) return false;
+
+    std::string upper = scratchDir + "/upper", work = scratchDir + "/work";
+    struct stat st;
+    mkdir(scratchDir.c_str(), 0700);
+    if (stat(source.c_str(), &st) != 0 || (mkdir(upper.c_str(), 0700) != 0 && errno != EEXIST) ||
+        (mkdir(work.c_str(), 0700) != 0 && errno != EEXIST) || (mkdir(target.c_str(), 0755) != 0 && errno != EEXIST))
+        return false;
+    // the root of the overlay has the attributes of the upper directory
+    struct timespec times[2] = {st.st_atim, st.st_mtim};
+    chmod(upper.c_str(), st.st_mode & 07777);
+    utimensat(AT_FDCWD, upper.c_str(), times, 0);
+    std::string options = "lowerdir=" + source + ",upperdir=" + upper + ",workdir=" + work;
+    return mount("overlay", target.c_str(), "overlay", 0, options.c_str()) == 0;
+}
+
+bool Sandbox::copyFile(const std::string &source, const std::string &target) {
+    int in = open(source.c_str(), O_RDONLY);
+    if (in < 0) return false;
+    struct stat st;
+    if (fstat(in, &st) != 0) {
+        close(in);
+        return false;
+    }
+    int out = open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 0777);
+    if (out < 0) {
+        close(in);
+        return false;
+    }
+
+    bool ok = false;
+#ifdef FICLONE
+    if (canClone) {
+        ok = ioctl(out, FICLONE, in) == 0;
+        // not supported by the file system, or across file systems
+        if (!ok && (errno == EOPNOTSUPP || errno == EXDEV || errno == EINVAL || errno == ENOTTY)) canClone = false;
+    }
+#endif
+    if (!ok) {
+        ok = true;
+        for (ssize_t n; ok && (n = copy_file_range(in, NULL, out, NULL, 1 << 30, 0)) != 0;) {
+            if (n > 0) continue;
+            if (errno != ENOSYS && errno != EXDEV && errno != EINVAL) {
+                ok = false;
+                break;
+            }
+            // older kernels
+            char buffer[1 << 16];
+            for (ssize_t r; (r = read(in, buffer, sizeof(buffer))) != 0;)
+                if (r < 0 || write(out, buffer, r) != r) {
+                    ok = false;
+                    break;
+                }
+            break;
+        }
+    }
+    if (ok && preserve) {
+        struct timespec times[2] = {st.st_atim, st.st_mtim};
+        fchmod(out, st.st_mode & 07777);
+        futimens(out, times);
+    }
+    close(in);
+    close(out);
+    return ok;
+}
+
+bool Sandbox::copyTree(const std::string &source, const std::string &target, bool link) {
+    struct stat st;
+    if (lstat(source.c_str(), &st) != 0) return false;
+
+    if (S_ISDIR(st.st_mode)) {
+        std::vector<std::string> names;
+        if ((mkdir(target.c_str(), st.st_mode & 07777) != 0 && errno != EEXIST) || !listDirectory(source, names))
+            return false;
+        bool ok = true;
+        for (auto &name : names) ok &= copyTree(source + "/" + name, target + "/" + name, link);
+        // after the entries, which update the times of the directory
+        if (preserve) {
+            struct timespec times[2] = {st.st_atim, st.st_mtim};
+            chmod(target.c_str(), st.st_mode & 07777);
+            utimensat(AT_FDCWD, target.c_str(), times, 0);
+        }
+        return ok;
+    }
+    if (S_ISLNK(st.st_mode)) {
+        std::vector<char> path(st.st_size + 1);
+        ssize_t n = readlink(source.c_str(), path.data(), path.size());
+        if (n < 0) return false;
+        return symlink(std::string(path.data(), n).c_str(), target.c_str()) == 0;
+    }
+    if (S_ISFIFO(st.st_mode)) return mkfifo(target.c_str(), st.st_mode & 07777) == 0;
+    if (!S_ISREG(st.st_mode)) return true;  // devices and sockets are not copied
+    if (link && ::link(source.c_str(), target.c_str()) == 0) return true;
+    return copyFile(source, target);
+}
+
+void Sandbox::remove(const std::string &path) {
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0) return;
+    if (!S_ISDIR(st.st_mode)) {
+        unlink(path.c_str());
+        return;
+    }
+    // scripts of rm remove the permissions of their directories
+    if ((st.st_mode & S_IRWXU) != S_IRWXU) chmod(path.c_str(), st.st_mode | S_IRWXU);
+    std::vector<std::string> names;
+    listDirectory(path, names);
+    for (auto &name : names) remove(path + "/" + name);
+    rmdir(path.c_str());
+}
@@ -0,0 +1,41 @@
+#ifndef SANDBOX_H
+#define SANDBOX_H
+
+#include <string>
+
+#include "llvm/ADT/StringRef.h"
+
+/// \brief Private views of input trees for test scripts, which may modify or delete their inputs
+///
+/// An overlay mounts the input tree read-only under a private upper directory, in a mount
+/// namespace of the calling process (it disappears with it). A clone replicates the directories
+/// and reflinks the files (copy-on-write on btrfs or xfs), or copies them on other file systems.
+/// A hardlink farm shares the files with the inputs, so it only suits scripts that delete or
+/// replace files and never write to them. Call populate() in the process running the script.
+class Sandbox {
+   public:
+    enum Mode { AUTO, OVERLAY, CLONE, HARDLINK, COPY };
+
+    Sandbox(Mode mode, bool preserve) : mode(mode), preserve(preserve) {}
+
+    static bool parseMode(llvm::StringRef name, Mode &mode);
+
+    // the view of the directory `source` at `target`, with scratch files in `scratchDir`
+    bool populate(const std::string &source, const std::string &target, const std::string &scratchDir);
+    // a private copy of a file (reflinked if possible)
+    bool copyFile(const std::string &source, const std::string &target);
+    // whether overlays can be mounted (tried in a child process, with scratch files in `scratchDir`)
+    static bool canMountOverlay(const std::string &scratchDir);
+    // removes a tree, even if scripts made some of its directories read-only
+    static void remove(const std::string &path);
+
+   private:
+    bool mountOverlay(const std::string &source, const std::string &target, const std::string &scratchDir);
+    bool copyTree(const std::string &source, const std::string &target, bool link);
+
+    Mode mode;
+    bool preserve;   // timestamps and modes of the inputs (cp -p)
+    bool canClone = true;  // reflinks are not supported once they fail
+};
+
+#endif  // SANDBOX_H
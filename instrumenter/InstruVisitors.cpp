@@ -1,8 +1,11 @@
 #include "InstruVisitors.h"
 
+#include <algorithm>
+#include <cmath>
+
 #include "SourceManager.h"
-#include "clang/AST/ParentMapContext.h"
 #include "clang/Lex/Lexer.h"
+#include "llvm/Support/Format.h"
 
 using BinaryOperator = clang::BinaryOperator;
 using BreakStmt = clang::BreakStmt;
@@ -36,7 +39,7 @@ bool FunctionDeclVisitor::VisitFunctionDecl(FunctionDecl* fd) {
     if (fd->isThisDeclarationADefinition() && fd->hasBody()) {
         if (RwTool.isInMainFile(fd->getLocation())) {
             // Insert function-end instru code
-            std::string fd_sig = getFuncSignature(fd);
+            std::string fd_sig = internFuncSignature(fd);
             if (const CompoundStmt* cs = llvm::dyn_cast<CompoundStmt>(fd->getBody())) {
                 SourceLocation loc = cs->getEndLoc();
                 if (loc.isMacroID()) {
@@ -214,10 +217,401 @@ bool StmtVisitor::VisitStmt(Stmt* stmt) {
     return true;
 }
 
+double BasicBlockVisitor::overheadBudget = 0;
+
+// only record the site, probes are inserted after the whole function is grouped into blocks
+void BasicBlockVisitor::instruStmt(const Stmt* stmt, std::string src_fname, bool is_return_stmt,
+                                   bool wrap_with_braces) {
+    // unselected lines are not grouped (returns only get FUNC_RETURN)
+    if (!isSelectedLine(stmt->getBeginLoc()))
+        InstruVisitor::instruStmt(stmt, src_fname, is_return_stmt, wrap_with_braces);
+    else
+        probeSites.push_back({stmt, is_return_stmt, wrap_with_braces});
+}
+
+bool BasicBlockVisitor::VisitFunctionDecl(FunctionDecl* fd) {
+    if (!fd->isThisDeclarationADefinition() || !fd->hasBody()) return true;
+    if (!RwTool.isInMainFile(fd->getLocation())) return true;
+    CompoundStmt* cs = llvm::dyn_cast<CompoundStmt>(fd->getBody());
+    if (!cs) return true;
+
+    // collect exactly the sites StmtVisitor would instrument (StmtVisitor::VisitStmt also inserts
+    // the null stmts after switch case colons, keep them for the same reason)
+    probeSites.clear();
+    std::string src_fname = RwTool.GetSrcFilename(fd->getLocation());
+    instruCompoundStmtAsStmtBody(cs, src_fname, true);
+    for (Stmt* child : getAllChildren(cs)) StmtVisitor::VisitStmt(child);
+
+    std::unique_ptr<clang::CFG> cfg =
+        clang::CFG::buildCFG(fd, fd->getBody(), astContext, clang::CFG::BuildOptions());
+    std::vector<ProbeGroup> groups = groupProbeSites(fd, cfg.get());
+    std::vector<ProbeSelection> selections(groups.size());
+    if (overheadBudget > 0 && cfg) selections = selectProbes(*cfg, groups);
+
+    std::vector<std::string> block_ids;
+    for (size_t i = 0; i < groups.size(); i++) block_ids.push_back(std::to_string(nextBlockId++));
+    for (size_t i = 0; i < groups.size(); i++) {
+        const ProbeSelection& selection = selections[i];
+        std::set<unsigned> lines;
+        for (const ProbeSite* site : groups[i].sites) {
+            SourceLocation loc = site->stmt->getBeginLoc();
+            if (loc.isValid()) lines.insert(RwTool.GetSourceManager().getSpellingLineNumber(loc));
+        }
+        std::string lines_str;
+        for (unsigned line : lines) lines_str += (lines_str.empty() ? "" : " ") + std::to_string(line);
+        addSidecarRecord("BLOCK_EXEC", block_ids[i], lines_str);
+
+        numProbes++;
+        if (selection.kind == ProbeSelection::OBSERVED) {
+            numKeptProbes++;
+        } else {
+            // "EQUIV <id>" or "DOM <id> <id>...": ids of the blocks with a probe implying it
+            std::string implicants_str = selection.kind == ProbeSelection::EQUIVALENT ? "EQUIV" : "DOM";
+            for (size_t k : selection.implicants) implicants_str += " " + block_ids[k];
+            addSidecarRecord("BLOCK_IMPLIED", block_ids[i], implicants_str);
+        }
+        for (unsigned line : lines) {
+            auto it = lineGuarantees.find(line);
+            if (it == lineGuarantees.end() || selection.kind < it->second) lineGuarantees[line] = selection.kind;
+        }
+
+        for (const ProbeSite* site : groups[i].sites) {
+            std::string instru_str0;
+            if (site == groups[i].sites.front() && selection.kind == ProbeSelection::OBSERVED)
+                instru_str0 += generateInsertionString("BLOCK_EXEC", "", block_ids[i]);
+            if (site->is_return_stmt) instru_str0 += generateInsertionString("FUNC_RETURN", "", "");
+            if (instru_str0.empty()) continue;
+            if (site->wrap_with_braces) instru_str0 = "{ " + instru_str0;
+            wrapWithStrings(site->stmt, instru_str0, site->wrap_with_braces ? " }" : "");
+        }
+    }
+    return true;
+}
+
+// Group the sites of a function so that all sites of a group run whenever the first one runs:
+//   - a site belongs to the block where it is entered (its first CFG element evaluated)
+//   - blocks of a fall-through chain (single successor -> single predecessor) share one group
+// Sites that cannot be placed (no CFG, no elements, several entries) get a group of their own.
+std::vector<ProbeGroup> BasicBlockVisitor::groupProbeSites(FunctionDecl* fd, clang::CFG* cfg) {
+    std::vector<ProbeGroup> groups;
+
+    std::map<const Stmt*, const ProbeSite*> sites, owners;
+    for (auto const& site : probeSites) sites[site.stmt] = &site;
+    mapSubStmtsToSites(fd->getBody(), nullptr, sites, owners);
+
+    if (!cfg) {
+        for (auto const& site : probeSites) groups.push_back({{&site}, nullptr});
+        return groups;
+    }
+
+    // sites touched by each block (in evaluation order) and blocks touched by each site
+    std::map<const clang::CFGBlock*, std::vector<const ProbeSite*>> sitesOfBlock;
+    std::map<const ProbeSite*, std::set<const clang::CFGBlock*>> blocksOfSite;
+    for (const clang::CFGBlock* block : *cfg) {
+        std::vector<const Stmt*> stmts;
+        for (const clang::CFGElement& element : *block) {
+            if (llvm::Optional<clang::CFGStmt> cfg_stmt = element.getAs<clang::CFGStmt>())
+                stmts.push_back(cfg_stmt->getStmt());
+        }
+        // such as break, continue and goto (which are not elements)
+        if (const Stmt* terminator = block->getTerminatorStmt()) stmts.push_back(terminator);
+        for (const Stmt* stmt : stmts) {
+            auto owner = owners.find(stmt);
+            if (owner == owners.end() || owner->second == nullptr) continue;
+            if (blocksOfSite[owner->second].insert(block).second)
+                sitesOfBlock[block].push_back(owner->second);
+        }
+    }
+
+    // the entry block of a site is the only one reachable from outside of the site
+    std::map<const ProbeSite*, const clang::CFGBlock*> entryOfSite;
+    for (auto const& site : probeSites) {
+        const clang::CFGBlock* entry = nullptr;
+        int n_entries = 0;
+        for (const clang::CFGBlock* block : blocksOfSite[&site]) {
+            bool is_entry = true;
+            for (const clang::CFGBlock* pred : block->preds()) {
+                if (pred == nullptr) continue;
+                is_entry = false;
+                if (blocksOfSite[&site].count(pred) == 0) {
+                    is_entry = true;
+                    break;
+                }
+            }
+            if (is_entry) {
+                entry = block;
+                n_entries++;
+            }
+        }
+        if (n_entries == 1) {
+            entryOfSite[&site] = entry;
+        } else {
+            groups.push_back({{&site}, nullptr});
+        }
+    }
+
+    // walk every fall-through chain from its head
+    std::map<const clang::CFGBlock*, const clang::CFGBlock*> heads;
+    for (const clang::CFGBlock* block : *cfg) {
+        const clang::CFGBlock* head = getChainHead(*cfg, block, heads);
+        heads[block] = head;
+    }
+    for (const clang::CFGBlock* head : *cfg) {
+        if (heads[head] != head) continue;
+        std::vector<const ProbeSite*> group;
+        std::set<const clang::CFGBlock*> visited;
+        for (const clang::CFGBlock* block = head; block && visited.insert(block).second;) {
+            for (const ProbeSite* site : sitesOfBlock[block]) {
+                if (entryOfSite.count(site) && entryOfSite[site] == block) group.push_back(site);
+            }
+            const clang::CFGBlock* next = nullptr;
+            for (const clang::CFGBlock* succ : block->succs()) {
+                if (succ && heads[succ] == head) next = succ;
+            }
+            block = next;
+        }
+        if (!group.empty()) groups.push_back({group, entryOfSite[group.front()]});
+    }
+
+    return groups;
+}
+
+// With an overhead budget, a group loses its probe when its execution can be inferred from the
+// probes that are kept (assuming the function returns normally, see the README):
+//   - EQUIVALENT: it dominates a kept group that post-dominates it (or the reverse), so it runs
+//     exactly when that group runs; equivalent groups always share one probe, the cheapest
+//   - DOMINATOR: it dominates kept groups, so it ran if any of them did (whether it never ran is
+//     unknown); only used, most expensive probes first, until the estimated cost fits the budget
+// The cost of a probe is its expected number of executions (8 per enclosing loop) relative to the
+// work of its block (its library calls).
+std::vector<ProbeSelection> BasicBlockVisitor::selectProbes(clang::CFG& cfg,
+                                                            const std::vector<ProbeGroup>& groups) {
+    std::vector<ProbeSelection> selections(groups.size());
+    clang::CFGDomTree dom;
+    dom.buildDominatorTree(&cfg);
+    clang::CFGPostDomTree postDom;
+    postDom.buildDominatorTree(&cfg);
+
+    // dominance is meaningless for unreachable blocks, their groups keep the probe
+    std::set<const clang::CFGBlock*> reachable;
+    std::vector<const clang::CFGBlock*> worklist = {&cfg.getEntry()};
+    while (!worklist.empty()) {
+        const clang::CFGBlock* block = worklist.back();
+        worklist.pop_back();
+        if (!reachable.insert(block).second) continue;
+        for (const clang::CFGBlock* succ : block->succs()) {
+            if (succ) worklist.push_back(succ);
+        }
+    }
+    auto isRemovable = [&](size_t i) { return groups[i].block && reachable.count(groups[i].block); };
+
+    std::map<const clang::CFGBlock*, int> depths = getLoopDepths(cfg, dom, reachable);
+    std::vector<double> costs;
+    double functionCost = 0;
+    for (auto const& group : groups) {
+        int depth = group.block ? depths[group.block] : 0;
+        int n_calls = group.block ? countLibraryCalls(group.block) : 0;
+        costs.push_back(std::pow(8.0, depth) / (1 + n_calls));
+        functionCost += costs.back();
+    }
+
+    // classes of equivalent groups
+    std::vector<std::vector<size_t>> classes;
+    std::vector<size_t> classOf(groups.size());
+    for (size_t i = 0; i < groups.size(); i++) {
+        size_t c = 0;
+        for (; isRemovable(i) && c < classes.size(); c++) {
+            const clang::CFGBlock *a = groups[classes[c].front()].block, *b = groups[i].block;
+            if (!isRemovable(classes[c].front())) continue;
+            if ((dom.dominates(a, b) && postDom.dominates(b, a)) || (dom.dominates(b, a) && postDom.dominates(a, b)))
+                break;
+        }
+        if (!isRemovable(i) || c == classes.size()) classes.push_back({});
+        classOf[i] = isRemovable(i) ? c : classes.size() - 1;
+        classes[classOf[i]].push_back(i);
+    }
+    std::vector<bool> kept(groups.size(), false);
+    std::vector<size_t> keptOfClass;
+    double classesCost = 0;
+    for (auto const& members : classes) {
+        size_t cheapest = members.front();
+        for (size_t m : members) {
+            if (costs[m] < costs[cheapest]) cheapest = m;
+        }
+        for (size_t m : members) {
+            if (m != cheapest) selections[m] = {ProbeSelection::EQUIVALENT, {cheapest}};
+        }
+        kept[cheapest] = true;
+        keptOfClass.push_back(cheapest);
+        classesCost += costs[cheapest];
+    }
+
+    // then whole classes, while over budget
+    std::vector<size_t> order(classes.size());
+    for (size_t c = 0; c < classes.size(); c++) order[c] = c;
+    std::stable_sort(order.begin(), order.end(),
+                     [&](size_t a, size_t b) { return costs[keptOfClass[a]] > costs[keptOfClass[b]]; });
+    auto dominatesKept = [&](size_t m, size_t c) {
+        for (size_t k = 0; k < groups.size(); k++) {
+            if (kept[k] && classOf[k] != c && isRemovable(k) && dom.dominates(groups[m].block, groups[k].block))
+                return true;
+        }
+        return false;
+    };
+    for (size_t c : order) {
+        if (classesCost <= overheadBudget * functionCost) break;
+        if (!isRemovable(keptOfClass[c])) continue;
+        bool inferable = true;
+        for (size_t m : classes[c]) inferable = inferable && dominatesKept(m, c);
+        if (!inferable) continue;
+        kept[keptOfClass[c]] = false;
+        classesCost -= costs[keptOfClass[c]];
+        for (size_t m : classes[c]) selections[m].kind = ProbeSelection::DOMINATOR;
+    }
+
+    // implicants are the kept groups dominated in the end (a removed group dominated some group,
+    // which itself dominated a kept one if it was removed later)
+    for (size_t i = 0; i < groups.size(); i++) {
+        if (selections[i].kind != ProbeSelection::DOMINATOR) continue;
+        selections[i].implicants.clear();
+        for (size_t k = 0; k < groups.size(); k++) {
+            if (kept[k] && isRemovable(k) && dom.dominates(groups[i].block, groups[k].block))
+                selections[i].implicants.push_back(k);
+        }
+    }
+
+    fullCost += functionCost;
+    keptCost += classesCost;
+    return selections;
+}
+
+// loop nesting depth of every block: the natural loop of a back edge (to a block dominating its
+// source) holds the blocks reaching the source without going through the loop header
+std::map<const clang::CFGBlock*, int> BasicBlockVisitor::getLoopDepths(
+    const clang::CFG& cfg, const clang::CFGDomTree& dom, const std::set<const clang::CFGBlock*>& reachable) {
+    std::map<const clang::CFGBlock*, std::set<const clang::CFGBlock*>> loops;
+    for (const clang::CFGBlock* block : cfg) {
+        if (!reachable.count(block)) continue;
+        for (const clang::CFGBlock* header : block->succs()) {
+            if (!header || !dom.dominates(header, block)) continue;
+            std::set<const clang::CFGBlock*>& body = loops[header];
+            body.insert(header);
+            std::vector<const clang::CFGBlock*> worklist = {block};
+            while (!worklist.empty()) {
+                const clang::CFGBlock* b = worklist.back();
+                worklist.pop_back();
+                if (!body.insert(b).second) continue;
+                for (const clang::CFGBlock* pred : b->preds()) {
+                    if (pred && reachable.count(pred)) worklist.push_back(pred);
+                }
+            }
+        }
+    }
+    std::map<const clang::CFGBlock*, int> depths;
+    for (auto const& loop : loops) {
+        for (const clang::CFGBlock* block : loop.second) depths[block]++;
+    }
+    return depths;
+}
+
+// calls to functions not defined in the main file
+int BasicBlockVisitor::countLibraryCalls(const clang::CFGBlock* block) {
+    int n_calls = 0;
+    for (const clang::CFGElement& element : *block) {
+        llvm::Optional<clang::CFGStmt> cfg_stmt = element.getAs<clang::CFGStmt>();
+        const CallExpr* ce = cfg_stmt ? llvm::dyn_cast<CallExpr>(cfg_stmt->getStmt()) : nullptr;
+        if (ce == nullptr) continue;
+        const FunctionDecl* callee = ce->getDirectCallee();
+        const FunctionDecl* definition = nullptr;
+        if (callee == nullptr || !callee->hasBody(definition) || !RwTool.isInMainFile(definition->getLocation()))
+            n_calls++;
+    }
+    return n_calls;
+}
+
+// chosen probes and how the coverage of the lines is known
+void BasicBlockVisitor::printSummary() {
+    if (overheadBudget <= 0) return;
+    unsigned n_lines[3] = {0, 0, 0};
+    for (auto const& lineGuarantee : lineGuarantees) n_lines[lineGuarantee.second]++;
+    double costPercent = fullCost > 0 ? 100 * keptCost / fullCost : 100;
+    llvm::outs() << "Overhead budget " << llvm::format("%.1f", 100 * overheadBudget) << "%: kept "
+                 << numKeptProbes << " of " << numProbes << " block probes (estimated cost "
+                 << llvm::format("%.1f", costPercent) << "% of block instrumentation).\n";
+    if (keptCost > overheadBudget * fullCost)
+        llvm::outs() << "  The budget cannot be met without losing the coverage of some lines.\n";
+    llvm::outs() << "  Lines observed by probes: " << n_lines[ProbeSelection::OBSERVED] << "\n"
+                 << "  Lines inferred exactly (if functions return normally): "
+                 << n_lines[ProbeSelection::EQUIVALENT] << "\n"
+                 << "  Lines inferred only when executed (never executed is unknown): "
+                 << n_lines[ProbeSelection::DOMINATOR] << "\n";
+}
+
+// the owner of a sub-stmt is the innermost site containing it
+void BasicBlockVisitor::mapSubStmtsToSites(const Stmt* stmt, const ProbeSite* site,
+                                           const std::map<const Stmt*, const ProbeSite*>& sites,
+                                           std::map<const Stmt*, const ProbeSite*>& owners) {
+    if (stmt == nullptr) return;
+    auto it = sites.find(stmt);
+    if (it != sites.end()) site = it->second;
+    owners[stmt] = site;
+    for (const Stmt* child : stmt->children()) mapSubStmtsToSites(child, site, sites, owners);
+}
+
+// follow single-predecessor blocks whose predecessor has a single successor (always falls through)
+const clang::CFGBlock* BasicBlockVisitor::getChainHead(
+    const clang::CFG& cfg, const clang::CFGBlock* block,
+    std::map<const clang::CFGBlock*, const clang::CFGBlock*>& heads) {
+    std::vector<const clang::CFGBlock*> path;
+    std::set<const clang::CFGBlock*> visited;
+    while (visited.insert(block).second) {
+        auto known = heads.find(block);
+        if (known != heads.end()) {
+            block = known->second;
+            break;
+        }
+        const clang::CFGBlock* pred = nullptr;
+        int n_preds = 0, n_succs = 0;
+        for (const clang::CFGBlock* p : block->preds()) {
+            if (p) {
+                pred = p;
+                n_preds++;
+            }
+        }
+        if (n_preds != 1 || pred == &cfg.getEntry()) break;
+        for (const clang::CFGBlock* s : pred->succs()) {
+            if (s) n_succs++;
+        }
+        if (n_succs != 1) break;
+        path.push_back(block);
+        block = pred;
+    }
+    for (const clang::CFGBlock* b : path) heads[b] = block;
+    return block;
+}
+
+// Keep track of the enclosing statement instead of climbing the parent map for every CallExpr
+bool FunctionCallVisitor::TraverseStmt(Stmt* stmt) {
+    if (stmt == nullptr) return InstruVisitor::TraverseStmt(stmt);
+
+    if (const Expr* expr = llvm::dyn_cast<Expr>(stmt)) {
+        if (enclosingStmts.back().outermost_expr != nullptr) return InstruVisitor::TraverseStmt(stmt);
+        enclosingStmts.back().outermost_expr = expr;
+        bool ret = InstruVisitor::TraverseStmt(stmt);
+        enclosingStmts.back().outermost_expr = nullptr;
+        return ret;
+    }
+
+    enclosingStmts.push_back({stmt, nullptr});
+    bool ret = InstruVisitor::TraverseStmt(stmt);
+    enclosingStmts.pop_back();
+    return ret;
+}
+
 // Only instrument functions that are defined outside the main file (library function calls)
 // FIXME: temporarily ignore "printf" function
 bool FunctionCallVisitor::VisitCallExpr(CallExpr* ce) {
-    if (!RwTool.isInMainFile(ce->getBeginLoc())) {
+    if (!RwTool.isInMainFile(ce->getBeginLoc()) || !isSelectedLine(ce->getBeginLoc())) {
         return true;
     }
 
@@ -239,33 +633,19 @@ bool FunctionCallVisitor::VisitCallExpr(CallExpr* ce) {
         }
 
         clang::SourceManager& theSM = RwTool.GetSourceManager();
-        std::string instru_str0 = generateInsertionString("FUNC_CALL", getFuncSignature(fd), "");
+        std::string instru_str0 = generateInsertionString("FUNC_CALL", internFuncSignature(fd), "");
         std::string instru_str1 = generateInsertionString("FUNC_RETURN", "", "");
 
         // Expr can be an individual Stmt while VarDecl must be wrapped in DeclStmt.
-        const Stmt* parentStmt = ce;
-        for (auto parents = this->astContext->getParents(*ce); !parents.empty();) {
-            if (const Expr* expr = parents[0].get<Expr>()) {
-                parentStmt = expr;
-                parents = this->astContext->getParents(*expr);
-                continue;
-            } else if (const Decl* decl = parents[0].get<Decl>()) {
-                // such as VarDecl...
-                parents = this->astContext->getParents(*decl);
-                continue;
-            } else if (parents[0].get<CompoundStmt>() || parents[0].get<IfStmt>() ||
-                       parents[0].get<DoStmt>() || parents[0].get<ForStmt>() ||
-                       parents[0].get<SwitchStmt>() || parents[0].get<WhileStmt>() ||
-                       parents[0].get<SwitchCase>() || parents[0].get<LabelStmt>()) {
-                break;
-            } else if (const Stmt* stmt = parents[0].get<Stmt>()) {
-                parentStmt = stmt;
-                break;
-            } else {
-                llvm::errs() << "Unknown parent type when finding CallExpr ("
-                             << getLineNumber(ce->getBeginLoc()) << ") 's parent.\n";
-                return true;
-            }
+        const EnclosingStmt& enclosing = enclosingStmts.back();
+        const Stmt* parentStmt = enclosing.outermost_expr;
+        if (enclosing.stmt != nullptr && !llvm::isa<CompoundStmt>(enclosing.stmt) &&
+            !llvm::isa<IfStmt>(enclosing.stmt) && !llvm::isa<DoStmt>(enclosing.stmt) &&
+            !llvm::isa<ForStmt>(enclosing.stmt) && !llvm::isa<SwitchStmt>(enclosing.stmt) &&
+            !llvm::isa<WhileStmt>(enclosing.stmt) && !llvm::isa<SwitchCase>(enclosing.stmt) &&
+            !llvm::isa<LabelStmt>(enclosing.stmt)) {
+            // such as DeclStmt, ReturnStmt...
+            parentStmt = enclosing.stmt;
         }
 
         if (parentStmt != nullptr) {
@@ -281,3 +661,81 @@ bool FunctionCallVisitor::VisitCallExpr(CallExpr* ce) {
     }
     return true;
 }
+
+bool EdgeVisitor::VisitStmt(Stmt* stmt) {
+    if (stmt->getBeginLoc().isMacroID() || !RwTool.isInMainFile(stmt->getBeginLoc())) return true;
+    if (!isSelectedLine(stmt->getBeginLoc())) return true;
+
+    // the false edge gets the lower id (the value of the condition is added to it)
+    auto addConditionEdges = [&](const clang::Expr* cond, std::string false_kind, const Stmt* false_target,
+                                 std::string true_kind, const Stmt* true_target) {
+        SourceLocation begin, end;
+        if (cond == nullptr || !getConditionRange(cond, begin, end)) return;
+        unsigned id = addEdge(false_kind, stmt, false_target);
+        addEdge(true_kind, stmt, true_target);
+        // parenthesized, the condition may be a comma expression
+        RwTool.InsertTextBefore(begin, "INSTRU_EDGE(" + std::to_string(id) + ", (");
+        RwTool.InsertTextAfter(end, "))");
+    };
+
+    if (IfStmt* is = llvm::dyn_cast<IfStmt>(stmt)) {
+        addConditionEdges(is->getCond(), "IF_ELSE", is->getElse(), "IF_THEN", is->getThen());
+    } else if (clang::WhileStmt* ws = llvm::dyn_cast<clang::WhileStmt>(stmt)) {
+        addConditionEdges(ws->getCond(), "LOOP_EXIT", nullptr, "LOOP_BODY", ws->getBody());
+    } else if (clang::ForStmt* fs = llvm::dyn_cast<clang::ForStmt>(stmt)) {
+        addConditionEdges(fs->getCond(), "LOOP_EXIT", nullptr, "LOOP_BODY", fs->getBody());
+    } else if (clang::DoStmt* ds = llvm::dyn_cast<clang::DoStmt>(stmt)) {
+        // the true edge of a do-while condition is the back edge
+        addConditionEdges(ds->getCond(), "LOOP_EXIT", nullptr, "LOOP_BACK", ds->getBody());
+    } else if (clang::SwitchStmt* ss = llvm::dyn_cast<clang::SwitchStmt>(stmt)) {
+        // probes after the colons also count the cases entered by falling through
+        clang::SourceManager& theSM = RwTool.GetSourceManager();
+        const clang::LangOptions& theLO = RwTool.GetLangOptions();
+        bool has_default = false;
+        for (clang::SwitchCase* sc = ss->getSwitchCaseList(); sc; sc = sc->getNextSwitchCase()) {
+            has_default = has_default || llvm::isa<clang::DefaultStmt>(sc);
+            if (sc->getColonLoc().isMacroID()) continue;
+            SourceLocation after_colon = clang::Lexer::getLocForEndOfToken(sc->getColonLoc(), 0, theSM, theLO);
+            unsigned id = addEdge(llvm::isa<clang::DefaultStmt>(sc) ? "SWITCH_DEFAULT" : "SWITCH_CASE", ss, sc);
+            RwTool.InsertTextAfter(after_colon, " " + generateInsertionString("EDGE_EXEC", "", std::to_string(id)));
+        }
+        // falling off the end of the switch body is a break, so the added default cannot be reached otherwise
+        CompoundStmt* body = llvm::dyn_cast_or_null<CompoundStmt>(ss->getBody());
+        if (!has_default && body && !body->getRBracLoc().isMacroID()) {
+            unsigned id = addEdge("SWITCH_DEFAULT", ss, nullptr);
+            RwTool.InsertTextBefore(body->getRBracLoc(), "break; default: " + generateInsertionString(
+                                                                                   "EDGE_EXEC", "", std::to_string(id)));
+        }
+    }
+    return true;
+}
+
+unsigned EdgeVisitor::addEdge(std::string kind, const Stmt* branch, const Stmt* target) {
+    unsigned id = nextEdgeId++;
+    std::string branch_line = getLineRange(branch);
+    branch_line = branch_line.substr(0, branch_line.find('-'));
+    addSidecarRecord("EDGE", std::to_string(id), kind + " " + branch_line + " " + getLineRange(target));
+    return id;
+}
+
+// file locations around the condition, which must not be part of a macro expansion
+bool EdgeVisitor::getConditionRange(const clang::Expr* cond, SourceLocation& begin, SourceLocation& end) {
+    clang::SourceManager& theSM = RwTool.GetSourceManager();
+    const clang::LangOptions& theLO = RwTool.GetLangOptions();
+    begin = cond->getBeginLoc();
+    end = cond->getEndLoc();
+    if (begin.isMacroID() && !clang::Lexer::isAtStartOfMacroExpansion(begin, theSM, theLO, &begin)) return false;
+    if (end.isMacroID() && !clang::Lexer::isAtEndOfMacroExpansion(end, theSM, theLO, &end)) return false;
+    end = clang::Lexer::getLocForEndOfToken(end, 0, theSM, theLO);
+    return begin.isValid() && end.isValid();
+}
+
+// "<first line>-<last line>", or "0-0" without a statement (such as a missing else)
+std::string EdgeVisitor::getLineRange(const Stmt* stmt) {
+    if (stmt == nullptr) return "0-0";
+    clang::SourceManager& theSM = RwTool.GetSourceManager();
+    SourceLocation begin = theSM.getFileLoc(stmt->getBeginLoc()), end = theSM.getFileLoc(stmt->getEndLoc());
+    if (begin.isInvalid() || end.isInvalid()) return "0-0";
+    return std::to_string(theSM.getSpellingLineNumber(begin)) + "-" +
+           std::to_string(theSM.getSpellingLineNumber(end));
+}
@@ -1,4 +1,8 @@
+#include <map>
+
 #include "Instrumentation.h"
+#include "clang/Analysis/Analyses/Dominators.h"
+#include "clang/Analysis/CFG.h"
 
 // break visitors apart to avoid conflicts in rewriting
 
@@ -10,6 +14,64 @@ class StmtVisitor : public InstruVisitor {
     bool VisitFunctionDecl(clang::FunctionDecl* FD);
     bool VisitStmt(clang::Stmt* stmt);
 };
+
+// a statement that would get a STMT_EXEC probe in statement granularity
+struct ProbeSite {
+    const clang::Stmt* stmt;
+    bool is_return_stmt;
+    bool wrap_with_braces;
+};
+
+// sites of a group run together, only the first one gets a probe
+struct ProbeGroup {
+    std::vector<const ProbeSite*> sites;
+    const clang::CFGBlock* block;  // block entering the first site (nullptr if unknown)
+};
+
+// how the execution of a group is known (with an overhead budget, see selectProbes)
+struct ProbeSelection {
+    enum Kind { OBSERVED, EQUIVALENT, DOMINATOR } kind = OBSERVED;
+    std::vector<size_t> implicants;  // groups with a probe implying its execution
+};
+
+// replaces StmtVisitor in block granularity: sites are collected exactly like StmtVisitor does, but
+// only the first site of every (fall-through chain of) basic block(s) gets a BLOCK_EXEC probe, and
+// the sidecar map records all the lines a block covers
+class BasicBlockVisitor : public StmtVisitor {
+   public:
+    BasicBlockVisitor(clang::Rewriter& TheRewriter) : StmtVisitor(TheRewriter) {}
+
+    bool VisitFunctionDecl(clang::FunctionDecl* FD);
+    bool VisitStmt(clang::Stmt* stmt) { return true; }
+    void instruStmt(const clang::Stmt* stmt, std::string src_fname, bool is_return_stmt,
+                    bool wrap_with_braces);
+    void printSummary();
+
+    // estimated cost of the kept probes relative to block instrumentation (0: no budget)
+    static double overheadBudget;
+
+   private:
+    std::vector<ProbeGroup> groupProbeSites(clang::FunctionDecl* FD, clang::CFG* cfg);
+    std::vector<ProbeSelection> selectProbes(clang::CFG& cfg, const std::vector<ProbeGroup>& groups);
+    std::map<const clang::CFGBlock*, int> getLoopDepths(const clang::CFG& cfg,
+                                                        const clang::CFGDomTree& dom,
+                                                        const std::set<const clang::CFGBlock*>& reachable);
+    int countLibraryCalls(const clang::CFGBlock* block);
+    void mapSubStmtsToSites(const clang::Stmt* stmt, const ProbeSite* site,
+                            const std::map<const clang::Stmt*, const ProbeSite*>& sites,
+                            std::map<const clang::Stmt*, const ProbeSite*>& owners);
+    const clang::CFGBlock* getChainHead(const clang::CFG& cfg, const clang::CFGBlock* block,
+                                        std::map<const clang::CFGBlock*, const clang::CFGBlock*>& heads);
+
+    std::vector<ProbeSite> probeSites;
+    unsigned nextBlockId = 0;
+
+    // summary of the probe selection
+    unsigned numProbes = 0, numKeptProbes = 0;
+    double fullCost = 0, keptCost = 0;
+    std::map<unsigned, ProbeSelection::Kind> lineGuarantees;
+};
+
 class FunctionDeclVisitor : public InstruVisitor {
     using InstruVisitor::InstruVisitor;
 
@@ -20,7 +82,35 @@ class FunctionCallVisitor : public InstruVisitor {
     using InstruVisitor::InstruVisitor;
 
    public:
+    bool TraverseStmt(clang::Stmt* S);
     bool VisitCallExpr(clang::CallExpr* ce);
+
+   private:
+    // innermost enclosing non-expression statement (nullptr outside of function bodies) and the
+    // outermost expression in it that contains the node being visited
+    struct EnclosingStmt {
+        const clang::Stmt* stmt;
+        const clang::Expr* outermost_expr;
+    };
+    std::vector<EnclosingStmt> enclosingStmts = {{nullptr, nullptr}};
+};
+
+// edge coverage (--edges): conditions of if / while / for / do statements are wrapped with
+// INSTRU_EDGE, which counts their false and true edges, and every case of a switch gets an
+// EDGE_EXEC probe (a default case is added when missing). EDGE records of the sidecar map give
+// "<kind> <branch line> <first line>-<last line>" of the statements an edge leads to.
+class EdgeVisitor : public InstruVisitor {
+    using InstruVisitor::InstruVisitor;
+
+   public:
+    bool VisitStmt(clang::Stmt* stmt);
+
+   private:
+    unsigned addEdge(std::string kind, const clang::Stmt* branch, const clang::Stmt* target);
+    bool getConditionRange(const clang::Expr* cond, clang::SourceLocation& begin, clang::SourceLocation& end);
+    std::string getLineRange(const clang::Stmt* stmt);
+
+    unsigned nextEdgeId = 0;
 };
 
 class StmtInstruAction : public clang::ASTFrontendAction {
@@ -31,6 +121,14 @@ class StmtInstruAction : public clang::ASTFrontendAction {
         return std::unique_ptr<clang::ASTConsumer>(new Instrumentation<StmtVisitor>());
     }
 };
+class BlockInstruAction : public clang::ASTFrontendAction {
+   public:
+    std::unique_ptr<clang::ASTConsumer> CreateASTConsumer(clang::CompilerInstance& CI,
+                                                          clang::StringRef InFile) final {
+        llvm::outs() << "Instrument source file '" << InFile.str() << "' (block granularity).\n";
+        return std::unique_ptr<clang::ASTConsumer>(new Instrumentation<BasicBlockVisitor>());
+    }
+};
 class FuncDeclInstruAction : public clang::ASTFrontendAction {
    public:
     std::unique_ptr<clang::ASTConsumer> CreateASTConsumer(clang::CompilerInstance& CI,
@@ -44,4 +142,11 @@ class CallExprInstruAction : public clang::ASTFrontendAction {
                                                           clang::StringRef InFile) final {
         return std::unique_ptr<clang::ASTConsumer>(new Instrumentation<FunctionCallVisitor>());
     }
+};
+class EdgeInstruAction : public clang::ASTFrontendAction {
+   public:
+    std::unique_ptr<clang::ASTConsumer> CreateASTConsumer(clang::CompilerInstance& CI,
+                                                          clang::StringRef InFile) final {
+        return std::unique_ptr<clang::ASTConsumer>(new Instrumentation<EdgeVisitor>());
+    }
 };
\ No newline at end of file
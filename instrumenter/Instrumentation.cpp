@@ -1,7 +1,13 @@
 #include "Instrumentation.h"
 
+#include <algorithm>
+#include <tuple>
+
 #include "SourceManager.h"
 #include "clang/Lex/Lexer.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
 
 using BinaryOperator = clang::BinaryOperator;
 using BreakStmt = clang::BreakStmt;
@@ -34,12 +40,122 @@ using SwitchCase = clang::SwitchCase;
 void InstruVisitor::instruStmt(const Stmt* stmt, std::string src_fname, bool is_return_stmt,
                                bool wrap_with_braces) {
     clang::SourceManager& theSM = RwTool.GetSourceManager();
+    // returns of unselected lines still need FUNC_RETURN to match the FUNC_CALL of the function
+    bool selected = isSelectedLine(stmt->getBeginLoc());
+    if (!selected && !is_return_stmt) return;
     std::string line_number = getLineNumber(stmt->getBeginLoc());
-    std::string instru_str0 = generateInsertionString("STMT_EXEC", "", line_number);
+    std::string instru_str0 = selected ? generateInsertionString("STMT_EXEC", "", line_number) : "";
     if (is_return_stmt) instru_str0 += generateInsertionString("FUNC_RETURN", "", "");
-    if (wrap_with_braces) instru_str0 = "{\n" + instru_str0;
-    std::string instru_str1 = wrap_with_braces ? "\n}\n" : "";
+    if (wrap_with_braces) instru_str0 = "{ " + instru_str0;
+    std::string instru_str1 = wrap_with_braces ? " }" : "";
     wrapWithStrings(stmt, instru_str0, instru_str1);
+    if (selected && line_number != "?") addSidecarRecord("STMT_EXEC", line_number, line_number);
+}
+
+std::string InstruVisitor::runtime = "printf";
+bool InstruVisitor::afl = false;
+std::set<std::string> InstruVisitor::onlyFunctions;
+std::map<int, int> InstruVisitor::onlyLines;
+
+// merged with the ranges it overlaps or touches
+void InstruVisitor::addOnlyLineRange(int begin, int end) {
+    auto it = onlyLines.upper_bound(begin);
+    if (it != onlyLines.begin() && std::prev(it)->second + 1LL >= begin) {
+        --it;
+        begin = it->first;
+        end = std::max(end, it->second);
+    }
+    while (it != onlyLines.end() && it->first <= end + 1LL) {
+        end = std::max(end, it->second);
+        it = onlyLines.erase(it);
+    }
+    onlyLines[begin] = end;
+}
+
+// "10-20" or "35"
+bool InstruVisitor::addOnlyLines(llvm::StringRef range) {
+    llvm::StringRef first, last;
+    std::tie(first, last) = range.trim().split('-');
+    int begin, end;
+    if (first.trim().getAsInteger(10, begin)) return false;
+    if (last.empty())
+        end = begin;
+    else if (last.trim().getAsInteger(10, end))
+        return false;
+    if (begin > end) return false;
+    addOnlyLineRange(begin, end);
+    return true;
+}
+
+// numbers separated by space (debloated lines format)
+bool InstruVisitor::addOnlyLinesFromFile(const std::string& fileName) {
+    auto buffer = llvm::MemoryBuffer::getFile(fileName, true);
+    if (!buffer) return false;
+    llvm::SmallVector<llvm::StringRef, 0> lines;
+    (*buffer)->getBuffer().split(lines, ' ', -1, false);
+    for (auto lineStr : lines) {
+        int line;
+        if (!lineStr.trim().getAsInteger(10, line)) addOnlyLineRange(line, line);
+    }
+    return true;
+}
+
+bool InstruVisitor::isSelectedFunction(const FunctionDecl* fd) {
+    if (onlyFunctions.empty() && onlyLines.empty()) return true;
+    if (onlyFunctions.count(fd->getNameAsString())) return true;
+    clang::SourceManager& theSM = RwTool.GetSourceManager();
+    SourceRange range = fd->getSourceRange();
+    if (range.isInvalid()) return false;
+    // the last range starting before the end of the function is the only one that may overlap it
+    auto it = onlyLines.upper_bound(theSM.getSpellingLineNumber(range.getEnd()));
+    return it != onlyLines.begin() && std::prev(it)->second >= (int)theSM.getSpellingLineNumber(range.getBegin());
+}
+
+// probes keep the line layout of the source, so lines are the original ones in every pass
+bool InstruVisitor::isSelectedLine(const SourceLocation loc) {
+    if (wholeFunctionSelected) return true;
+    if (loc.isInvalid()) return false;
+    int line = RwTool.GetSourceManager().getSpellingLineNumber(loc);
+    auto it = onlyLines.upper_bound(line);
+    return it != onlyLines.begin() && std::prev(it)->second >= line;
+}
+
+bool InstruVisitor::TraverseFunctionDecl(FunctionDecl* fd) {
+    if (fd->isThisDeclarationADefinition() && !isSelectedFunction(fd)) return true;
+    bool savedWholeFunctionSelected = wholeFunctionSelected;
+    wholeFunctionSelected = (onlyFunctions.empty() && onlyLines.empty()) ||
+                            onlyFunctions.count(fd->getNameAsString());
+    bool ret = clang::RecursiveASTVisitor<InstruVisitor>::TraverseFunctionDecl(fd);
+    wholeFunctionSelected = savedWholeFunctionSelected;
+    return ret;
+}
+
+void InstruVisitor::addSidecarRecord(std::string kind, std::string id, std::string payload) {
+    sidecarRecords.push_back(kind + ";" + id + ";" + payload);
+}
+
+// "path/prog.instru.c" -> "path/prog.instru.map"
+std::string InstruVisitor::getSidecarFilename() {
+    clang::SourceManager& theSM = RwTool.GetSourceManager();
+    llvm::SmallString<256> path(
+        RwTool.GetSrcFilename(theSM.getLocForStartOfFile(theSM.getMainFileID())));
+    llvm::sys::path::replace_extension(path, "map");
+    return std::string(path.str());
+}
+
+// every pass appends its own records (the file is truncated by the driver before the first pass)
+void InstruVisitor::writeSidecarFile() {
+    if (sidecarRecords.empty()) return;
+    std::string sidecar_fname = getSidecarFilename();
+    std::error_code ec;
+    llvm::raw_fd_ostream os(sidecar_fname, ec, llvm::sys::fs::OF_Append | llvm::sys::fs::OF_Text);
+    if (ec) {
+        llvm::errs() << "Failed to write sidecar map '" << sidecar_fname << "': " << ec.message()
+                     << "\n";
+        return;
+    }
+    for (auto const& record : sidecarRecords) os << record << "\n";
+    sidecarRecords.clear();
 }
 
 // FIXME: Actually, it should be AFTER the semicolon token, not BEFORE the next token
@@ -139,11 +255,34 @@ std::string InstruVisitor::getFuncSignature(const FunctionDecl* fd) {
     return fd_name + param_types;
 }
 
+std::map<std::string, unsigned> InstruVisitor::funcSignatureIds;
+
+// FUNC_CALL probes only carry the id, the signature goes to the sidecar map ("FUNC_SIG;ID;SIGNATURE")
+std::string InstruVisitor::internFuncSignature(const FunctionDecl* fd) {
+    std::string func_signature = getFuncSignature(fd);
+    auto it = funcSignatureIds.find(func_signature);
+    if (it == funcSignatureIds.end()) {
+        unsigned id = funcSignatureIds.size();
+        it = funcSignatureIds.insert(std::make_pair(func_signature, id)).first;
+    }
+    std::string id = std::to_string(it->second);
+    if (recordedFuncSignatureIds.insert(it->second).second)
+        addSidecarRecord("FUNC_SIG", id, func_signature);
+    return id;
+}
+
 std::string InstruVisitor::generateInsertionString(std::string type, std::string func_signature,
                                                    std::string stmt_line) {
+    if (runtime != "printf") {
+        // the probe runtime (instru_runtime.h) only needs the id of the event
+        std::string id = !func_signature.empty() ? func_signature : stmt_line;
+        if (id.empty() || id == "?") id = "0";
+        return "INSTRU_PROBE(" + type + ", " + id + "); ";
+    }
     std::string content = type + ";" + func_signature + ";" + stmt_line;
     // add a newline at the beginning to separate from original outputs of the instrumented program
-    return "printf(\"\\n" + content + "\\n\");\n";
+    // (no newline after the probe, so that lines of the instrumented file are the original ones)
+    return "printf(\"\\n" + content + "\\n\"); ";
 }
 
 std::string InstruVisitor::getLineNumber(const clang::SourceLocation loc) {
@@ -225,3 +364,46 @@ std::vector<clang::Stmt*> InstruVisitor::getAllPrimitiveChildrenStmts(clang::Com
     }
     return AllPrimitiveChildrenStmts;
 }
+
+std::string addRuntimeToSource(const std::string& source, const std::string& mapFile,
+                               const std::string& runtimeDir, bool blockGranularity) {
+    unsigned n_sites = 1, n_funcs = 1, n_edges = 0;
+    if (auto mapBuffer = llvm::MemoryBuffer::getFile(mapFile)) {
+        llvm::SmallVector<llvm::StringRef, 0> records;
+        (*mapBuffer)->getBuffer().split(records, '\n', -1, false);
+        for (auto record : records) {
+            llvm::StringRef kind, rest;
+            std::tie(kind, rest) = record.split(';');
+            unsigned id;
+            if (rest.split(';').first.getAsInteger(10, id)) continue;
+            if (kind == "STMT_EXEC" || kind == "BLOCK_EXEC")
+                n_sites = std::max(n_sites, id + 1);
+            else if (kind == "FUNC_SIG")
+                n_funcs = std::max(n_funcs, id + 1);
+            else if (kind == "EDGE")
+                n_edges = std::max(n_edges, id + 1);
+        }
+    }
+
+    const std::string& runtime = InstruVisitor::runtime;
+    // the output files of the source ("<prefix>.<pid>.<unit>.<ext>") are named after its map
+    llvm::StringRef mapName = llvm::sys::path::filename(mapFile);
+    mapName.consume_back(".map");
+    mapName.consume_back(".instru");
+    std::string unit = mapName.str();
+    for (char& c : unit)
+        if (!isalnum((unsigned char)c) && c != '_' && c != '-' && c != '.') c = '_';
+    std::string mode = runtime == "trace"              ? "INSTRU_RUNTIME_TRACE"
+                       : runtime == "compressed-trace" ? "INSTRU_RUNTIME_COMPRESSED_TRACE"
+                       : runtime == "counter"          ? "INSTRU_RUNTIME_COUNTER"
+                                                       : "INSTRU_RUNTIME_FIRST_HIT";
+    std::string prologue = "#define INSTRU_RUNTIME " + mode + "\n" + "#define INSTRU_SITE_SPACE " +
+                           (blockGranularity ? "INSTRU_SITES_BLOCKS" : "INSTRU_SITES_LINES") + "\n" +
+                           "#define INSTRU_N_SITES " + std::to_string(n_sites) + "\n" +
+                           "#define INSTRU_N_FUNCS " + std::to_string(n_funcs) + "\n" +
+                           "#define INSTRU_N_EDGES " + std::to_string(n_edges) + "\n" +
+                           "#define INSTRU_UNIT \"" + unit + "\"\n" +
+                           (InstruVisitor::afl ? "#define INSTRU_AFL 1\n" : "") +
+                           "#include \"" + runtimeDir + "/instru_runtime.h\"\n" + "#line 1\n";
+    return prologue + source + "\n#include \"" + runtimeDir + "/instru_runtime_impl.h\"\n";
+}
@@ -1,6 +1,7 @@
 #ifndef INSTRUMENTATION_H
 #define INSTRUMENTATION_H
 
+#include <map>
 #include <memory>
 #include <queue>
 #include <set>
@@ -13,6 +14,7 @@
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendAction.h"
 #include "clang/Rewrite/Core/Rewriter.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 
 class InstruVisitor : public clang::RecursiveASTVisitor<InstruVisitor> {
@@ -22,12 +24,19 @@ class InstruVisitor : public clang::RecursiveASTVisitor<InstruVisitor> {
     void writeChangesToFiles() { RwTool.WriteChangesToFiles(); }
     RewriterTool* getTheRwTool() { return &this->RwTool; }
 
-    void instruStmt(const clang::Stmt* stmt, std::string src_fname, bool is_return_stmt,
-                    bool wrap_with_braces);
+    // sidecar map ("<stem>.instru.map"): one "KIND;ID;PAYLOAD" record per line, describing probes
+    void addSidecarRecord(std::string kind, std::string id, std::string payload);
+    std::string getSidecarFilename();
+    void writeSidecarFile();
+    virtual void printSummary() {}
+
+    virtual void instruStmt(const clang::Stmt* stmt, std::string src_fname, bool is_return_stmt,
+                            bool wrap_with_braces);
     void wrapWithStrings(const clang::Stmt* stmt, std::string instru_str0, std::string instru_str1);
     bool isParentStmt(const clang::Stmt* stmt);
 
     std::string getFuncSignature(const clang::FunctionDecl* fd);
+    std::string internFuncSignature(const clang::FunctionDecl* fd);
     std::string generateInsertionString(std::string type, std::string func_signature,
                                         std::string stmt_line);
     std::string getLineNumber(const clang::SourceLocation loc);
@@ -36,10 +45,33 @@ class InstruVisitor : public clang::RecursiveASTVisitor<InstruVisitor> {
     void instruCompoundStmtAsStmtBody(const clang::CompoundStmt* cs, std::string src_fname,
                                       bool instru_break);
 
+    // probe runtime (printf, trace, compressed-trace, counter or first-hit) and AFL map, set from
+    // the options of the instrumenter or the arguments of the plugin
+    static std::string runtime;
+    static bool afl;
+
+    // selective instrumentation (--only-functions, --only-lines): a function is traversed if it is
+    // selected by name or contains a selected line, then only its selected lines get probes (all of
+    // them if selected by name). Nothing selected means everything.
+    static std::set<std::string> onlyFunctions;
+    // selected lines as disjoint ranges, first line -> last line (a range may span a whole file)
+    static std::map<int, int> onlyLines;
+    static void addOnlyLineRange(int begin, int end);
+    static bool addOnlyLines(llvm::StringRef range);
+    static bool addOnlyLinesFromFile(const std::string& fileName);
+    bool isSelectedFunction(const clang::FunctionDecl* fd);
+    bool isSelectedLine(const clang::SourceLocation loc);
+    bool TraverseFunctionDecl(clang::FunctionDecl* fd);
+
     std::vector<clang::Stmt*> getAllChildren(clang::Stmt* S);
     std::vector<clang::Stmt*> getAllPrimitiveChildrenStmts(clang::CompoundStmt* S);
 
     // must declare them in the base class to let RecursiveASTVisitor know
+    // (TraverseStmt without the queue argument also turns off data recursion, so that overrides
+    // can keep track of the statements enclosing the node being visited)
+    virtual bool TraverseStmt(clang::Stmt* S) {
+        return clang::RecursiveASTVisitor<InstruVisitor>::TraverseStmt(S);
+    }
     virtual bool VisitCallExpr(clang::CallExpr* ce) { return true; }
     virtual bool VisitFunctionDecl(clang::FunctionDecl* FD) { return true; }
     virtual bool VisitStmt(clang::Stmt* stmt) { return true; }
@@ -47,12 +79,27 @@ class InstruVisitor : public clang::RecursiveASTVisitor<InstruVisitor> {
    protected:
     clang::ASTContext* astContext;
     RewriterTool RwTool;
+    std::vector<std::string> sidecarRecords;
+
+    // signatures are interned across all passes of a run (dense ids in order of first use), each
+    // visitor records the ones it uses in its sidecar map
+    static std::map<std::string, unsigned> funcSignatureIds;
+    std::set<unsigned> recordedFuncSignatureIds;
+
+    bool wholeFunctionSelected = true;
 };
 
+// Include the probe runtime (instrumenter/runtime) at the top and the end of an instrumented source,
+// with counters sized by the ids found in the sidecar map
+std::string addRuntimeToSource(const std::string& source, const std::string& mapFile,
+                               const std::string& runtimeDir, bool blockGranularity);
+
 template <typename VISITOR_TYPE>
 class Instrumentation : public clang::ASTConsumer {
    public:
-    Instrumentation() : visitor(nullptr) {}
+    // the instrumented main file is written to disk, or to rewrittenSource if given
+    Instrumentation(std::string* rewrittenSource = nullptr)
+        : visitor(nullptr), rewrittenSource(rewrittenSource) {}
     ~Instrumentation() { delete visitor; }
 
    private:
@@ -64,11 +111,22 @@ class Instrumentation : public clang::ASTConsumer {
     void HandleTranslationUnit(clang::ASTContext& Ctx) {
         this->visitor->setASTContext(&Ctx);
         this->visitor->TraverseDecl(Ctx.getTranslationUnitDecl());
-        this->visitor->writeChangesToFiles();
+        if (rewrittenSource == nullptr) {
+            this->visitor->writeChangesToFiles();
+        } else {
+            clang::FileID mainFileID = Ctx.getSourceManager().getMainFileID();
+            if (const clang::RewriteBuffer* buffer = theRewriter.getRewriteBufferFor(mainFileID))
+                *rewrittenSource = std::string(buffer->begin(), buffer->end());
+            else
+                *rewrittenSource = Ctx.getSourceManager().getBufferData(mainFileID).str();
+        }
+        this->visitor->writeSidecarFile();
+        this->visitor->printSummary();
     }
 
     InstruVisitor* visitor;
     clang::Rewriter theRewriter;
+    std::string* rewrittenSource;
 };
 
 #endif  // INSTRUMENTATION_H
@@ -14,25 +14,54 @@
 #include "clang/Tooling/Tooling.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/raw_ostream.h"
 
 using namespace clang::tooling;
 
 void checkCommandLineArgs();
 void runTool(const std::vector<std::string> &inputFiles, const CompilationDatabase &compilations);
+void addRuntime(const std::string &instruFile, const std::string &mapFile);
 
 llvm::cl::OptionCategory instrumenterOptionsCategory("Instrumenter Options");
 std::vector<std::string> opt_input_files;
 llvm::cl::opt<bool> opt_no_compilation("no-compilation",
                                        llvm::cl::desc("Do not compile during instrumentation"),
                                        llvm::cl::cat(instrumenterOptionsCategory));
-// llvm::cl::opt<std::string> opt_granu("granularity", llvm::cl::init("statement"),
-//                                      llvm::cl::desc("Instrumentation Granularity"),
-//                                      llvm::cl::value_desc("GRANU"),
-//                                      llvm::cl::cat(instrumenterOptionsCategory));
-// llvm::cl::alias _opt_granu("g", llvm::cl::desc("Alias for -granularity"),
-//                            llvm::cl::aliasopt(opt_granu),
-//                            llvm::cl::cat(instrumenterOptionsCategory));
+llvm::cl::opt<std::string> opt_granu("granularity", llvm::cl::init("statement"),
+                                     llvm::cl::desc("Instrumentation Granularity (statement or block)"),
+                                     llvm::cl::value_desc("GRANU"),
+                                     llvm::cl::cat(instrumenterOptionsCategory));
+llvm::cl::alias _opt_granu("g", llvm::cl::desc("Alias for -granularity"),
+                           llvm::cl::aliasopt(opt_granu),
+                           llvm::cl::cat(instrumenterOptionsCategory));
+llvm::cl::list<std::string> opt_only_functions("only-functions", llvm::cl::CommaSeparated,
+                                               llvm::cl::desc("Only instrument these functions (comma separated)"),
+                                               llvm::cl::value_desc("FUNCTIONS"),
+                                               llvm::cl::cat(instrumenterOptionsCategory));
+llvm::cl::list<std::string> opt_only_lines("only-lines", llvm::cl::CommaSeparated,
+                                           llvm::cl::desc("Only instrument these lines (comma separated, such as 10-20,35)"),
+                                           llvm::cl::value_desc("LINES"),
+                                           llvm::cl::cat(instrumenterOptionsCategory));
+llvm::cl::opt<std::string> opt_only_lines_file("only-lines-file",
+                                               llvm::cl::desc("Only instrument the lines in the file (same format as debloated lines)"),
+                                               llvm::cl::value_desc("FILEPATH"),
+                                               llvm::cl::cat(instrumenterOptionsCategory));
+llvm::cl::opt<std::string> opt_runtime(
+    "runtime", llvm::cl::init("printf"),
+    llvm::cl::desc("Probe runtime (printf, trace, compressed-trace, counter or first-hit)"),
+    llvm::cl::value_desc("RUNTIME"), llvm::cl::cat(instrumenterOptionsCategory));
+llvm::cl::opt<double> opt_overhead_budget(
+    "overhead-budget", llvm::cl::init(0),
+    llvm::cl::desc("Drop block probes whose coverage can be inferred, until their estimated cost is "
+                   "this fraction of block instrumentation (such as 0.3, requires -granularity=block)"),
+    llvm::cl::value_desc("FRACTION"), llvm::cl::cat(instrumenterOptionsCategory));
+llvm::cl::opt<bool> opt_edges("edges",
+                              llvm::cl::desc("Also count the edges of branches and loops (requires a -runtime other than printf)"),
+                              llvm::cl::cat(instrumenterOptionsCategory));
+llvm::cl::opt<bool> opt_afl("afl",
+                            llvm::cl::desc("Probes also update an AFL shared-memory map, and the program runs AFL's forkserver (requires a -runtime other than printf)"),
+                            llvm::cl::cat(instrumenterOptionsCategory));
 
 int main(int argc, const char **argv) {
     llvm::cl::SetVersionPrinter([](llvm::raw_ostream &OS) { OS << "Instrumenter version 0.1\n"; });
@@ -50,13 +79,19 @@ int main(int argc, const char **argv) {
 
     // generate output files
     // FIXME: don't know if changing the filename will make "options.getCompilations()" useless
-    std::vector<std::string> outputFiles;
+    std::vector<std::string> outputFiles, mapFiles;
     for (auto &inputFile : options.getSourcePathList()) {
         std::string outputFile = FileManager::getStemName(inputFile) + ".instru.c";
         llvm::sys::fs::copy_file(inputFile, outputFile);
+        // visitors append to the sidecar map, so drop the one from a previous run
+        mapFiles.push_back(FileManager::getStemName(inputFile) + ".instru.map");
+        llvm::sys::fs::remove(mapFiles.back());
         outputFiles.push_back(outputFile);
     }
     runTool(outputFiles, options.getCompilations());
+    if (opt_runtime != "printf") {
+        for (size_t i = 0; i < outputFiles.size(); i++) addRuntime(outputFiles[i], mapFiles[i]);
+    }
 
     return 0;
 }
@@ -68,19 +103,88 @@ void checkCommandLineArgs() {
             exit(1);
         }
     }
+    if (opt_granu != "statement" && opt_granu != "block") {
+        llvm::errs() << "Unknown granularity '" << opt_granu << "' (use 'statement' or 'block').\n";
+        exit(1);
+    }
+    if (opt_overhead_budget < 0 || opt_overhead_budget > 1) {
+        llvm::errs() << "Invalid overhead budget " << opt_overhead_budget << " (use a fraction in 0-1).\n";
+        exit(1);
+    }
+    if (opt_overhead_budget > 0 && opt_granu != "block") {
+        llvm::errs() << "The overhead budget requires the block granularity (-granularity=block).\n";
+        exit(1);
+    }
+    BasicBlockVisitor::overheadBudget = opt_overhead_budget;
+    InstruVisitor::runtime = opt_runtime;
+    InstruVisitor::afl = opt_afl;
+    InstruVisitor::onlyFunctions.insert(opt_only_functions.begin(), opt_only_functions.end());
+    for (auto &range : opt_only_lines) {
+        if (!InstruVisitor::addOnlyLines(range)) {
+            llvm::errs() << "Invalid line range '" << range << "' (use such as 10-20 or 35).\n";
+            exit(1);
+        }
+    }
+    if (!opt_only_lines_file.empty() && !InstruVisitor::addOnlyLinesFromFile(opt_only_lines_file)) {
+        llvm::errs() << "Failed to read lines file '" << opt_only_lines_file << "'.\n";
+        exit(1);
+    }
+    if (opt_runtime != "printf" && opt_runtime != "trace" && opt_runtime != "compressed-trace" &&
+        opt_runtime != "counter" && opt_runtime != "first-hit") {
+        llvm::errs() << "Unknown runtime '" << opt_runtime
+                     << "' (use 'printf', 'trace', 'compressed-trace', 'counter' or 'first-hit').\n";
+        exit(1);
+    }
+    if (opt_edges && opt_runtime == "printf") {
+        llvm::errs() << "Edge coverage requires a probe runtime (-runtime=trace, compressed-trace, counter or first-hit).\n";
+        exit(1);
+    }
+    if (opt_afl && opt_runtime == "printf") {
+        llvm::errs() << "The AFL map requires a probe runtime (-runtime=trace, compressed-trace, counter or first-hit).\n";
+        exit(1);
+    }
 }
 
 void runTool(const std::vector<std::string> &sourceFiles, const CompilationDatabase &compilations) {
     if (!opt_no_compilation) {
-        Frontend::run(sourceFiles, compilations, newFrontendActionFactory<StmtInstruAction>().get());
+        if (opt_granu == "block")
+            Frontend::run(sourceFiles, compilations, newFrontendActionFactory<BlockInstruAction>().get());
+        else
+            Frontend::run(sourceFiles, compilations, newFrontendActionFactory<StmtInstruAction>().get());
         Frontend::run(sourceFiles, compilations, newFrontendActionFactory<FuncDeclInstruAction>().get());
         Frontend::run(sourceFiles, compilations, newFrontendActionFactory<CallExprInstruAction>().get());
+        if (opt_edges)
+            Frontend::run(sourceFiles, compilations, newFrontendActionFactory<EdgeInstruAction>().get());
     } else {
         for (auto f : sourceFiles) {
             llvm::outs() << "Instrument source file '" << f << "'.\n";
-            Frontend::runWithoutCompilation(f, new Instrumentation<StmtVisitor>());
+            if (opt_granu == "block")
+                Frontend::runWithoutCompilation(f, new Instrumentation<BasicBlockVisitor>());
+            else
+                Frontend::runWithoutCompilation(f, new Instrumentation<StmtVisitor>());
             Frontend::runWithoutCompilation(f, new Instrumentation<FunctionDeclVisitor>());
             Frontend::runWithoutCompilation(f, new Instrumentation<FunctionCallVisitor>());
+            if (opt_edges) Frontend::runWithoutCompilation(f, new Instrumentation<EdgeVisitor>());
         }
     }
 }
+
+// the probe runtime is copied next to the executable
+void addRuntime(const std::string &instruFile, const std::string &mapFile) {
+    auto instruBuffer = llvm::MemoryBuffer::getFile(instruFile);
+    if (!instruBuffer) {
+        llvm::errs() << "Failed to read instrumented file '" << instruFile << "'.\n";
+        exit(1);
+    }
+    std::string runtimeDir = FileManager::getParentDir(llvm::sys::fs::getMainExecutable(nullptr, nullptr));
+    std::string content = addRuntimeToSource((*instruBuffer)->getBuffer().str(), mapFile, runtimeDir,
+                                             opt_granu == "block");
+
+    std::error_code ec;
+    llvm::raw_fd_ostream os(instruFile, ec, llvm::sys::fs::OF_Text);
+    if (ec) {
+        llvm::errs() << "Failed to write instrumented file '" << instruFile << "': " << ec.message() << "\n";
+        exit(1);
+    }
+    os << content;
+}
@@ -0,0 +1,157 @@
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+
+// Instrumentation backend on (optimized) LLVM IR:
+//   clang -O2 -g -fpass-plugin=build/bin/libInstruPass.so prog.c build/bin/libinstru_rt.a -lpthread
+// Every basic block with a line of the source file gets a counter (BLOCK_EXEC records map it to
+// the lines of its instructions, read from DILocation), and every call to an external function
+// counts a FUNC_CALL of the callee (FUNC_SIG records give its name). Counters are dumped by the
+// runtime (instru_runtime_ir.c) in the format of the counter runtime, and the sidecar map is
+// written to "<dir>/<stem>.instru.map" next to the source file. Requires debug info (-g).
+
+class InstruPass : public llvm::PassInfoMixin<InstruPass> {
+   public:
+    llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &);
+
+   private:
+    std::set<unsigned> getSourceLines(llvm::BasicBlock &BB, llvm::StringRef sourceName);
+    void insertIncrement(llvm::Instruction *before, llvm::GlobalVariable *counters, unsigned id);
+    void writeSidecarFile(llvm::Module &M, const std::vector<std::string> &records);
+};
+
+// lines of the source file (not of included headers) of the instructions in a block
+std::set<unsigned> InstruPass::getSourceLines(llvm::BasicBlock &BB, llvm::StringRef sourceName) {
+    std::set<unsigned> lines;
+    for (auto &I : BB) {
+        if (llvm::isa<llvm::DbgInfoIntrinsic>(I)) continue;
+        const llvm::DILocation *loc = I.getDebugLoc().get();
+        if (loc == nullptr || loc->getLine() == 0) continue;
+        if (llvm::sys::path::filename(loc->getFilename()) != sourceName) continue;
+        lines.insert(loc->getLine());
+    }
+    return lines;
+}
+
+// relaxed atomic increment, as the counter runtime
+void InstruPass::insertIncrement(llvm::Instruction *before, llvm::GlobalVariable *counters,
+                                 unsigned id) {
+    llvm::IRBuilder<> builder(before);
+    llvm::Value *counter = builder.CreateConstInBoundsGEP2_64(counters->getValueType(), counters, 0, id);
+    builder.CreateAtomicRMW(llvm::AtomicRMWInst::Add, counter, builder.getInt64(1), llvm::MaybeAlign(8),
+                            llvm::AtomicOrdering::Monotonic);
+}
+
+llvm::PreservedAnalyses InstruPass::run(llvm::Module &M, llvm::ModuleAnalysisManager &) {
+    llvm::StringRef sourceName = llvm::sys::path::filename(M.getSourceFileName());
+    std::vector<std::string> records;
+
+    // collect sites first, counters are sized by their number
+    std::vector<llvm::Instruction *> blockSites;
+    std::vector<std::pair<llvm::Instruction *, unsigned>> callSites;
+    std::map<std::string, unsigned> calleeIds;
+    for (auto &F : M) {
+        if (F.isDeclaration()) continue;
+        for (auto &BB : F) {
+            auto insertPt = BB.getFirstInsertionPt();
+            std::set<unsigned> lines = getSourceLines(BB, sourceName);
+            if (insertPt != BB.end() && !lines.empty()) {
+                std::string lines_str;
+                for (unsigned line : lines) lines_str += (lines_str.empty() ? "" : " ") + std::to_string(line);
+                records.push_back("BLOCK_EXEC;" + std::to_string(blockSites.size()) + ";" + lines_str);
+                blockSites.push_back(&*insertPt);
+            }
+            for (auto &I : BB) {
+                auto *call = llvm::dyn_cast<llvm::CallBase>(&I);
+                if (call == nullptr || llvm::isa<llvm::IntrinsicInst>(call)) continue;
+                llvm::Function *callee = call->getCalledFunction();
+                if (callee == nullptr || !callee->isDeclaration() || callee->isIntrinsic()) continue;
+                std::string name = callee->getName().str();
+                auto it = calleeIds.find(name);
+                if (it == calleeIds.end()) {
+                    it = calleeIds.insert(std::make_pair(name, calleeIds.size())).first;
+                    records.push_back("FUNC_SIG;" + std::to_string(it->second) + ";" + name + "()");
+                }
+                callSites.push_back(std::make_pair(call, it->second));
+            }
+        }
+    }
+    // the map is written even without sites, so that no stale map of an earlier build is left
+    if (blockSites.empty() && callSites.empty()) {
+        writeSidecarFile(M, records);
+        return llvm::PreservedAnalyses::all();
+    }
+
+    llvm::LLVMContext &C = M.getContext();
+    llvm::Type *int64Ty = llvm::Type::getInt64Ty(C);
+    auto createCounters = [&](const char *name, size_t n) {
+        auto *ty = llvm::ArrayType::get(int64Ty, std::max<size_t>(n, 1));
+        auto *counters = new llvm::GlobalVariable(M, ty, false, llvm::GlobalValue::InternalLinkage,
+                                                  llvm::Constant::getNullValue(ty), name);
+        counters->setAlignment(llvm::Align(8));
+        return counters;
+    };
+    llvm::GlobalVariable *siteHits = createCounters("__instru_site_hits", blockSites.size());
+    llvm::GlobalVariable *funcHits = createCounters("__instru_func_hits", calleeIds.size());
+    for (unsigned id = 0; id < blockSites.size(); id++) insertIncrement(blockSites[id], siteHits, id);
+    for (auto &callSite : callSites) insertIncrement(callSite.first, funcHits, callSite.second);
+
+    // register the counters with the runtime before main()
+    llvm::Type *ptrTy = llvm::PointerType::getUnqual(int64Ty);
+    llvm::Type *int32Ty = llvm::Type::getInt32Ty(C);
+    llvm::FunctionCallee registerFunc = M.getOrInsertFunction(
+        "__instru_ir_register", llvm::Type::getVoidTy(C), ptrTy, int32Ty, ptrTy, int32Ty);
+    llvm::Function *ctor = llvm::Function::Create(llvm::FunctionType::get(llvm::Type::getVoidTy(C), false),
+                                                  llvm::GlobalValue::InternalLinkage, "__instru_ir_init", M);
+    llvm::IRBuilder<> builder(llvm::BasicBlock::Create(C, "", ctor));
+    builder.CreateCall(registerFunc,
+                       {builder.CreatePointerCast(siteHits, ptrTy), builder.getInt32(blockSites.size()),
+                        builder.CreatePointerCast(funcHits, ptrTy),
+                        builder.getInt32(std::max<size_t>(calleeIds.size(), 1))});
+    builder.CreateRetVoid();
+    llvm::appendToGlobalCtors(M, ctor, 0);
+
+    writeSidecarFile(M, records);
+    return llvm::PreservedAnalyses::none();
+}
+
+// "path/prog.c" -> "path/prog.instru.map", same records as the source instrumenter
+void InstruPass::writeSidecarFile(llvm::Module &M, const std::vector<std::string> &records) {
+    llvm::SmallString<256> path(M.getSourceFileName());
+    llvm::sys::path::replace_extension(path, "instru.map");
+    std::error_code ec;
+    llvm::raw_fd_ostream os(path, ec, llvm::sys::fs::OF_Text);
+    if (ec) {
+        llvm::errs() << "Failed to write sidecar map '" << path << "': " << ec.message() << "\n";
+        return;
+    }
+    for (auto const &record : records) os << record << "\n";
+}
+
+// runs last in the optimization pipeline (also at -O0), or with "opt -passes=instru"
+extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo llvmGetPassPluginInfo() {
+    return {LLVM_PLUGIN_API_VERSION, "InstruPass", "0.1", [](llvm::PassBuilder &PB) {
+                PB.registerOptimizerLastEPCallback(
+                    [](llvm::ModulePassManager &MPM, llvm::OptimizationLevel) { MPM.addPass(InstruPass()); });
+                PB.registerPipelineParsingCallback([](llvm::StringRef name, llvm::ModulePassManager &MPM,
+                                                      llvm::ArrayRef<llvm::PassBuilder::PipelineElement>) {
+                    if (name != "instru") return false;
+                    MPM.addPass(InstruPass());
+                    return true;
+                });
+            }};
+}
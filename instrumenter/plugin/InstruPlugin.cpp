@@ -0,0 +1,182 @@
+#include <dlfcn.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "FileManager.h"
+#include "InstruVisitors.h"
+#include "Instrumentation.h"
+#include "clang/Basic/Diagnostic.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/DependencyOutputOptions.h"
+#include "clang/Frontend/FrontendAction.h"
+#include "clang/Frontend/FrontendPluginRegistry.h"
+#include "clang/Lex/PreprocessorOptions.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+// Compile-time instrumentation: the instrumenter passes run in memory on the main file, whose
+// buffer is then replaced before the real compile parses it.
+//   clang -fplugin=build/bin/libInstruPlugin.so [-fplugin-arg-instru-granularity=block]
+//         [-fplugin-arg-instru-runtime=trace] [-fplugin-arg-instru-only-functions=f,g] prog.c
+// The sidecar map is written to "<dir>/<stem>.instru.map", next to the source file.
+
+template <typename VISITOR_TYPE>
+class InMemoryInstruAction : public clang::ASTFrontendAction {
+   public:
+    InMemoryInstruAction(std::string* rewrittenSource) : rewrittenSource(rewrittenSource) {}
+    std::unique_ptr<clang::ASTConsumer> CreateASTConsumer(clang::CompilerInstance& CI,
+                                                          clang::StringRef InFile) final {
+        return std::unique_ptr<clang::ASTConsumer>(new Instrumentation<VISITOR_TYPE>(rewrittenSource));
+    }
+
+   private:
+    std::string* rewrittenSource;
+};
+
+class InstruPluginAction : public clang::PluginASTAction {
+   protected:
+    bool ParseArgs(const clang::CompilerInstance& CI, const std::vector<std::string>& args) override;
+    ActionType getActionType() override { return AddBeforeMainAction; }
+    std::unique_ptr<clang::ASTConsumer> CreateASTConsumer(clang::CompilerInstance& CI,
+                                                          clang::StringRef InFile) override;
+
+   private:
+    bool blockGranularity = false;
+    bool edges = false;
+
+    template <typename VISITOR_TYPE>
+    bool runPass(clang::CompilerInstance& CI, const std::string& instruFile, std::string& source);
+};
+
+bool InstruPluginAction::ParseArgs(const clang::CompilerInstance& CI,
+                                   const std::vector<std::string>& args) {
+    for (auto& arg : args) {
+        if (arg == "granularity=statement" || arg == "granularity=block") {
+            blockGranularity = arg == "granularity=block";
+        } else if (arg == "runtime=printf" || arg == "runtime=trace" || arg == "runtime=compressed-trace" ||
+                   arg == "runtime=counter" || arg == "runtime=first-hit") {
+            InstruVisitor::runtime = arg.substr(arg.find('=') + 1);
+        } else if (llvm::StringRef(arg).startswith("only-functions=")) {
+            llvm::SmallVector<llvm::StringRef, 8> names;
+            llvm::StringRef(arg).split('=').second.split(names, ',', -1, false);
+            for (auto name : names) InstruVisitor::onlyFunctions.insert(name.str());
+        } else if (llvm::StringRef(arg).startswith("only-lines=")) {
+            llvm::SmallVector<llvm::StringRef, 8> ranges;
+            llvm::StringRef(arg).split('=').second.split(ranges, ',', -1, false);
+            for (auto range : ranges) {
+                if (!InstruVisitor::addOnlyLines(range)) {
+                    llvm::errs() << "Invalid line range '" << range << "' (use such as 10-20 or 35).\n";
+                    return false;
+                }
+            }
+        } else if (llvm::StringRef(arg).startswith("only-lines-file=")) {
+            if (!InstruVisitor::addOnlyLinesFromFile(llvm::StringRef(arg).split('=').second.str())) {
+                llvm::errs() << "Failed to read lines file in '" << arg << "'.\n";
+                return false;
+            }
+        } else if (arg == "edges") {
+            edges = true;
+        } else if (arg == "afl") {
+            InstruVisitor::afl = true;
+        } else if (llvm::StringRef(arg).startswith("overhead-budget=")) {
+            double budget;
+            if (llvm::StringRef(arg).split('=').second.getAsDouble(budget) || budget < 0 || budget > 1) {
+                llvm::errs() << "Invalid overhead budget in '" << arg << "' (use a fraction in 0-1).\n";
+                return false;
+            }
+            // inference works on the blocks
+            BasicBlockVisitor::overheadBudget = budget;
+            blockGranularity = blockGranularity || budget > 0;
+        } else {
+            llvm::errs() << "Unknown instrumenter plugin argument '" << arg
+                         << "' (use granularity=, runtime=, only-functions=, only-lines=, only-lines-file=, "
+                            "overhead-budget=, edges or afl).\n";
+            return false;
+        }
+    }
+    if (edges && InstruVisitor::runtime == "printf") {
+        llvm::errs() << "Edge coverage requires a probe runtime (runtime=trace, compressed-trace, counter or first-hit).\n";
+        return false;
+    }
+    if (InstruVisitor::afl && InstruVisitor::runtime == "printf") {
+        llvm::errs() << "The AFL map requires a probe runtime (runtime=trace, compressed-trace, counter or first-hit).\n";
+        return false;
+    }
+    return true;
+}
+
+// The passes parse the source as "<dir>/<stem>.instru.c" (a remapped virtual file), so that the
+// sidecar map is named as with the instrumenter
+std::unique_ptr<clang::ASTConsumer> InstruPluginAction::CreateASTConsumer(clang::CompilerInstance& CI,
+                                                                          clang::StringRef InFile) {
+    clang::SourceManager& SM = CI.getSourceManager();
+    const clang::FileEntry* mainFile = SM.getFileEntryForID(SM.getMainFileID());
+    if (mainFile == nullptr) return std::make_unique<clang::ASTConsumer>();
+
+    llvm::SmallString<256> instruFile(mainFile->getName());
+    llvm::sys::path::replace_extension(instruFile, "instru.c");
+    llvm::SmallString<256> mapFile(instruFile);
+    llvm::sys::path::replace_extension(mapFile, "map");
+    llvm::sys::fs::remove(mapFile);
+
+    std::string source = SM.getBufferData(SM.getMainFileID()).str();
+    bool ok = blockGranularity ? runPass<BasicBlockVisitor>(CI, instruFile.str().str(), source)
+                               : runPass<StmtVisitor>(CI, instruFile.str().str(), source);
+    ok = ok && runPass<FunctionDeclVisitor>(CI, instruFile.str().str(), source) &&
+         runPass<FunctionCallVisitor>(CI, instruFile.str().str(), source) &&
+         (!edges || runPass<EdgeVisitor>(CI, instruFile.str().str(), source));
+    if (!ok) {
+        llvm::errs() << "Failed to instrument '" << InFile << "', compiling it unchanged.\n";
+        return std::make_unique<clang::ASTConsumer>();
+    }
+
+    if (InstruVisitor::runtime != "printf") {
+        // the runtime headers are copied next to the plugin
+        Dl_info info;
+        dladdr(reinterpret_cast<void*>(&addRuntimeToSource), &info);
+        source = addRuntimeToSource(source, mapFile.str().str(),
+                                    FileManager::getParentDir(info.dli_fname), blockGranularity);
+    }
+
+    // The main FileID was created for the original file, and its range of source locations has the
+    // size of the original. Plugins added before the main action are created after that, so the
+    // instrumented buffer gets a FileID of its own, sized for it, which becomes the main file.
+    // Nothing has been lexed or allocated after the main FileID yet (the predefines come with
+    // EnterMainSourceFile), so every later location follows the instrumented buffer.
+    llvm::Optional<clang::FileEntryRef> mainFileRef = SM.getFileEntryRefForID(SM.getMainFileID());
+    if (!mainFileRef) return std::make_unique<clang::ASTConsumer>();
+    SM.overrideFileContents(mainFile, llvm::MemoryBuffer::getMemBufferCopy(source, mainFile->getName()));
+    SM.setMainFileID(SM.createFileID(*mainFileRef, clang::SourceLocation(), clang::SrcMgr::C_User));
+    return std::make_unique<clang::ASTConsumer>();
+}
+
+template <typename VISITOR_TYPE>
+bool InstruPluginAction::runPass(clang::CompilerInstance& CI, const std::string& instruFile,
+                                 std::string& source) {
+    auto invocation = std::make_shared<clang::CompilerInvocation>(CI.getInvocation());
+    clang::FrontendOptions& frontendOpts = invocation->getFrontendOpts();
+    frontendOpts.Inputs = {clang::FrontendInputFile(instruFile, clang::InputKind(clang::Language::C))};
+    frontendOpts.Plugins.clear();
+    frontendOpts.AddPluginActions.clear();
+    invocation->getDependencyOutputOpts() = clang::DependencyOutputOptions();
+    invocation->getPreprocessorOpts().addRemappedFile(
+        instruFile, llvm::MemoryBuffer::getMemBufferCopy(source, instruFile).release());
+
+    // diagnostics are reported once, by the real compile
+    clang::CompilerInstance instance(CI.getPCHContainerOperations());
+    instance.setInvocation(invocation);
+    instance.createDiagnostics(new clang::IgnoringDiagConsumer(), true);
+
+    std::string rewrittenSource;
+    InMemoryInstruAction<VISITOR_TYPE> action(&rewrittenSource);
+    if (!instance.ExecuteAction(action)) return false;
+    source = rewrittenSource;
+    return true;
+}
+
+static clang::FrontendPluginRegistry::Add<InstruPluginAction> X("instru",
+                                                                "instrument the main file before compiling it");
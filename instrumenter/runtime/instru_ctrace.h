@@ -0,0 +1,122 @@
+#ifndef INSTRU_CTRACE_H
+#define INSTRU_CTRACE_H
+
+/* Compressed traces ("<prefix>.<pid>.ctrace", compressed-trace mode), little endian:
+ *   struct instru_ctrace_header
+ *   chunks: INSTRU_CTRACE_CHUNK, varint tid, varint length, then length bytes of tokens
+ * Tokens are LEB128 varints, a chunk is decoded on its own (the state below starts empty):
+ *   (zigzag(id - previous id of the type) << 3) | type   one event of type INSTRU_EVENT_*
+ *   (L << 3) | INSTRU_CTRACE_REPEAT, varint n           the last L events happen n more times
+ * Repeats are found while streaming: an event equal to the one L events back (smallest L, up to
+ * INSTRU_CTRACE_MAX_PERIOD) starts a candidate period, which is extended while the next events
+ * match, so a loop whose body always runs the same events is written once with a count.
+ * The encoder is shared by the runtime and the C++ reader (for the format constants). */
+
+#include <stdint.h>
+#include <string.h>
+
+#define INSTRU_CTRACE_MAGIC 0x54434e49u /* "INCT" */
+#define INSTRU_CTRACE_VERSION 1
+
+#define INSTRU_CTRACE_CHUNK 'T'
+#define INSTRU_CTRACE_REPEAT 7
+#define INSTRU_CTRACE_MAX_PERIOD 64
+#define INSTRU_CTRACE_HISTORY 128 /* a period and a partial repetition */
+/* bytes an event can add to a chunk: a repeat token and a partial repetition of literals */
+#define INSTRU_CTRACE_MAX_EVENT_BYTES (2 * 10 + INSTRU_CTRACE_MAX_PERIOD * 10)
+
+struct instru_ctrace_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t pid;
+    uint64_t ppid;
+};
+
+struct __instru_ctrace_encoder {
+    uint64_t history[INSTRU_CTRACE_HISTORY]; /* last events, (id << 3) | type */
+    uint64_t n_history;                      /* events of the chunk */
+    uint32_t last_ids[8];                    /* by type, as seen by the decoder */
+    uint32_t period;                         /* candidate period, 0 for none */
+    uint32_t matched;                        /* events of the current repetition */
+    uint64_t repeats;                        /* complete repetitions */
+};
+
+static inline void __instru_ctrace_reset(struct __instru_ctrace_encoder* enc) { memset(enc, 0, sizeof(*enc)); }
+
+static inline unsigned char* __instru_ctrace_varint(unsigned char* p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (unsigned char)v;
+    return p;
+}
+
+/* back >= 1: the event "back" events ago */
+static inline uint64_t __instru_ctrace_at(const struct __instru_ctrace_encoder* enc, uint64_t back) {
+    return enc->history[(enc->n_history - back) % INSTRU_CTRACE_HISTORY];
+}
+
+static inline void __instru_ctrace_push(struct __instru_ctrace_encoder* enc, uint64_t key) {
+    enc->history[enc->n_history++ % INSTRU_CTRACE_HISTORY] = key;
+}
+
+static inline unsigned char* __instru_ctrace_literal(struct __instru_ctrace_encoder* enc, unsigned char* p,
+                                                     uint64_t key) {
+    unsigned type = key & 7;
+    int64_t delta = (int64_t)(key >> 3) - (int64_t)enc->last_ids[type];
+    enc->last_ids[type] = (uint32_t)(key >> 3);
+    return __instru_ctrace_varint(p, ((((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63)) << 3) | type);
+}
+
+/* writes the pending repetitions, then the events matched since the last one */
+static inline unsigned char* __instru_ctrace_finish(struct __instru_ctrace_encoder* enc, unsigned char* p) {
+    uint64_t i;
+    if (enc->period == 0) return p;
+    if (enc->repeats > 0) {
+        p = __instru_ctrace_varint(p, ((uint64_t)enc->period << 3) | INSTRU_CTRACE_REPEAT);
+        p = __instru_ctrace_varint(p, enc->repeats);
+        /* the decoder replays the period, so the previous ids become those of its events */
+        for (i = enc->period + enc->matched; i > enc->matched; i--) {
+            uint64_t key = __instru_ctrace_at(enc, i);
+            enc->last_ids[key & 7] = (uint32_t)(key >> 3);
+        }
+    }
+    for (i = enc->matched; i > 0; i--) p = __instru_ctrace_literal(enc, p, __instru_ctrace_at(enc, i));
+    enc->period = enc->matched = 0;
+    enc->repeats = 0;
+    return p;
+}
+
+/* writes at most INSTRU_CTRACE_MAX_EVENT_BYTES to p, returns the new end */
+static inline unsigned char* __instru_ctrace_add(struct __instru_ctrace_encoder* enc, unsigned char* p,
+                                                 unsigned type, unsigned id) {
+    uint64_t key = ((uint64_t)id << 3) | type;
+    uint32_t period;
+    if (enc->period != 0) {
+        if (key != __instru_ctrace_at(enc, enc->period)) {
+            p = __instru_ctrace_finish(enc, p);
+        } else {
+            __instru_ctrace_push(enc, key);
+            if (++enc->matched == enc->period) {
+                enc->repeats++;
+                enc->matched = 0;
+            }
+            return p;
+        }
+    }
+    for (period = 1; period <= INSTRU_CTRACE_MAX_PERIOD && period <= enc->n_history; period++) {
+        if (__instru_ctrace_at(enc, period) != key) continue;
+        enc->period = period;
+        __instru_ctrace_push(enc, key);
+        if (++enc->matched == enc->period) {
+            enc->repeats++;
+            enc->matched = 0;
+        }
+        return p;
+    }
+    __instru_ctrace_push(enc, key);
+    return __instru_ctrace_literal(enc, p, key);
+}
+
+#endif /* INSTRU_CTRACE_H */
@@ -0,0 +1,34 @@
+#ifndef INSTRU_FORMAT_H
+#define INSTRU_FORMAT_H
+
+/* Coverage dumps of the instrumentation runtime ("<prefix>.<pid>.cov", counter and first-hit modes):
+ *   struct instru_cov_header
+ *   n_sites site entries (indexed by line number or block id, see site_space)
+ *   n_funcs FUNC_CALL entries (indexed by function signature id, see FUNC_SIG records of the map)
+ *   n_edges EDGE_EXEC entries (indexed by edge id, see EDGE records of the map; 0 without edges)
+ * An entry is a uint64_t hit count (INSTRU_COV_COUNTER) or a uint8_t hit flag (INSTRU_COV_FIRST_HIT).
+ * Shared by the C runtime and the C++ tools reading the dumps. */
+
+#include <stdint.h>
+
+#define INSTRU_COV_MAGIC 0x56434e49u /* "INCV" */
+#define INSTRU_COV_VERSION 1
+
+#define INSTRU_COV_COUNTER 1
+#define INSTRU_COV_FIRST_HIT 2
+
+#define INSTRU_SITES_LINES 1  /* statement granularity: site id is the line number */
+#define INSTRU_SITES_BLOCKS 2 /* block granularity: site id is the block id (BLOCK_EXEC records) */
+
+struct instru_cov_header {
+    uint32_t magic;
+    uint16_t version;
+    uint8_t kind;
+    uint8_t site_space;
+    uint32_t n_sites;
+    uint32_t n_funcs;
+    uint32_t pid;
+    uint32_t n_edges; /* was reserved (always 0) before edge coverage */
+};
+
+#endif /* INSTRU_FORMAT_H */
@@ -0,0 +1,40 @@
+#ifndef INSTRU_OUTPUT_H
+#define INSTRU_OUTPUT_H
+
+/* Output files of the instrumentation runtimes: "<prefix>.<pid>.<ext>", the prefix is read from
+ * $INSTRU_OUTPUT (default "instru"). Each instrumented source file has its own runtime state and
+ * site ids (its own sidecar map), so the runtime included in it defines INSTRU_UNIT (the stem of
+ * the map) and writes "<prefix>.<pid>.<unit>.<ext>": the files of a program built from several
+ * sources do not truncate each other. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static int __instru_open_output(const char* ext) {
+    char path[4096];
+    const char* prefix = getenv("INSTRU_OUTPUT");
+#ifdef INSTRU_UNIT
+    snprintf(path, sizeof(path), "%s.%ld.%s.%s", prefix && *prefix ? prefix : "instru", (long)getpid(),
+             INSTRU_UNIT, ext);
+#else
+    snprintf(path, sizeof(path), "%s.%ld.%s", prefix && *prefix ? prefix : "instru", (long)getpid(),
+             ext);
+#endif
+    return open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+}
+
+static void __instru_write_all(int fd, const void* data, size_t len) {
+    const char* p = (const char*)data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        p += n;
+        len -= n;
+    }
+}
+
+#endif /* INSTRU_OUTPUT_H */
@@ -0,0 +1,118 @@
+#ifndef INSTRU_RUNTIME_H
+#define INSTRU_RUNTIME_H
+
+/* Probes of the instrumentation runtime, included at the top of "<stem>.instru.c".
+ * No system header is included here so that feature macros (_GNU_SOURCE...) of the program still
+ * work, the implementation (instru_runtime_impl.h) is included at the end of the file.
+ *
+ * Defined by the instrumenter before including this file:
+ *   INSTRU_RUNTIME     INSTRU_RUNTIME_TRACE, INSTRU_RUNTIME_COMPRESSED_TRACE, INSTRU_RUNTIME_COUNTER
+ *                      or INSTRU_RUNTIME_FIRST_HIT
+ *   INSTRU_SITE_SPACE  INSTRU_SITES_LINES or INSTRU_SITES_BLOCKS (see instru_format.h)
+ *   INSTRU_N_SITES     number of site ids (max line number or block id + 1)
+ *   INSTRU_N_FUNCS     number of function signature ids
+ *   INSTRU_N_EDGES     number of edge ids (0 without edge coverage)
+ *   INSTRU_AFL         (optional) probes also update an AFL map, see instru_runtime_impl.h */
+
+#define INSTRU_RUNTIME_TRACE 1
+#define INSTRU_RUNTIME_COUNTER 2
+#define INSTRU_RUNTIME_FIRST_HIT 3
+#define INSTRU_RUNTIME_COMPRESSED_TRACE 4
+
+#define INSTRU_EVENT_STMT_EXEC 0
+#define INSTRU_EVENT_BLOCK_EXEC 1
+#define INSTRU_EVENT_FUNC_CALL 2
+#define INSTRU_EVENT_FUNC_RETURN 3
+#define INSTRU_EVENT_EDGE_EXEC 4
+
+#define INSTRU_PROBE(type, id) __instru_probe(INSTRU_EVENT_##type, (id))
+/* branch conditions: counts edge "id" when false and "id + 1" when true, the value is kept */
+#define INSTRU_EDGE(id, cond) __instru_edge((id), (cond) ? 1 : 0)
+
+#ifndef INSTRU_N_EDGES
+#define INSTRU_N_EDGES 0
+#endif
+
+#ifdef INSTRU_AFL
+
+/* AFL edge hashing over the sequence of STMT/BLOCK/EDGE probes (calls have no location): the map
+ * counts transitions between probes, it is a local map until the fuzzer's shared memory is attached */
+#define INSTRU_AFL_MAP_SIZE (1 << 16)
+static unsigned char __instru_afl_local_area[INSTRU_AFL_MAP_SIZE];
+static unsigned char* __instru_afl_area = __instru_afl_local_area;
+static __thread unsigned __instru_afl_prev;
+static inline void __instru_afl_hit(unsigned type, unsigned id) {
+    unsigned cur;
+    if (type == INSTRU_EVENT_FUNC_CALL || type == INSTRU_EVENT_FUNC_RETURN) return;
+    cur = ((id * 8 + type) * 2654435761u) >> 16;
+    __instru_afl_area[cur ^ __instru_afl_prev]++;
+    __instru_afl_prev = cur >> 1;
+}
+
+#else
+static inline void __instru_afl_hit(unsigned type, unsigned id) {
+    (void)type;
+    (void)id;
+}
+#endif
+
+#if INSTRU_RUNTIME == INSTRU_RUNTIME_TRACE || INSTRU_RUNTIME == INSTRU_RUNTIME_COMPRESSED_TRACE
+
+/* events are appended to a per-thread buffer */
+static void __instru_trace_event(unsigned type, unsigned id);
+static inline void __instru_probe(unsigned type, unsigned id) {
+    __instru_afl_hit(type, id);
+    __instru_trace_event(type, id);
+}
+static inline int __instru_edge(unsigned id, int taken) {
+    __instru_afl_hit(INSTRU_EVENT_EDGE_EXEC, id + taken);
+    __instru_trace_event(INSTRU_EVENT_EDGE_EXEC, id + taken);
+    return taken;
+}
+
+#elif INSTRU_RUNTIME == INSTRU_RUNTIME_COUNTER
+
+/* relaxed atomics: exact counts without ordering between threads */
+static unsigned long long __instru_site_hits[INSTRU_N_SITES];
+static unsigned long long __instru_func_hits[INSTRU_N_FUNCS];
+static unsigned long long __instru_edge_hits[INSTRU_N_EDGES > 0 ? INSTRU_N_EDGES : 1];
+static inline void __instru_probe(unsigned type, unsigned id) {
+    __instru_afl_hit(type, id);
+    if (type == INSTRU_EVENT_FUNC_CALL)
+        __atomic_fetch_add(&__instru_func_hits[id], 1, __ATOMIC_RELAXED);
+    else if (type == INSTRU_EVENT_EDGE_EXEC)
+        __atomic_fetch_add(&__instru_edge_hits[id], 1, __ATOMIC_RELAXED);
+    else if (type != INSTRU_EVENT_FUNC_RETURN)
+        __atomic_fetch_add(&__instru_site_hits[id], 1, __ATOMIC_RELAXED);
+}
+static inline int __instru_edge(unsigned id, int taken) {
+    __instru_afl_hit(INSTRU_EVENT_EDGE_EXEC, id + taken);
+    __atomic_fetch_add(&__instru_edge_hits[id + taken], 1, __ATOMIC_RELAXED);
+    return taken;
+}
+
+#elif INSTRU_RUNTIME == INSTRU_RUNTIME_FIRST_HIT
+
+/* check before storing, so that hot probes only read a shared cache line */
+static unsigned char __instru_site_hits[INSTRU_N_SITES];
+static unsigned char __instru_func_hits[INSTRU_N_FUNCS];
+static unsigned char __instru_edge_hits[INSTRU_N_EDGES > 0 ? INSTRU_N_EDGES : 1];
+static inline void __instru_probe(unsigned type, unsigned id) {
+    unsigned char* hit;
+    __instru_afl_hit(type, id);
+    if (type == INSTRU_EVENT_FUNC_RETURN) return;
+    hit = type == INSTRU_EVENT_FUNC_CALL   ? &__instru_func_hits[id]
+          : type == INSTRU_EVENT_EDGE_EXEC ? &__instru_edge_hits[id]
+                                           : &__instru_site_hits[id];
+    if (!__atomic_load_n(hit, __ATOMIC_RELAXED)) __atomic_store_n(hit, 1, __ATOMIC_RELAXED);
+}
+static inline int __instru_edge(unsigned id, int taken) {
+    __instru_probe(INSTRU_EVENT_EDGE_EXEC, id + taken);
+    return taken;
+}
+
+#else
+#error "INSTRU_RUNTIME must be defined by the instrumenter"
+#endif
+
+#endif /* INSTRU_RUNTIME_H */
@@ -0,0 +1,372 @@
+#ifndef INSTRU_RUNTIME_IMPL_H
+#define INSTRU_RUNTIME_IMPL_H
+
+/* Implementation of the instrumentation runtime, included at the end of "<stem>.instru.c".
+ * Every process writes its own output, "<prefix>.<pid>.trace" (trace mode), "<prefix>.<pid>.ctrace"
+ * (compressed-trace mode, see instru_ctrace.h) or "<prefix>.<pid>.cov" (counter and first-hit
+ * modes, see instru_format.h), the prefix is read from $INSTRU_OUTPUT
+ * (default "instru"). A forked child starts a new output with empty buffers and counters, so every
+ * event is reported by exactly one process. Outputs are written at exit(), a killed process loses
+ * what is still buffered. In the trace modes, chunks are sent to a consumer (such as covstream)
+ * instead when $INSTRU_STREAM is the path of its Unix socket. With INSTRU_AFL, the runs forked by
+ * AFL's forkserver only write outputs when $INSTRU_OUTPUT is set. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "instru_ctrace.h"
+#include "instru_format.h"
+#include "instru_output.h"
+
+#ifdef INSTRU_AFL
+#include <sys/shm.h>
+#include <sys/wait.h>
+static int __instru_afl_fuzzing; /* the process is a forkserver run of afl-fuzz */
+/* fuzzing runs would litter the output directory */
+#define INSTRU_SKIP_OUTPUT() (__instru_afl_fuzzing && getenv("INSTRU_OUTPUT") == NULL)
+#else
+#define INSTRU_SKIP_OUTPUT() 0
+#endif
+
+#if INSTRU_RUNTIME == INSTRU_RUNTIME_TRACE || INSTRU_RUNTIME == INSTRU_RUNTIME_COMPRESSED_TRACE
+
+/* The trace has the same events as the printf probes ("STMT_EXEC;;<line>"...), chunks of events
+ * are preceded by "THREAD;<tid>;" and the trace starts with "PROCESS;<pid>;<parent pid>".
+ * Compressed traces have the same chunks, encoded by the thread as events arrive. */
+
+#define INSTRU_TRACE_BUFFER_SIZE (64 * 1024)
+
+struct __instru_trace_buffer {
+    struct __instru_trace_buffer* next;
+    int owned; /* claimed by a live thread */
+    long tid;
+    size_t len;
+#if INSTRU_RUNTIME == INSTRU_RUNTIME_COMPRESSED_TRACE
+    struct __instru_ctrace_encoder encoder;
+#endif
+    char data[INSTRU_TRACE_BUFFER_SIZE];
+};
+
+static struct __instru_trace_buffer* __instru_trace_buffers; /* every buffer ever registered */
+static __thread struct __instru_trace_buffer* __instru_trace_buffer;
+static pthread_key_t __instru_trace_key;
+static int __instru_trace_fd = -1;
+static int __instru_trace_streaming; /* __instru_trace_fd is a connection to $INSTRU_STREAM */
+static pthread_mutex_t __instru_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* A socket can take a chunk in several sends, the lock keeps chunks whole. Sends block while the
+ * consumer is behind, which throttles the program instead of buffering. */
+static void __instru_trace_send(const struct iovec* iov, int n_iov) {
+    int i;
+    pthread_mutex_lock(&__instru_trace_lock);
+    for (i = 0; i < n_iov && __instru_trace_fd >= 0; i++) {
+        const char* p = (const char*)iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+        while (len > 0) {
+            ssize_t n = send(__instru_trace_fd, p, len, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                /* the consumer is gone, the rest of the trace is lost */
+                close(__instru_trace_fd);
+                __instru_trace_fd = -1;
+                break;
+            }
+            p += n;
+            len -= n;
+        }
+    }
+    pthread_mutex_unlock(&__instru_trace_lock);
+}
+
+/* one writev() per chunk on an O_APPEND file, so chunks of different threads never interleave */
+static void __instru_trace_flush(struct __instru_trace_buffer* buf) {
+    char header[64];
+    struct iovec iov[2];
+    int saved_errno = errno;
+#if INSTRU_RUNTIME == INSTRU_RUNTIME_COMPRESSED_TRACE
+    buf->len = (char*)__instru_ctrace_finish(&buf->encoder, (unsigned char*)buf->data + buf->len) - buf->data;
+#endif
+    if (buf->len != 0 && __instru_trace_fd >= 0) {
+        iov[0].iov_base = header;
+#if INSTRU_RUNTIME == INSTRU_RUNTIME_COMPRESSED_TRACE
+        header[0] = INSTRU_CTRACE_CHUNK;
+        iov[0].iov_len = (char*)__instru_ctrace_varint(
+                             __instru_ctrace_varint((unsigned char*)header + 1, (uint64_t)buf->tid), buf->len) -
+                         header;
+#else
+        iov[0].iov_len = snprintf(header, sizeof(header), "THREAD;%ld;\n", buf->tid);
+#endif
+        iov[1].iov_base = buf->data;
+        iov[1].iov_len = buf->len;
+        if (__instru_trace_streaming)
+            __instru_trace_send(iov, 2);
+        else
+            while (writev(__instru_trace_fd, iov, 2) < 0 && errno == EINTR) {
+            }
+    }
+    buf->len = 0;
+#if INSTRU_RUNTIME == INSTRU_RUNTIME_COMPRESSED_TRACE
+    __instru_ctrace_reset(&buf->encoder);
+#endif
+    errno = saved_errno;
+}
+
+/* the consumer reads the same bytes as the file, falls back to the file if it cannot be reached */
+static int __instru_trace_open_output(const char* ext) {
+    const char* path = getenv("INSTRU_STREAM");
+    struct sockaddr_un addr;
+    int fd;
+    __instru_trace_streaming = 0;
+    if (INSTRU_SKIP_OUTPUT()) return -1;
+    if (path == NULL || *path == '\0') return __instru_open_output(ext);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+        __instru_trace_streaming = 1;
+        return fd;
+    }
+    if (fd >= 0) close(fd);
+    fprintf(stderr, "instru: cannot connect to $INSTRU_STREAM '%s', writing the trace to a file\n", path);
+    return __instru_open_output(ext);
+}
+
+static void __instru_trace_write_header(const void* header, size_t len) {
+    struct iovec iov;
+    iov.iov_base = (void*)header;
+    iov.iov_len = len;
+    if (__instru_trace_streaming)
+        __instru_trace_send(&iov, 1);
+    else
+        __instru_write_all(__instru_trace_fd, header, len);
+}
+
+/* lock-free: claim the buffer of an exited thread, or push a new one to the list */
+static struct __instru_trace_buffer* __instru_trace_register(void) {
+    struct __instru_trace_buffer* buf;
+    for (buf = __atomic_load_n(&__instru_trace_buffers, __ATOMIC_ACQUIRE); buf; buf = buf->next) {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&buf->owned, &expected, 1, 0, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED))
+            break;
+    }
+    if (buf == NULL) {
+        buf = (struct __instru_trace_buffer*)malloc(sizeof(*buf));
+        if (buf == NULL) return NULL;
+        buf->owned = 1;
+        buf->len = 0;
+#if INSTRU_RUNTIME == INSTRU_RUNTIME_COMPRESSED_TRACE
+        __instru_ctrace_reset(&buf->encoder);
+#endif
+        buf->next = __atomic_load_n(&__instru_trace_buffers, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&__instru_trace_buffers, &buf->next, buf, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+    buf->tid = syscall(SYS_gettid);
+    __instru_trace_buffer = buf;
+    pthread_setspecific(__instru_trace_key, buf);
+    return buf;
+}
+
+/* thread exit: flush and give the buffer back (a later probe of the thread registers again) */
+static void __instru_trace_release(void* arg) {
+    struct __instru_trace_buffer* buf = (struct __instru_trace_buffer*)arg;
+    __instru_trace_flush(buf);
+    __instru_trace_buffer = NULL;
+    __atomic_store_n(&buf->owned, 0, __ATOMIC_RELEASE);
+}
+
+#if INSTRU_RUNTIME == INSTRU_RUNTIME_COMPRESSED_TRACE
+
+static void __instru_trace_event(unsigned type, unsigned id) {
+    struct __instru_trace_buffer* buf = __instru_trace_buffer;
+    if (buf == NULL && (buf = __instru_trace_register()) == NULL) return;
+    if (buf->len + INSTRU_CTRACE_MAX_EVENT_BYTES > INSTRU_TRACE_BUFFER_SIZE) __instru_trace_flush(buf);
+    buf->len = (char*)__instru_ctrace_add(&buf->encoder, (unsigned char*)buf->data + buf->len, type, id) - buf->data;
+}
+
+static void __instru_trace_open(void) {
+    struct instru_ctrace_header header;
+    __instru_trace_fd = __instru_trace_open_output("ctrace");
+    if (__instru_trace_fd < 0) return;
+    header.magic = INSTRU_CTRACE_MAGIC;
+    header.version = INSTRU_CTRACE_VERSION;
+    header.pid = getpid();
+    header.ppid = getppid();
+    __instru_trace_write_header(&header, sizeof(header));
+}
+
+#else
+
+static void __instru_trace_event(unsigned type, unsigned id) {
+    static const char* const prefixes[] = {"STMT_EXEC;;", "BLOCK_EXEC;;", "FUNC_CALL;",
+                                           "FUNC_RETURN;;", "EDGE_EXEC;;"};
+    struct __instru_trace_buffer* buf = __instru_trace_buffer;
+    char digits[16];
+    const char* s;
+    char* p;
+    int n = 0;
+
+    if (buf == NULL && (buf = __instru_trace_register()) == NULL) return;
+    if (buf->len + 64 > INSTRU_TRACE_BUFFER_SIZE) __instru_trace_flush(buf);
+    p = buf->data + buf->len;
+    for (s = prefixes[type]; *s; s++) *p++ = *s;
+    if (type != INSTRU_EVENT_FUNC_RETURN) {
+        do {
+            digits[n++] = '0' + id % 10;
+            id /= 10;
+        } while (id);
+        while (n) *p++ = digits[--n];
+    }
+    if (type == INSTRU_EVENT_FUNC_CALL) *p++ = ';';
+    *p++ = '\n';
+    buf->len = p - buf->data;
+}
+
+static void __instru_trace_open(void) {
+    char header[64];
+    __instru_trace_fd = __instru_trace_open_output("trace");
+    if (__instru_trace_fd < 0) return;
+    __instru_trace_write_header(header, snprintf(header, sizeof(header), "PROCESS;%ld;%ld\n", (long)getpid(),
+                                                 (long)getppid()));
+}
+
+#endif
+
+/* best effort for threads that are still running */
+static void __instru_trace_exit(void) {
+    struct __instru_trace_buffer* buf;
+    for (buf = __atomic_load_n(&__instru_trace_buffers, __ATOMIC_ACQUIRE); buf; buf = buf->next)
+        __instru_trace_flush(buf);
+}
+
+static void __instru_trace_prepare_fork(void) {
+    if (__instru_trace_buffer != NULL) __instru_trace_flush(__instru_trace_buffer);
+}
+
+/* only the forking thread survives in the child, buffers of the others belong to the parent */
+static void __instru_trace_child(void) {
+    struct __instru_trace_buffer* buf;
+    int parent_fd = __instru_trace_fd;
+    for (buf = __instru_trace_buffers; buf; buf = buf->next) {
+        buf->len = 0;
+#if INSTRU_RUNTIME == INSTRU_RUNTIME_COMPRESSED_TRACE
+        __instru_ctrace_reset(&buf->encoder);
+#endif
+        buf->owned = buf == __instru_trace_buffer;
+    }
+    if (__instru_trace_buffer != NULL) __instru_trace_buffer->tid = syscall(SYS_gettid);
+    pthread_mutex_init(&__instru_trace_lock, NULL);
+    /* the parent's connection is closed after the child's is open, so a consumer waiting for the
+     * last connection does not stop in between */
+    __instru_trace_open();
+    if (parent_fd >= 0) close(parent_fd);
+}
+
+__attribute__((constructor)) static void __instru_trace_init(void) {
+    pthread_key_create(&__instru_trace_key, __instru_trace_release);
+    pthread_atfork(__instru_trace_prepare_fork, NULL, __instru_trace_child);
+#ifndef INSTRU_AFL
+    /* with INSTRU_AFL, opened by __instru_afl_init unless the process is a forkserver */
+    __instru_trace_open();
+#endif
+    atexit(__instru_trace_exit);
+}
+
+#else
+
+static void __instru_cov_dump(void) {
+    struct instru_cov_header header;
+    int fd;
+    if (INSTRU_SKIP_OUTPUT()) return;
+    fd = __instru_open_output("cov");
+    if (fd < 0) return;
+    memset(&header, 0, sizeof(header));
+    header.magic = INSTRU_COV_MAGIC;
+    header.version = INSTRU_COV_VERSION;
+    header.kind =
+        INSTRU_RUNTIME == INSTRU_RUNTIME_COUNTER ? INSTRU_COV_COUNTER : INSTRU_COV_FIRST_HIT;
+    header.site_space = INSTRU_SITE_SPACE;
+    header.n_sites = INSTRU_N_SITES;
+    header.n_funcs = INSTRU_N_FUNCS;
+    header.pid = getpid();
+    header.n_edges = INSTRU_N_EDGES;
+    __instru_write_all(fd, &header, sizeof(header));
+    __instru_write_all(fd, __instru_site_hits, sizeof(__instru_site_hits));
+    __instru_write_all(fd, __instru_func_hits, sizeof(__instru_func_hits));
+    __instru_write_all(fd, __instru_edge_hits, INSTRU_N_EDGES * sizeof(__instru_edge_hits[0]));
+    close(fd);
+}
+
+/* the child reports what it executes itself, the parent keeps the hits before fork() */
+static void __instru_cov_child(void) {
+    memset(__instru_site_hits, 0, sizeof(__instru_site_hits));
+    memset(__instru_func_hits, 0, sizeof(__instru_func_hits));
+    memset(__instru_edge_hits, 0, sizeof(__instru_edge_hits));
+}
+
+/* registered first, so the dump also sees the atexit handlers of the program */
+__attribute__((constructor)) static void __instru_cov_init(void) {
+    pthread_atfork(NULL, NULL, __instru_cov_child);
+    atexit(__instru_cov_dump);
+}
+
+#endif
+
+#ifdef INSTRU_AFL
+
+/* AFL's forkserver protocol (fds 198 and 199): the fuzzer asks for a run, which is a fork of the
+ * initialized process, and is sent its pid and exit status. Without the fuzzer, the hello write
+ * fails and the program runs as usual. */
+#define INSTRU_AFL_FORKSRV_FD 198
+
+static void __instru_afl_forkserver(void) {
+    unsigned char msg[4] = {0, 0, 0, 0};
+    if (write(INSTRU_AFL_FORKSRV_FD + 1, msg, 4) != 4) return;
+    /* set before fork(), the atfork handlers of the child already skip the outputs */
+    __instru_afl_fuzzing = 1;
+    for (;;) {
+        int status;
+        pid_t pid;
+        if (read(INSTRU_AFL_FORKSRV_FD, msg, 4) != 4) _exit(1);
+        pid = fork();
+        if (pid < 0) _exit(1);
+        if (pid == 0) {
+            close(INSTRU_AFL_FORKSRV_FD);
+            close(INSTRU_AFL_FORKSRV_FD + 1);
+            return;
+        }
+        if (write(INSTRU_AFL_FORKSRV_FD + 1, &pid, 4) != 4) _exit(1);
+        if (waitpid(pid, &status, 0) < 0) _exit(1);
+        if (write(INSTRU_AFL_FORKSRV_FD + 1, &status, 4) != 4) _exit(1);
+    }
+}
+
+/* after the constructors of the runtime above, so that runs inherit them initialized */
+__attribute__((constructor)) static void __instru_afl_init(void) {
+    const char* shm_id = getenv("__AFL_SHM_ID");
+    if (shm_id != NULL) {
+        void* area = shmat(atoi(shm_id), NULL, 0);
+        if (area != (void*)-1) __instru_afl_area = (unsigned char*)area;
+    }
+    __instru_afl_forkserver();
+#if INSTRU_RUNTIME == INSTRU_RUNTIME_TRACE || INSTRU_RUNTIME == INSTRU_RUNTIME_COMPRESSED_TRACE
+    /* the forkserver itself has no trace, its runs open theirs in __instru_trace_child */
+    if (!__instru_afl_fuzzing) __instru_trace_open();
+#endif
+}
+
+#endif
+
+#endif /* INSTRU_RUNTIME_IMPL_H */
@@ -0,0 +1,54 @@
+/* Runtime of the LLVM pass backend (libInstruPass.so), linked into the instrumented program.
+ * The pass allocates the counters of the module and registers them from a constructor, dumps have
+ * the format of the counter runtime (instru_format.h). Only one instrumented module per program
+ * is supported, as the sidecar map describes one source file. */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "instru_format.h"
+#include "instru_output.h"
+
+static uint64_t* __instru_site_hits;
+static uint64_t* __instru_func_hits;
+static uint32_t __instru_n_sites, __instru_n_funcs;
+
+static void __instru_ir_dump(void) {
+    struct instru_cov_header header;
+    int fd = __instru_open_output("cov");
+    if (fd < 0) return;
+    memset(&header, 0, sizeof(header));
+    header.magic = INSTRU_COV_MAGIC;
+    header.version = INSTRU_COV_VERSION;
+    header.kind = INSTRU_COV_COUNTER;
+    header.site_space = INSTRU_SITES_BLOCKS;
+    header.n_sites = __instru_n_sites;
+    header.n_funcs = __instru_n_funcs;
+    header.pid = getpid();
+    __instru_write_all(fd, &header, sizeof(header));
+    __instru_write_all(fd, __instru_site_hits, __instru_n_sites * sizeof(uint64_t));
+    __instru_write_all(fd, __instru_func_hits, __instru_n_funcs * sizeof(uint64_t));
+    close(fd);
+}
+
+/* the child reports what it executes itself, the parent keeps the hits before fork() */
+static void __instru_ir_child(void) {
+    memset(__instru_site_hits, 0, __instru_n_sites * sizeof(uint64_t));
+    memset(__instru_func_hits, 0, __instru_n_funcs * sizeof(uint64_t));
+}
+
+void __instru_ir_register(uint64_t* site_hits, uint32_t n_sites, uint64_t* func_hits,
+                          uint32_t n_funcs) {
+    if (__instru_site_hits != NULL) {
+        fprintf(stderr, "instru: only one instrumented module is supported, ignoring the others\n");
+        return;
+    }
+    __instru_site_hits = site_hits;
+    __instru_n_sites = n_sites;
+    __instru_func_hits = func_hits;
+    __instru_n_funcs = n_funcs;
+    pthread_atfork(NULL, NULL, __instru_ir_child);
+    atexit(__instru_ir_dump);
+}
@@ -0,0 +1,139 @@
+/* Sampling profiler, preloaded into a program built with debug info (no source rewriting):
+ *   LD_PRELOAD=build/bin/libinstru_sampler.so INSTRU_OUTPUT=/tmp/prog ./prog
+ * SIGPROF fires every $INSTRU_SAMPLE_INTERVAL microseconds of CPU time (default 1000, all threads
+ * count) and the interrupted PC is counted in a lock-free table. At exit, every process writes
+ * "<prefix>.<pid>.samples" (text, read by covsample):
+ *   SAMPLER;<interval us>;<samples>;<dropped samples>
+ *   MAP;<start>;<end>;<file offset>;<path>     executable mappings, from /proc/self/maps
+ *   PC;<address>;<count>
+ * A forked child starts with an empty table, a killed process loses its samples. */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <ucontext.h>
+
+#include "instru_output.h"
+
+#define INSTRU_SAMPLER_TABLE_SIZE (1 << 16) /* distinct PCs, a power of 2 */
+#define INSTRU_SAMPLER_MAX_PROBES 64
+
+struct __instru_sample {
+    uintptr_t pc; /* 0: empty slot */
+    uint64_t count;
+};
+
+static struct __instru_sample __instru_samples[INSTRU_SAMPLER_TABLE_SIZE];
+static uint64_t __instru_n_samples, __instru_n_dropped;
+static long __instru_sample_interval = 1000;
+
+static uintptr_t __instru_get_pc(void* context) {
+    ucontext_t* uc = (ucontext_t*)context;
+#if defined(__x86_64__)
+    return (uintptr_t)uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__i386__)
+    return (uintptr_t)uc->uc_mcontext.gregs[REG_EIP];
+#elif defined(__aarch64__)
+    return (uintptr_t)uc->uc_mcontext.pc;
+#else
+    (void)uc;
+    return 0;
+#endif
+}
+
+/* async-signal-safe: only atomics on static memory */
+static void __instru_sampler_handler(int sig, siginfo_t* info, void* context) {
+    uintptr_t pc = __instru_get_pc(context);
+    size_t slot, probe;
+    (void)sig;
+    (void)info;
+    __atomic_fetch_add(&__instru_n_samples, 1, __ATOMIC_RELAXED);
+    if (pc == 0) {
+        __atomic_fetch_add(&__instru_n_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    slot = (pc * 0x9e3779b97f4a7c15ull) >> 16;
+    for (probe = 0; probe < INSTRU_SAMPLER_MAX_PROBES; probe++, slot++) {
+        struct __instru_sample* sample = &__instru_samples[slot & (INSTRU_SAMPLER_TABLE_SIZE - 1)];
+        uintptr_t expected = 0;
+        if (__atomic_load_n(&sample->pc, __ATOMIC_RELAXED) == pc ||
+            __atomic_compare_exchange_n(&sample->pc, &expected, pc, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED) ||
+            expected == pc) {
+            __atomic_fetch_add(&sample->count, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+    __atomic_fetch_add(&__instru_n_dropped, 1, __ATOMIC_RELAXED);
+}
+
+static void __instru_sampler_arm(long interval) {
+    struct itimerval timer;
+    timer.it_interval.tv_sec = interval / 1000000;
+    timer.it_interval.tv_usec = interval % 1000000;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+static void __instru_sampler_dump(void) {
+    char line[4096 + 128];
+    FILE* maps;
+    size_t i;
+    int fd;
+
+    __instru_sampler_arm(0);
+    fd = __instru_open_output("samples");
+    if (fd < 0) return;
+    __instru_write_all(fd, line,
+                       snprintf(line, sizeof(line), "SAMPLER;%ld;%llu;%llu\n", __instru_sample_interval,
+                                (unsigned long long)__instru_n_samples,
+                                (unsigned long long)__instru_n_dropped));
+    /* "start-end perms offset dev inode path" */
+    if ((maps = fopen("/proc/self/maps", "r")) != NULL) {
+        char map[4096 + 128], perms[8], path[4096];
+        unsigned long long start, end, offset;
+        while (fgets(map, sizeof(map), maps)) {
+            path[0] = '\0';
+            if (sscanf(map, "%llx-%llx %7s %llx %*s %*s %4095s", &start, &end, perms, &offset, path) < 4) continue;
+            if (perms[2] != 'x' || path[0] != '/') continue;
+            __instru_write_all(fd, line,
+                               snprintf(line, sizeof(line), "MAP;%llx;%llx;%llx;%s\n", start, end, offset, path));
+        }
+        fclose(maps);
+    }
+    for (i = 0; i < INSTRU_SAMPLER_TABLE_SIZE; i++) {
+        if (__instru_samples[i].pc == 0) continue;
+        __instru_write_all(fd, line,
+                           snprintf(line, sizeof(line), "PC;%llx;%llu\n",
+                                    (unsigned long long)__instru_samples[i].pc,
+                                    (unsigned long long)__instru_samples[i].count));
+    }
+    close(fd);
+}
+
+/* interval timers are not inherited by fork() */
+static void __instru_sampler_child(void) {
+    memset(__instru_samples, 0, sizeof(__instru_samples));
+    __instru_n_samples = __instru_n_dropped = 0;
+    __instru_sampler_arm(__instru_sample_interval);
+}
+
+__attribute__((constructor)) static void __instru_sampler_init(void) {
+    struct sigaction action;
+    const char* interval = getenv("INSTRU_SAMPLE_INTERVAL");
+    if (interval && atol(interval) > 0) __instru_sample_interval = atol(interval);
+
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = __instru_sampler_handler;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, NULL);
+    pthread_atfork(NULL, NULL, __instru_sampler_child);
+    atexit(__instru_sampler_dump);
+    __instru_sampler_arm(__instru_sample_interval);
+}
@@ -0,0 +1,64 @@
+#include <string>
+
+#include "LinePatch.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+llvm::cl::OptionCategory linepatchOptionsCategory("Linepatch Options");
+llvm::cl::list<std::string> opt_files(llvm::cl::Positional, llvm::cl::desc("<patch> | --diff <old file> <new file>"),
+                                      llvm::cl::OneOrMore, llvm::cl::cat(linepatchOptionsCategory));
+llvm::cl::opt<std::string> opt_base_file("base",
+                                         llvm::cl::desc("file path to the patched file (default: the file named in the \"---\" line of the patch)"),
+                                         llvm::cl::value_desc("FILEPATH"),
+                                         llvm::cl::cat(linepatchOptionsCategory));
+llvm::cl::opt<std::string> opt_output_file("o", llvm::cl::desc("file path to the result (default: stdout)"),
+                                           llvm::cl::value_desc("FILEPATH"), llvm::cl::init("-"),
+                                           llvm::cl::cat(linepatchOptionsCategory));
+llvm::cl::opt<bool> opt_diff("diff", llvm::cl::desc("Write the patch turning the old file into the new file instead"),
+                             llvm::cl::cat(linepatchOptionsCategory));
+
+int main(int argc, const char **argv) {
+    llvm::cl::SetVersionPrinter([](llvm::raw_ostream &OS) { OS << "Linepatch version 0.1\n"; });
+    llvm::cl::HideUnrelatedOptions(linepatchOptionsCategory);
+    llvm::cl::ParseCommandLineOptions(argc, argv, "Apply the patches written by the fixer and cov_augment (--patch)");
+
+    if (opt_files.size() != (opt_diff ? 2u : 1u)) {
+        llvm::errs() << (opt_diff ? "Expected an old and a new file.\n" : "Expected one patch.\n");
+        return 1;
+    }
+    if (opt_diff) return LinePatch::writeDiffToFile(opt_files[0], opt_files[1], opt_output_file) ? 0 : 1;
+
+    auto patch = llvm::MemoryBuffer::getFileOrSTDIN(opt_files[0]);
+    if (!patch) {
+        llvm::errs() << "Failed to read '" << opt_files[0] << "'.\n";
+        return 1;
+    }
+    std::string baseFile = opt_base_file.empty() ? LinePatch::getOldName((*patch)->getBuffer()) : opt_base_file;
+    if (baseFile.empty()) {
+        llvm::errs() << "No file named in '" << opt_files[0] << "', use --base.\n";
+        return 1;
+    }
+    auto base = llvm::MemoryBuffer::getFile(baseFile);
+    if (!base) {
+        llvm::errs() << "Failed to read '" << baseFile << "'.\n";
+        return 1;
+    }
+
+    // buffered, so that a patch failing halfway writes nothing
+    std::string result, error;
+    llvm::raw_string_ostream resultStream(result);
+    if (!LinePatch::apply((*patch)->getBuffer(), LinePatch::splitLines((*base)->getBuffer()), resultStream, error)) {
+        llvm::errs() << "Failed to apply '" << opt_files[0] << "' to '" << baseFile << "': " << error << "\n";
+        return 1;
+    }
+    std::error_code ec;
+    llvm::raw_fd_ostream os(opt_output_file, ec, llvm::sys::fs::OF_None);
+    if (ec) {
+        llvm::errs() << "Failed to write '" << opt_output_file << "': " << ec.message() << "\n";
+        return 1;
+    }
+    os << resultStream.str();
+    return 0;
+}
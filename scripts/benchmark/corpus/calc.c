@@ -0,0 +1,97 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Arithmetic expressions: "<rounds>" then one expression per line, all evaluated <rounds> times
+ * by a recursive descent parser. Prints every value and their sum. */
+
+#define MAX_EXPRS 1024
+#define MAX_EXPR 256
+#define MOD 1000000007L
+
+static char exprs[MAX_EXPRS][MAX_EXPR];
+static const char* p;
+
+static long expr(void);
+
+static void skip_spaces(void) {
+    while (*p == ' ') p++;
+}
+
+static long factor(void) {
+    long value = 0;
+    skip_spaces();
+    if (*p == '(') {
+        p++;
+        value = expr();
+        skip_spaces();
+        if (*p == ')') p++;
+        return value;
+    }
+    if (*p == '-') {
+        p++;
+        return -factor();
+    }
+    while (isdigit((unsigned char)*p)) value = value * 10 + (*p++ - '0');
+    return value;
+}
+
+static long term(void) {
+    long value = factor();
+    for (;;) {
+        long divisor;
+        skip_spaces();
+        if (*p == '*') {
+            p++;
+            value = value * factor() % MOD;
+        } else if (*p == '/' || *p == '%') {
+            char op = *p++;
+            divisor = factor();
+            if (divisor == 0)
+                value = 0;
+            else
+                value = op == '/' ? value / divisor : value % divisor;
+        } else {
+            return value;
+        }
+    }
+}
+
+static long expr(void) {
+    long value = term();
+    for (;;) {
+        skip_spaces();
+        if (*p == '+') {
+            p++;
+            value = (value + term()) % MOD;
+        } else if (*p == '-') {
+            p++;
+            value = (value - term()) % MOD;
+        } else {
+            return value;
+        }
+    }
+}
+
+int main(void) {
+    long sum = 0;
+    int rounds, r, n = 0, i;
+
+    if (scanf("%d\n", &rounds) != 1) return 1;
+    while (n < MAX_EXPRS && fgets(exprs[n], MAX_EXPR, stdin)) {
+        exprs[n][strcspn(exprs[n], "\n")] = '\0';
+        if (exprs[n][0] != '\0') n++;
+    }
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < n; i++) {
+            p = exprs[i];
+            sum = (sum + expr()) % MOD;
+        }
+    }
+    for (i = 0; i < n && i < 5; i++) {
+        p = exprs[i];
+        printf("%s = %ld\n", exprs[i], expr());
+    }
+    printf("sum %ld\n", sum);
+    return 0;
+}
@@ -0,0 +1,36 @@
+#include <stdio.h>
+
+/* Matrix power modulo a prime: "<n> <iterations>", prints a checksum of the result. */
+
+#define MAX_N 128
+#define MOD 1000003
+
+static long a[MAX_N][MAX_N], b[MAX_N][MAX_N], c[MAX_N][MAX_N];
+
+int main(void) {
+    long sum = 0;
+    int n, iterations, it, i, j, k;
+
+    if (scanf("%d %d", &n, &iterations) != 2 || n < 1 || n > MAX_N) return 1;
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) {
+            a[i][j] = (i * 31 + j * 17) % 10;
+            b[i][j] = i == j;
+        }
+    }
+    for (it = 0; it < iterations; it++) {
+        for (i = 0; i < n; i++) {
+            for (j = 0; j < n; j++) {
+                long s = 0;
+                for (k = 0; k < n; k++) s += b[i][k] * a[k][j];
+                c[i][j] = s % MOD;
+            }
+        }
+        for (i = 0; i < n; i++)
+            for (j = 0; j < n; j++) b[i][j] = c[i][j];
+    }
+    for (i = 0; i < n; i++)
+        for (j = 0; j < n; j++) sum = (sum + b[i][j] * (i + 1)) % MOD;
+    printf("%ld\n", sum);
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Run-length encoding round trips: "<seed> <size> <rounds>", data with runs is generated from the
+ * seed, encoded and decoded <rounds> times. Prints the sizes, or the first mismatch. */
+
+static unsigned long seed;
+
+static unsigned next(void) {
+    seed = seed * 6364136223846793005ul + 1442695040888963407ul;
+    return (unsigned)(seed >> 33);
+}
+
+static size_t encode(const unsigned char* data, size_t size, unsigned char* out) {
+    size_t i = 0, n = 0;
+    while (i < size) {
+        size_t run = 1;
+        while (i + run < size && run < 255 && data[i + run] == data[i]) run++;
+        out[n++] = (unsigned char)run;
+        out[n++] = data[i];
+        i += run;
+    }
+    return n;
+}
+
+static size_t decode(const unsigned char* in, size_t size, unsigned char* out) {
+    size_t i, n = 0;
+    for (i = 0; i + 1 < size; i += 2) {
+        memset(out + n, in[i + 1], in[i]);
+        n += in[i];
+    }
+    return n;
+}
+
+int main(void) {
+    unsigned char *data, *encoded, *decoded;
+    size_t size, encoded_size = 0, decoded_size = 0, i;
+    int rounds, r;
+
+    if (scanf("%lu %zu %d", &seed, &size, &rounds) != 3 || size == 0) return 1;
+    data = malloc(size);
+    encoded = malloc(2 * size);
+    decoded = malloc(size);
+    for (i = 0; i < size;) {
+        unsigned run = 1 + next() % 12;
+        unsigned char value = (unsigned char)(next() % 4);
+        while (run-- > 0 && i < size) data[i++] = value;
+    }
+    for (r = 0; r < rounds; r++) {
+        encoded_size = encode(data, size, encoded);
+        decoded_size = decode(encoded, encoded_size, decoded);
+        if (decoded_size != size || memcmp(data, decoded, size) != 0) {
+            printf("mismatch at round %d\n", r);
+            return 1;
+        }
+    }
+    printf("%zu -> %zu\n", size, encoded_size);
+    return 0;
+}
@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Sorts lines: "<rounds>" then lines, shuffled and merge sorted <rounds> times.
+ * Prints a checksum of every sort and the first lines. */
+
+#define MAX_LINES 8192
+#define MAX_LINE 256
+
+static char* lines[MAX_LINES];
+static char* merged[MAX_LINES];
+
+static void merge_sort(char** a, int n) {
+    int mid, i, j, k;
+    if (n < 2) return;
+    mid = n / 2;
+    merge_sort(a, mid);
+    merge_sort(a + mid, n - mid);
+    i = 0;
+    j = mid;
+    k = 0;
+    while (i < mid && j < n) merged[k++] = strcmp(a[i], a[j]) <= 0 ? a[i++] : a[j++];
+    while (i < mid) merged[k++] = a[i++];
+    while (j < n) merged[k++] = a[j++];
+    memcpy(a, merged, n * sizeof(*a));
+}
+
+static unsigned long checksum(int n) {
+    unsigned long sum = 0;
+    int i;
+    for (i = 0; i < n; i++) sum = sum * 31 + (unsigned char)lines[i][0] + strlen(lines[i]);
+    return sum;
+}
+
+int main(void) {
+    char line[MAX_LINE];
+    unsigned long seed = 12345;
+    int rounds, r, n = 0, i;
+
+    if (scanf("%d\n", &rounds) != 1) return 1;
+    while (n < MAX_LINES && fgets(line, sizeof(line), stdin)) {
+        line[strcspn(line, "\n")] = '\0';
+        lines[n] = malloc(strlen(line) + 1);
+        strcpy(lines[n++], line);
+    }
+    for (r = 0; r < rounds; r++) {
+        for (i = n - 1; i > 0; i--) {
+            char* swap;
+            int j;
+            seed = seed * 6364136223846793005ul + 1442695040888963407ul;
+            j = (int)((seed >> 33) % (unsigned long)(i + 1));
+            swap = lines[i];
+            lines[i] = lines[j];
+            lines[j] = swap;
+        }
+        merge_sort(lines, n);
+        printf("%d %lu\n", r, checksum(n));
+    }
+    for (i = 0; i < n && i < 3; i++) printf("%s\n", lines[i]);
+    return 0;
+}
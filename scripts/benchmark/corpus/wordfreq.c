@@ -0,0 +1,70 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Word frequencies of stdin: "<rounds>" then a text, counted <rounds> times in a hash table.
+ * Prints the 10 most frequent words. */
+
+#define TABLE_SIZE 4096
+#define MAX_WORD 32
+
+struct entry {
+    char word[MAX_WORD];
+    long count;
+};
+
+static struct entry table[TABLE_SIZE];
+static int distinct;
+
+static unsigned hash(const char* s) {
+    unsigned h = 2166136261u;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void add_word(const char* word) {
+    unsigned i = hash(word) % TABLE_SIZE;
+    while (table[i].count != 0 && strcmp(table[i].word, word) != 0) i = (i + 1) % TABLE_SIZE;
+    if (table[i].count == 0) {
+        if (distinct == TABLE_SIZE - 1) return;
+        strcpy(table[i].word, word);
+        distinct++;
+    }
+    table[i].count++;
+}
+
+static int by_count(const void* a, const void* b) {
+    const struct entry* x = a;
+    const struct entry* y = b;
+    if (x->count != y->count) return x->count < y->count ? 1 : -1;
+    return strcmp(x->word, y->word);
+}
+
+int main(void) {
+    static char text[1 << 20];
+    char word[MAX_WORD];
+    size_t len, i;
+    int rounds, r, n;
+
+    if (scanf("%d", &rounds) != 1) return 1;
+    len = fread(text, 1, sizeof(text) - 1, stdin);
+    for (r = 0; r < rounds; r++) {
+        n = 0;
+        for (i = 0; i <= len; i++) {
+            if (i < len && isalpha((unsigned char)text[i])) {
+                if (n < MAX_WORD - 1) word[n++] = tolower((unsigned char)text[i]);
+            } else if (n > 0) {
+                word[n] = '\0';
+                add_word(word);
+                n = 0;
+            }
+        }
+    }
+    qsort(table, TABLE_SIZE, sizeof(table[0]), by_count);
+    for (i = 0; i < 10 && table[i].count != 0; i++) printf("%s %ld\n", table[i].word, table[i].count);
+    return 0;
+}
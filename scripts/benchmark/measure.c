@@ -0,0 +1,57 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Runs a program and writes "<seconds> <max RSS in KB> <exit code>" to the result file.
+ * The max RSS of a process counts the memory it had before exec, so a program forked by the
+ * (large) Python interpreter of the benchmark is measured from this small launcher instead.
+ * Usage: measure RESULT_FILE TIMEOUT_SECONDS PROGRAM [ARGS...] */
+
+static pid_t child;
+
+static void on_alarm(int sig) {
+    (void)sig;
+    kill(child, SIGKILL);
+}
+
+int main(int argc, char** argv) {
+    struct timespec start, end;
+    struct rusage usage;
+    int status, code;
+    FILE* result;
+
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s RESULT_FILE TIMEOUT_SECONDS PROGRAM [ARGS...]\n", argv[0]);
+        return 2;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    child = fork();
+    if (child < 0) return 2;
+    if (child == 0) {
+        execv(argv[3], argv + 3);
+        _exit(127);
+    }
+    signal(SIGALRM, on_alarm);
+    alarm((unsigned)atoi(argv[2]));
+    /* only interrupted waits are retried, any other error would fail forever */
+    while (wait4(child, &status, 0, &usage) < 0) {
+        if (errno != EINTR) {
+            perror("wait4");
+            return 2;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    code = WIFEXITED(status) ? WEXITSTATUS(status) : -WTERMSIG(status);
+    result = fopen(argv[1], "w");
+    if (result == NULL) return 2;
+    fprintf(result, "%.6f %ld %d\n", (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9,
+            usage.ru_maxrss, code);
+    return fclose(result) == 0 ? 0 : 2;
+}
@@ -0,0 +1,227 @@
+#!/usr/bin/env python3
+
+import argparse
+import json
+import math
+import os
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+
+# Runtime overhead of the instrumenter: every program of the corpus (<name>.c, with recorded inputs
+# in <name>.inputs/) is instrumented with every mode, then run on its inputs. The report (JSON)
+# gives, per program and mode, the median time of the runs (summed over inputs), the slowdown
+# against the uninstrumented build, the max RSS, and the bytes of output (stdout of printf probes,
+# traces or dumps). Outputs of the program itself must not change, which is checked too. A mode
+# with a run that could not be measured gets no time (null) and does not match.
+# Example usage: python3 run_overhead_benchmark.py --bin-dir build/bin -o benchmark.json
+
+# mode -> instrumenter options (None: the uninstrumented build, the reference of slowdowns)
+MODES = {
+    "baseline": None,
+    "printf": ["--runtime=printf"],
+    "trace": ["--runtime=trace"],
+    "compressed-trace": ["--runtime=compressed-trace"],
+    "counter": ["--runtime=counter"],
+    "first-hit": ["--runtime=first-hit"],
+    "counter-block": ["--runtime=counter", "--granularity=block"],
+    "counter-edges": ["--runtime=counter", "--edges"],
+}
+
+# printf probes share stdout with the program
+EVENT_PREFIXES = ("STMT_EXEC;", "BLOCK_EXEC;", "FUNC_CALL;", "FUNC_RETURN;", "EDGE_EXEC;")
+
+
+def read_args():
+    script_dir = os.path.dirname(os.path.realpath(__file__))
+    parser = argparse.ArgumentParser(description="Measure the runtime overhead of instrumented programs.")
+
+    parser.add_argument("--bin-dir", metavar="DIR", required=True, help="directory of the instrumenter (build/bin)")
+    parser.add_argument("--corpus", metavar="DIR", default=os.path.join(script_dir, "corpus"),
+                        help="directory of the programs and their inputs (default: corpus next to this script)")
+    parser.add_argument("--modes", metavar="MODES", default=",".join(MODES),
+                        help="comma separated modes (default: all of " + ", ".join(MODES) + ")")
+    parser.add_argument("--programs", metavar="NAMES", help="comma separated programs of the corpus (default: all)")
+    parser.add_argument("--repeat", type=int, default=5, help="runs per input, the median is reported (default: 5)")
+    parser.add_argument("--timeout", type=int, default=120, help="timeout of a run in seconds (default: 120)")
+    parser.add_argument("--cc", default=shutil.which("clang") and "clang" or "cc", help="C compiler (default: clang if found, else cc)")
+    parser.add_argument("--cflags", default="-O2", help="compiler flags of every build (default: -O2)")
+    parser.add_argument("--work-dir", metavar="DIR", help="keep the builds and outputs in this directory (default: a temporary one)")
+    parser.add_argument("-o", "--output", metavar="OUTPUT_FILEPATH", dest="filepath_output",
+                        help="file path to the JSON report (default: stdout)")
+    parser.add_argument("--compare", metavar="JSON_FILEPATH", dest="filepath_compare",
+                        help="previous report: exit with 1 if a slowdown or an output size grew by more than the tolerance")
+    parser.add_argument("--tolerance", type=float, default=0.2, help="relative growth accepted by --compare (default: 0.2)")
+
+    args = parser.parse_args()
+    args.modes = args.modes.split(",")
+    for mode in args.modes:
+        if mode not in MODES:
+            parser.error(f"unknown mode '{mode}'")
+    if "baseline" not in args.modes:
+        args.modes.insert(0, "baseline")
+    return args
+
+
+def build(args, program, mode, work_dir):
+    """Returns the binary, and the time spent in the instrumenter (None for the baseline)."""
+    mode_dir = os.path.join(work_dir, program, mode)
+    os.makedirs(mode_dir, exist_ok=True)
+    source = os.path.join(mode_dir, program + ".c")
+    shutil.copy(os.path.join(args.corpus, program + ".c"), source)
+    instrument_time = None
+    if MODES[mode] is not None:
+        start = time.perf_counter()
+        subprocess.run([os.path.join(args.bin_dir, "instrumenter"), "--no-compilation"] + MODES[mode] + [source, "--"],
+                       check=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        instrument_time = time.perf_counter() - start
+        source = os.path.join(mode_dir, program + ".instru.c")
+    binary = os.path.join(mode_dir, program + ".bin")
+    subprocess.run([args.cc, "-w"] + args.cflags.split() + ["-o", binary, source, "-lpthread", "-lm"], check=True)
+    return binary, instrument_time
+
+
+def run(args, binary, input_file, output_dir):
+    """One run: wall time, max RSS (KB), exit code, program stdout and bytes of instrumentation output.
+    None if the run could not be measured (measure failed)."""
+    shutil.rmtree(output_dir, ignore_errors=True)
+    os.makedirs(output_dir)
+    stdout_file = os.path.join(output_dir, "stdout")
+    result_file = os.path.join(os.path.dirname(output_dir), "measure.txt")
+    env = dict(os.environ, INSTRU_OUTPUT=os.path.join(output_dir, "run"))
+    env.pop("INSTRU_STREAM", None)
+    with open(input_file, "rb") as stdin, open(stdout_file, "wb") as stdout:
+        measured = subprocess.run([args.measure, result_file, str(int(args.timeout)), binary], stdin=stdin,
+                                  stdout=stdout, stderr=subprocess.DEVNULL, env=env)
+    if measured.returncode != 0:
+        print(f"Failed to measure {binary} on {input_file} (exit code {measured.returncode})", file=sys.stderr)
+        return None
+    with open(result_file, "r") as f:
+        elapsed, max_rss, returncode = f.read().split()
+
+    program_output, probe_bytes = [], 0
+    with open(stdout_file, "r", errors="replace") as f:
+        for line in f:
+            if line.startswith(EVENT_PREFIXES):
+                probe_bytes += len(line)
+            else:
+                program_output.append(line)
+    for name in os.listdir(output_dir):
+        if name != "stdout":
+            probe_bytes += os.path.getsize(os.path.join(output_dir, name))
+    return float(elapsed), int(max_rss), int(returncode), "".join(program_output), probe_bytes
+
+
+def geomean(values):
+    values = [v for v in values if v > 0]
+    return math.exp(sum(math.log(v) for v in values) / len(values)) if values else None
+
+
+def benchmark(args, work_dir):
+    # the launcher measuring the runs (see measure.c)
+    args.measure = os.path.join(work_dir, "measure")
+    subprocess.run([args.cc, "-O2", "-o", args.measure, os.path.join(os.path.dirname(os.path.realpath(__file__)), "measure.c")],
+                   check=True)
+    programs = sorted(f[:-2] for f in os.listdir(args.corpus) if f.endswith(".c"))
+    if args.programs:
+        programs = [p for p in programs if p in args.programs.split(",")]
+    report = {"cc": args.cc, "cflags": args.cflags, "repeat": args.repeat, "programs": {}, "summary": {}}
+
+    for program in programs:
+        input_dir = os.path.join(args.corpus, program + ".inputs")
+        inputs = sorted(os.path.join(input_dir, f) for f in os.listdir(input_dir))
+        results, expected = {}, {}
+        for mode in args.modes:
+            print(f"{program}: {mode}", file=sys.stderr)
+            binary, instrument_time = build(args, program, mode, work_dir)
+            total_time, max_rss, probe_bytes, matches, failed = 0.0, 0, 0, True, False
+            for input_file in inputs:
+                times = []
+                for _ in range(args.repeat):
+                    result = run(args, binary, input_file, os.path.join(work_dir, program, mode, "out"))
+                    if result is None:
+                        break
+                    elapsed, rss, returncode, output, probe_bytes_run = result
+                    times.append(elapsed)
+                    max_rss = max(max_rss, rss)
+                # a failed run fails the mode, the other modes and programs are still measured
+                if len(times) < args.repeat:
+                    failed = True
+                    break
+                # the program itself must behave as without instrumentation
+                if mode == "baseline":
+                    expected[input_file] = (returncode, output)
+                elif expected.get(input_file) != (returncode, output):
+                    matches = False
+                total_time += statistics.median(times)
+                probe_bytes += probe_bytes_run
+            results[mode] = {"time_s": None if failed else round(total_time, 6), "max_rss_kb": max_rss,
+                             "output_bytes": probe_bytes, "output_matches": matches and not failed}
+            if instrument_time is not None:
+                results[mode]["instrument_s"] = round(instrument_time, 3)
+        for mode, result in results.items():
+            baseline_time = results["baseline"]["time_s"]
+            result["slowdown"] = (None if result["time_s"] is None or not baseline_time
+                                  else round(result["time_s"] / baseline_time, 3))
+        report["programs"][program] = {"inputs": len(inputs), "modes": results}
+
+    for mode in args.modes:
+        per_program = [report["programs"][p]["modes"][mode] for p in report["programs"]]
+        report["summary"][mode] = {
+            "geomean_slowdown": round(geomean([r["slowdown"] for r in per_program if r["slowdown"] is not None]) or 0, 3),
+            "output_bytes": sum(r["output_bytes"] for r in per_program),
+            "output_matches": all(r["output_matches"] for r in per_program),
+        }
+    return report
+
+
+# regressions against a previous report, for the programs and modes of both
+def compare(report, previous, tolerance):
+    regressions = []
+    for program, data in report["programs"].items():
+        old_modes = previous.get("programs", {}).get(program, {}).get("modes", {})
+        for mode, result in data["modes"].items():
+            old = old_modes.get(mode)
+            if old is None:
+                continue
+            for key in ("slowdown", "output_bytes"):
+                if old[key] is None or result[key] is None:
+                    continue
+                if old[key] > 0 and result[key] > old[key] * (1 + tolerance):
+                    regressions.append(f"{program} {mode}: {key} {old[key]} -> {result[key]}")
+            if result["time_s"] is None:
+                regressions.append(f"{program} {mode}: a run could not be measured")
+            elif old["output_matches"] and not result["output_matches"]:
+                regressions.append(f"{program} {mode}: the program output changed")
+    return regressions
+
+
+if __name__ == "__main__":
+    args = read_args()
+    work_dir = args.work_dir or tempfile.mkdtemp(prefix="instru-benchmark-")
+    try:
+        report = benchmark(args, work_dir)
+    finally:
+        if not args.work_dir:
+            shutil.rmtree(work_dir, ignore_errors=True)
+
+    report_json = json.dumps(report, indent=2)
+    if args.filepath_output:
+        with open(args.filepath_output, "w") as f:
+            f.write(report_json + "\n")
+    else:
+        print(report_json)
+    for mode, summary in report["summary"].items():
+        print(f"{mode:>16}: x{summary['geomean_slowdown']} (geomean), {summary['output_bytes']} bytes of output"
+              + ("" if summary["output_matches"] else ", PROGRAM OUTPUT CHANGED"), file=sys.stderr)
+
+    if args.filepath_compare:
+        with open(args.filepath_compare, "r") as f:
+            regressions = compare(report, json.load(f), args.tolerance)
+        for regression in regressions:
+            print("Regression: " + regression, file=sys.stderr)
+        sys.exit(1 if regressions else 0)
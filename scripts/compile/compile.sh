@@ -19,4 +19,13 @@ elif [[ $SRC =~ "sort" ]]; then
     flags="-lpthread $flags"
 fi
 
+# compile-time instrumentation, e.g. INSTRU_PLUGIN=build/bin/libInstruPlugin.so INSTRU_PLUGIN_ARGS="runtime=trace"
+if [ -n "$INSTRU_PLUGIN" ]; then
+    plugin_flags="-fplugin=$INSTRU_PLUGIN"
+    for arg in $INSTRU_PLUGIN_ARGS; do
+        plugin_flags="$plugin_flags -fplugin-arg-instru-$arg"
+    done
+    flags="$plugin_flags $flags"
+fi
+
 $COMPILER -I$SRC_DIR -I$SCRIPT_DIR ${flags} -w -o $BIN $SRC
@@ -36,79 +36,22 @@ evaluate_generality() {
     $compiler $src_original $base_dir/bin_original.out
 
     # Use qixin5/debloating_study repo for generality experiment. Print the differences between two programs.
-    mkdir -p $base_dir/generality
-    pushd $base_dir/generality > /dev/null
-    mkdir -p $base_dir/dir1 $base_dir/dir2 $base_dir/dir_original
-    for script in $DEBLOATING_STUDY_DIR/expt/debaug/benchmark/$program_name/testscript/I*/*; do
-        # outdir
-        testid=$(basename $(dirname $script))
-        mkdir -p dir1/output/$testid dir2/output/$testid dir_original/output/$testid
-        mkdir -p dir1/output_tmp/$testid dir2/output_tmp/$testid dir_original/output_tmp/$testid
-        # indir
-        input_origin=$DEBLOATING_STUDY_DIR/expt/debaug/benchmark/$program_name/input.origin
-
-        # check if this input is related to the debloating specification
-        if [ -d $input_origin/$testid ]; then
-            if [ $program_name == "make-3.79" ]; then
-                cp -r -p $input_origin/$testid input
-            else
-                cp -r $input_origin/$testid input
-            fi
-        fi
-        tmp_out_dir=$(realpath dir1/output_tmp/$testid)
-        tmp_dir=workdir
-        rm -rf $tmp_dir; mkdir -p $tmp_dir/input
-        pushd $tmp_dir > /dev/null
-        create_wrapper_to_check_related eval_bin.py $base_dir/debloating_specification_inputs.txt is_related
-        bash $script ./eval_bin.py $tmp_out_dir 1 $input_origin/$testid &>/dev/null
-        popd > /dev/null
-        if [[ ! -f $tmp_dir/is_related ]]; then
-            rm -rf $tmp_dir
-            if [[ $should_check_related_input == "1" ]]; then
-                continue
-            fi
-        fi
-
-        # compile (testing rm may get the binary removed; same filename for same "usage" output)
-        # run script with args: "binary outdir timeout indir"
-        for bin in 1 2 _original; do
-            out_dir=$(realpath dir${bin}/output/$testid)
-            tmp_out_dir=$(realpath dir${bin}/output_tmp/$testid)
-
-            tmp_dir=workdir
-            rm -rf $tmp_dir; mkdir -p $tmp_dir/input
-            pushd $tmp_dir > /dev/null
-
-            if [ -d $input_origin/$testid ]; then
-                if [ $program_name == "make-3.79" ]; then
-                    cp -r -p $input_origin/$testid input
-                else
-                    cp -r $input_origin/$testid input
-                fi
-            fi
-
-            # echo "Running $program_name bin${bin}.out on $testid ($(date +%H:%M:%S))"
-
-            cp $base_dir/bin${bin}.out eval_bin
-            bash $script ./eval_bin $out_dir 1 input/$testid &>/dev/null
-
-            popd > /dev/null
-            rm -rf $tmp_dir
-        done
-        # copy outputs to base_dir
-        cp -r dir1/output $base_dir/dir1
-        cp -r dir2/output $base_dir/dir2
-        cp -r dir_original/output $base_dir/dir_original
-    done
-    popd > /dev/null
+    benchmark_dir=$DEBLOATING_STUDY_DIR/expt/debaug/benchmark/$program_name
+    geneval_args=()
+    # check if the inputs are related to the debloating specification
+    if [[ $should_check_related_input == "1" ]]; then
+        create_wrapper_to_check_related $base_dir/eval_bin.py $base_dir/debloating_specification_inputs.txt is_related
+        geneval_args+=(--related-checker $base_dir/eval_bin.py --related-cache $base_dir/related_inputs.txt)
+    fi
+    if [ $program_name == "make-3.79" ]; then
+        geneval_args+=(--preserve)
+    fi
 
-    # count files that do not contain "INPUT_NOT_IN_SPEC"
-    total_count=$(find $base_dir/dir_original/output -type f | xargs grep -L "INPUT_NOT_IN_SPEC" | wc -l)
-    differ_count_1=$(diff -qr $base_dir/dir1/output $base_dir/dir_original/output | grep -c "^Files.*differ$")
-    differ_count_2=$(diff -qr $base_dir/dir2/output $base_dir/dir_original/output | grep -c "^Files.*differ$")
     echo | tee -a $result_file
-    echo "Generality problems count (before augmentation): $differ_count_1/$total_count" | tee -a $result_file
-    echo "Generality problems count (after augmentation): $differ_count_2/$total_count" | tee -a $result_file
+    $ANALYSIS_TOOLS_DIR/build/bin/geneval --testscripts $benchmark_dir/testscript --inputs $benchmark_dir/input.origin \
+        --original $base_dir/bin_original.out --binary "before augmentation=$base_dir/bin1.out" \
+        --binary "after augmentation=$base_dir/bin2.out" --work-dir $base_dir/generality "${geneval_args[@]}" \
+        | grep "^Generality problems count" | tee -a $result_file
 }
 
 # TODO Not finished
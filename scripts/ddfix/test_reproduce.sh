@@ -29,19 +29,25 @@ fi
 
 
 # Try to reproduce the crash/hang in the debloated program
-bash $COMPILE_SCRIPT $DEBLOATED_SRC $DEBLOATED_SRC.test.temp &> /dev/null
+# in a private directory, so that concurrent reproductions do not share the binary or the files the crash writes
+sandbox_dir=$(mktemp -d)
+# also when the script is interrupted (run scripts may remove the permissions of the files they create)
+trap 'chmod -R u+rwX "$sandbox_dir"; rm -rf "$sandbox_dir"' EXIT
+output_dir=$(pwd)
+bash $COMPILE_SCRIPT $DEBLOATED_SRC $sandbox_dir/test.temp &> /dev/null
+pushd $sandbox_dir > /dev/null
 if [[ OUTPUT_TO_FILE -eq 1 ]]; then
     crash_id=$(echo $RUN_SCRIPT | cut -d: -f1 | rev | cut -d/ -f1 | rev)
-    bash $RUN_SCRIPT $DEBLOATED_SRC.test.temp &> ${crash_id}_output
+    bash $RUN_SCRIPT ./test.temp &> $output_dir/${crash_id}_output
 else
-    bash $RUN_SCRIPT $DEBLOATED_SRC.test.temp &> /dev/null
+    bash $RUN_SCRIPT ./test.temp &> /dev/null
 fi
+retcode=$?
+popd > /dev/null
 # crash = ((retcode >= 131 && retcode <= 136) || retcode == 139)
 # hang = (retcode == 124 || retcode == 137)
-if [[ $? -eq 124 || $? -eq 137 || ($? -ge 131 && $? -le 136) || $? -eq 139 ]]; then
-    rm $DEBLOATED_SRC.test.temp
+if [[ $retcode -eq 124 || $retcode -eq 137 || ($retcode -ge 131 && $retcode -le 136) || $retcode -eq 139 ]]; then
     exit 0
 else
-    rm $DEBLOATED_SRC.test.temp
     exit 1
 fi
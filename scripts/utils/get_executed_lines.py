@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+
+import argparse
+
+
+# Collect executed lines from the output of an instrumented program.
+#   STMT_EXEC;;<line>    (statement granularity) -> the line itself
+#   BLOCK_EXEC;;<id>     (block granularity)     -> all lines of the block, read from the sidecar map
+# Blocks without a probe ("instrumenter --overhead-budget") are executed when their implicants are
+# (BLOCK_IMPLIED records of the sidecar map).
+# The output has the same format as the debloated lines file (numbers separated by space).
+
+
+def read_args():
+    parser = argparse.ArgumentParser(description="Find out all lines that get executed in an instrumented program.")
+
+    parser.add_argument("-o", "--output", metavar="OUTPUT_FILEPATH", default="executed-lines.txt",
+                        help="file path to the output file (default: executed-lines.txt)", dest="filepath_output")
+    parser.add_argument("-m", "--map", metavar="MAP_FILEPATH", dest="filepath_map",
+                        help="file path to the sidecar map of the instrumented program (<stem>.instru.map, required for block granularity)")
+
+    parser.add_argument("filepath_outputs", metavar="PROGRAM_OUTPUT_FILEPATH", nargs="+", help="file path to the output of the instrumented program")
+
+    return parser.parse_args()
+
+
+def read_block_lines(filepath_map):
+    block_lines, implied_blocks = {}, {}
+    if not filepath_map:
+        return block_lines, implied_blocks
+    with open(filepath_map, "r") as f:
+        for record in f:
+            kind, block_id, payload = record.rstrip("\n").split(";", 2)
+            if kind == "BLOCK_EXEC":
+                block_lines[block_id] = [int(line) for line in payload.split()]
+            elif kind == "BLOCK_IMPLIED":
+                # "EQUIV <id>" or "DOM <id> <id>...", executed if any implicant is
+                implied_blocks[block_id] = payload.split()[1:]
+    return block_lines, implied_blocks
+
+
+if __name__ == "__main__":
+    args = read_args()
+    block_lines, implied_blocks = read_block_lines(args.filepath_map)
+    executed_lines, executed_blocks, unknown_blocks = set(), set(), set()
+    for filepath_output in args.filepath_outputs:
+        with open(filepath_output, "r", errors="replace") as f:
+            for line in f:
+                if line.startswith("STMT_EXEC;;"):
+                    line_number = line.rstrip("\n")[len("STMT_EXEC;;"):]
+                    if line_number.isdigit():
+                        executed_lines.add(int(line_number))
+                elif line.startswith("BLOCK_EXEC;;"):
+                    block_id = line.rstrip("\n")[len("BLOCK_EXEC;;"):]
+                    if not block_id in block_lines:
+                        unknown_blocks.add(block_id)
+                        continue
+                    executed_blocks.add(block_id)
+    for block_id, implicants in implied_blocks.items():
+        if any(implicant in executed_blocks for implicant in implicants):
+            executed_blocks.add(block_id)
+    for block_id in executed_blocks:
+        executed_lines.update(block_lines.get(block_id, []))
+    if unknown_blocks:
+        print(f"Ignored {len(unknown_blocks)} unknown blocks (missing --map?)")
+    # output to file
+    print(f"Output executed lines to file '{args.filepath_output}'.")
+    with open(args.filepath_output, "w") as f:
+        f.write(" " + " ".join(map(str, sorted(executed_lines))))
@@ -0,0 +1,51 @@
+#!/usr/bin/env python3
+
+import argparse
+import sys
+
+
+# Decode the output of an instrumented program into readable events.
+# FUNC_CALL probes only carry a signature id ("FUNC_CALL;<id>;"), the signature is resolved with the
+# FUNC_SIG records of the sidecar map ("FUNC_SIG;<id>;<signature>"). Other lines are kept as they are.
+
+
+def read_args():
+    parser = argparse.ArgumentParser(description="Resolve function signatures in the output of an instrumented program.")
+
+    parser.add_argument("-o", "--output", metavar="OUTPUT_FILEPATH", dest="filepath_output",
+                        help="file path to the output file (default: stdout)")
+    parser.add_argument("--only-events", action="store_true", help="drop lines that are not instrumentation events")
+
+    parser.add_argument("filepath_map", metavar="MAP_FILEPATH", help="file path to the sidecar map of the instrumented program (<stem>.instru.map)")
+    parser.add_argument("filepath_trace", metavar="PROGRAM_OUTPUT_FILEPATH", help="file path to the output of the instrumented program")
+
+    return parser.parse_args()
+
+
+def read_signatures(filepath_map):
+    signatures = {}
+    with open(filepath_map, "r") as f:
+        for record in f:
+            kind, sig_id, payload = record.rstrip("\n").split(";", 2)
+            if kind == "FUNC_SIG":
+                signatures[sig_id] = payload
+    return signatures
+
+
+EVENTS = ("STMT_EXEC;", "BLOCK_EXEC;", "FUNC_CALL;", "FUNC_RETURN;")
+
+
+if __name__ == "__main__":
+    args = read_args()
+    signatures = read_signatures(args.filepath_map)
+    output = open(args.filepath_output, "w") if args.filepath_output else sys.stdout
+    with open(args.filepath_trace, "r", errors="replace") as f:
+        for line in f:
+            if line.startswith("FUNC_CALL;"):
+                _, sig_id, stmt_line = line.rstrip("\n").split(";", 2)
+                line = f"FUNC_CALL;{signatures.get(sig_id, '<unknown:' + sig_id + '>')};{stmt_line}\n"
+            elif args.only_events and not line.startswith(EVENTS):
+                continue
+            output.write(line)
+    if output is not sys.stdout:
+        output.close()